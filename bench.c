@@ -0,0 +1,339 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file bench.c
+/// @author Harry Austen
+/// @brief Program for benchmarking the ydotool code paths that don't need a uinput device
+
+// System includes
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// Local includes
+#include "protocol.h"
+#include "ring.h"
+#include "uinput.h"
+
+/// Number of events passed through each transport
+#define BENCH_TRANSPORT_EVENTS (1 << 24)
+
+/// Number of events written per batch, as for a full struct uinput_batch
+#define BENCH_BATCH UINPUT_BATCH_SIZE
+
+/// Number of characters typed by the typing benchmark
+#define BENCH_TYPE_CHARS (8 << 20)
+
+/// @brief Consumer side of a transport benchmark
+struct bench_consumer {
+    /// Socket or eventfd to wait on
+    int fd;
+    /// Ring to read from, NULL for the socket transport
+    struct ydotool_ring * ring;
+    /// Number of events received
+    size_t received;
+};
+
+/// Get the current CLOCK_MONOTONIC time in seconds
+/// @return Seconds since an arbitrary fixed point
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/// Fill a batch with alternating key press/release frames
+/// @param [out] events The batch to fill
+static void bench_fill(struct uinput_raw_data * events) {
+    for (size_t i = 0; i != BENCH_BATCH; i += 2) {
+        events[i].type = EV_KEY;
+        events[i].code = KEY_A;
+        events[i].value = (int32_t)((i / 2) & 1);
+        events[i + 1].type = EV_SYN;
+        events[i + 1].code = SYN_REPORT;
+        events[i + 1].value = 0;
+    }
+}
+
+/// Receive version 2 event messages until all events have arrived, as ydotoold does
+/// @param arg The struct bench_consumer
+/// @return NULL
+static void * bench_socket_consumer(void * arg) {
+    struct bench_consumer * consumer = arg;
+    static unsigned char buf[65536];
+    size_t len = 0;
+
+    while (consumer->received != BENCH_TRANSPORT_EVENTS) {
+        ssize_t rc = recv(consumer->fd, buf + len, sizeof(buf) - len, 0);
+        if (rc <= 0) {
+            break;
+        }
+        len += (size_t)rc;
+
+        size_t used = 0;
+        struct ydotool_msg_header header;
+        while (len - used >= sizeof(header)) {
+            memcpy(&header, buf + used, sizeof(header));
+            size_t size = sizeof(header) + header.count * sizeof(struct uinput_raw_data);
+            if (len - used < size) {
+                break;
+            }
+            consumer->received += header.count;
+            used += size;
+        }
+        memmove(buf, buf + used, len - used);
+        len -= used;
+    }
+    return NULL;
+}
+
+/// Read the shared memory ring until all events have arrived, as ydotoold does
+/// @param arg The struct bench_consumer
+/// @return NULL
+static void * bench_ring_consumer(void * arg) {
+    struct bench_consumer * consumer = arg;
+    struct uinput_raw_data events[1024];
+
+    while (consumer->received != BENCH_TRANSPORT_EVENTS) {
+        size_t count = ydotool_ring_peek(consumer->ring, YDOTOOL_RING_DEFAULT_SIZE, events, 1024);
+        if (count) {
+            ydotool_ring_advance(consumer->ring, count);
+            consumer->received += count;
+            continue;
+        }
+        if (!ydotool_ring_sleep(consumer->ring)) {
+            struct pollfd pfd = { consumer->fd, POLLIN, 0 };
+            eventfd_t value;
+            poll(&pfd, 1, -1);
+            eventfd_read(consumer->fd, &value);
+        }
+    }
+    return NULL;
+}
+
+/// Pass events over a socket pair using the version 2 protocol messages
+/// @return Seconds taken, or a negative number on error
+static double bench_socket() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+        fprintf(stderr, "Failed to create socket pair: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct bench_consumer consumer = { fds[1], NULL, 0 };
+    struct uinput_raw_data events[BENCH_BATCH];
+    bench_fill(events);
+
+    double start = bench_now();
+    pthread_t thd;
+    pthread_create(&thd, NULL, bench_socket_consumer, &consumer);
+
+    for (size_t sent = 0; sent != BENCH_TRANSPORT_EVENTS; sent += BENCH_BATCH) {
+        struct ydotool_msg_header header = { YDOTOOL_MSG_EVENTS, 0, BENCH_BATCH };
+        unsigned char msg[sizeof(header) + sizeof(events)];
+        memcpy(msg, &header, sizeof(header));
+        memcpy(msg + sizeof(header), events, sizeof(events));
+        for (size_t off = 0; off != sizeof(msg);) {
+            ssize_t rc = write(fds[0], msg + off, sizeof(msg) - off);
+            if (rc <= 0) {
+                break;
+            }
+            off += (size_t)rc;
+        }
+    }
+
+    pthread_join(thd, NULL);
+    double elapsed = bench_now() - start;
+
+    close(fds[0]);
+    close(fds[1]);
+    return consumer.received == BENCH_TRANSPORT_EVENTS ? elapsed : -1;
+}
+
+/// Pass events through a shared memory ring signalled by an eventfd
+/// @param [out] wakes Number of times the consumer had to be signalled
+/// @return Seconds taken, or a negative number on error
+static double bench_ring(size_t * wakes) {
+    size_t bytes = ydotool_ring_bytes(YDOTOOL_RING_DEFAULT_SIZE);
+    struct ydotool_ring * ring = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    int fd = eventfd(0, EFD_NONBLOCK);
+    if (ring == MAP_FAILED || fd == -1) {
+        fprintf(stderr, "Failed to set up ring: %s\n", strerror(errno));
+        return -1;
+    }
+    ydotool_ring_init(ring, YDOTOOL_RING_DEFAULT_SIZE);
+
+    struct bench_consumer consumer = { fd, ring, 0 };
+    struct uinput_raw_data events[BENCH_BATCH];
+    bench_fill(events);
+    *wakes = 0;
+
+    double start = bench_now();
+    pthread_t thd;
+    pthread_create(&thd, NULL, bench_ring_consumer, &consumer);
+
+    for (size_t sent = 0; sent != BENCH_TRANSPORT_EVENTS; sent += BENCH_BATCH) {
+        // Ring full, keep batches whole like the real producer
+        while (ydotool_ring_space(ring) < BENCH_BATCH) {
+            sched_yield();
+        }
+        ydotool_ring_write(ring, events, BENCH_BATCH);
+        if (ydotool_ring_needs_wake(ring)) {
+            eventfd_write(fd, 1);
+            ++*wakes;
+        }
+    }
+
+    pthread_join(thd, NULL);
+    double elapsed = bench_now() - start;
+
+    close(fd);
+    munmap(ring, bytes);
+    return consumer.received == BENCH_TRANSPORT_EVENTS ? elapsed : -1;
+}
+
+/// Compare the socket and shared memory transports between ydotool and ydotoold
+/// @return 0 on success, >0 if errors
+int bench_transport() {
+    size_t wakes = 0;
+    double socket_time = bench_socket();
+    double ring_time = bench_ring(&wakes);
+
+    if (socket_time < 0 || ring_time < 0) {
+        printf("transport: FAILED\n");
+        return 1;
+    }
+
+    printf("transport: %d events in batches of %d\n", BENCH_TRANSPORT_EVENTS, BENCH_BATCH);
+    printf("    socket: %8.3fs %12.0f events/s\n", socket_time, BENCH_TRANSPORT_EVENTS / socket_time);
+    printf("    shm:    %8.3fs %12.0f events/s (%zu wakeups)\n", ring_time, BENCH_TRANSPORT_EVENTS / ring_time, wakes);
+    return 0;
+}
+
+/// Number of events written out by bench_count()
+static size_t BENCH_EVENTS = 0;
+
+/// Batch output that only counts the events, so typing is timed without a device
+/// @param events The events, unused
+/// @param count Number of events
+/// @return 0
+static int bench_count(const struct uinput_raw_data * events, size_t count) {
+    (void)events;
+    BENCH_EVENTS += count;
+    return 0;
+}
+
+/// Type a text one character at a time, each looked up in the key tables, as before the
+/// character table
+/// @param text The characters to type
+/// @param len Number of characters
+/// @return Seconds taken, or a negative number on error
+static double bench_type_per_char(const char * text, size_t len) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    batch.emit = bench_count;
+
+    double start = bench_now();
+    for (size_t i = 0; i != len; ++i) {
+        if (uinput_batch_enter_char(&batch, text[i])) {
+            return -1;
+        }
+    }
+    uinput_batch_flush(&batch);
+    return bench_now() - start;
+}
+
+/// Type a text through the character table, checking it all first
+/// @param text The characters to type
+/// @param len Number of characters
+/// @return Seconds taken, or a negative number on error
+static double bench_type_table(const char * text, size_t len) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    batch.emit = bench_count;
+
+    double start = bench_now();
+    if (uinput_batch_type(&batch, text, len, 0)) {
+        return -1;
+    }
+    uinput_batch_flush(&batch);
+    return bench_now() - start;
+}
+
+/// Compare typing text character by character with typing it through the character table
+/// @return 0 on success, >0 if errors
+int bench_type() {
+    // Prose-like text: mostly small letters, with capitals, punctuation and newlines mixed in
+    static const char words[] = "The quick brown fox jumps over the lazy dog, (again) & again!\n";
+    char * text = malloc(BENCH_TYPE_CHARS);
+    if (!text) {
+        fprintf(stderr, "Failed to allocate text to type\n");
+        return 1;
+    }
+    for (size_t i = 0; i != BENCH_TYPE_CHARS; ++i) {
+        text[i] = words[i % (sizeof(words) - 1)];
+    }
+
+    BENCH_EVENTS = 0;
+    double per_char_time = bench_type_per_char(text, BENCH_TYPE_CHARS);
+    size_t per_char_events = BENCH_EVENTS;
+    BENCH_EVENTS = 0;
+    double table_time = bench_type_table(text, BENCH_TYPE_CHARS);
+    size_t table_events = BENCH_EVENTS;
+
+    double check_start = bench_now();
+    int check = uinput_check_text(text, BENCH_TYPE_CHARS);
+    double check_time = bench_now() - check_start;
+
+    // Mixed-script text: Cyrillic words, entered by code point, between ASCII ones
+    static const char mixed_words[] = "\xd0\x91\xd1\x8b\xd1\x81\xd1\x82\xd1\x80\xd0\xb0\xd1\x8f brown \xd0\xbb\xd0\xb8\xd1\x81\xd0\xb0 jumps!\n";
+    for (size_t i = 0; i != BENCH_TYPE_CHARS; ++i) {
+        text[i] = mixed_words[i % (sizeof(mixed_words) - 1)];
+    }
+    size_t mixed_len = uinput_text_complete(text, BENCH_TYPE_CHARS);
+    BENCH_EVENTS = 0;
+    double mixed_time = bench_type_table(text, mixed_len);
+    size_t mixed_events = BENCH_EVENTS;
+    free(text);
+
+    if (per_char_time < 0 || table_time < 0 || check || mixed_time < 0) {
+        printf("type: FAILED\n");
+        return 1;
+    }
+
+    double mib = BENCH_TYPE_CHARS / (double)(1 << 20);
+    printf("type: %.0f MiB of text\n", mib);
+    printf("    per char: %8.3fs %8.1f MiB/s %10zu events\n", per_char_time, mib / per_char_time, per_char_events);
+    printf("    table:    %8.3fs %8.1f MiB/s %10zu events\n", table_time, mib / table_time, table_events);
+    printf("    check:    %8.3fs %8.1f MiB/s\n", check_time, mib / check_time);
+    printf("    mixed:    %8.3fs %8.1f MiB/s %10zu events\n", mixed_time, (double)mixed_len / (1 << 20) / mixed_time, mixed_events);
+    return 0;
+}
+
+/// Main entrypoint for the benchmark executable
+/// @return 0 on success, >0 if errors
+int main() {
+    int ret = 0;
+
+    ret += bench_transport();
+    ret += bench_type();
+
+    return ret;
+}
@@ -0,0 +1,129 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file gamepad.c
+/// @author Harry Austen
+/// @brief Implementation of driving the virtual gamepad from samples of its controls
+
+// System includes
+#include <stdlib.h>
+#include <string.h>
+
+// Local includes
+#include "gamepad.h"
+
+// Nothing sampled
+void gamepad_init(struct gamepad * gamepad) {
+    memset(gamepad, 0, sizeof(*gamepad));
+}
+
+// Control by name
+int gamepad_find(const char * name, size_t len) {
+    for (int i = 0; i != UINPUT_GAMEPAD_CONTROLS; ++i) {
+        if (len < sizeof(GAMEPAD_CONTROLS[i].name) && !strncmp(GAMEPAD_CONTROLS[i].name, name, len) && !GAMEPAD_CONTROLS[i].name[len]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Control by event
+int gamepad_find_code(uint16_t type, uint16_t code) {
+    for (int i = 0; i != UINPUT_GAMEPAD_CONTROLS; ++i) {
+        if (GAMEPAD_CONTROLS[i].type == type && GAMEPAD_CONTROLS[i].code == code) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Parse a sample
+int gamepad_parse(const char * token, size_t len, int * control, int32_t * value) {
+    const char * equals = memchr(token, '=', len);
+    if (!equals || (size_t)(equals - token) + 1 == len) {
+        return 1;
+    }
+
+    *control = gamepad_find(token, (size_t)(equals - token));
+    if (*control == -1) {
+        return 1;
+    }
+
+    // The value ends where the token does
+    char * end;
+    long parsed = strtol(equals + 1, &end, 10);
+    if (end != token + len) {
+        return 1;
+    }
+    *value = parsed > INT32_MAX ? INT32_MAX : parsed < INT32_MIN ? INT32_MIN : (int32_t)parsed;
+    return 0;
+}
+
+// Sample a control
+int gamepad_set(struct gamepad * gamepad, int control, int32_t value) {
+    const struct uinput_gamepad_control * info = &GAMEPAD_CONTROLS[control];
+    if (value < info->minimum) {
+        value = info->minimum;
+    } else if (value > info->maximum) {
+        value = info->maximum;
+    }
+
+    if (info->type == EV_ABS) {
+        gamepad->axes[control] = value;
+        gamepad->dirty |= (uint32_t)1 << control;
+        return 0;
+    }
+
+    if (gamepad->num_presses == GAMEPAD_MAX_PRESSES) {
+        return 1;
+    }
+    struct uinput_raw_data * press = &gamepad->presses[gamepad->num_presses++];
+    press->type = EV_KEY;
+    press->code = (uint16_t)control;
+    press->value = value;
+    return 0;
+}
+
+// Frames of everything sampled
+int gamepad_batch(struct uinput_batch * batch, struct gamepad * gamepad) {
+    if (!gamepad->dirty && !gamepad->num_presses) {
+        return 0;
+    }
+
+    if (uinput_batch_add(batch, UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_GAMEPAD)) {
+        return 1;
+    }
+    for (int i = 0; i != UINPUT_GAMEPAD_CONTROLS; ++i) {
+        if ((gamepad->dirty >> i) & 1 && uinput_batch_add(batch, EV_ABS, GAMEPAD_CONTROLS[i].code, gamepad->axes[i])) {
+            return 1;
+        }
+    }
+    gamepad->dirty = 0;
+
+    // A button already in the frame starts a new one, so none of its changes are lost
+    uint32_t in_frame = 0;
+    for (size_t i = 0; i != gamepad->num_presses; ++i) {
+        const struct uinput_raw_data * press = &gamepad->presses[i];
+        if ((in_frame >> press->code) & 1) {
+            if (uinput_batch_sync(batch) || uinput_batch_add(batch, UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_GAMEPAD)) {
+                return 1;
+            }
+            in_frame = 0;
+        }
+        in_frame |= (uint32_t)1 << press->code;
+        if (uinput_batch_add(batch, EV_KEY, GAMEPAD_CONTROLS[press->code].code, press->value)) {
+            return 1;
+        }
+    }
+    gamepad->num_presses = 0;
+
+    return uinput_batch_sync(batch);
+}
@@ -0,0 +1,82 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file gamepad.h
+/// @author Harry Austen
+/// @brief Interface for driving the virtual gamepad from samples of its controls
+
+#ifndef __GAMEPAD_H__
+#define __GAMEPAD_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Local includes
+#include "uinput.h"
+
+/// Maximum number of button changes held between two updates
+#define GAMEPAD_MAX_PRESSES 64
+
+/// @brief Gamepad controls sampled since the last update
+/// @details Axes are coalesced, only their latest value is kept. Button changes are kept in order,
+/// so a press and release arriving between two updates are both seen
+struct gamepad {
+    /// Latest value of each axis, indexed like GAMEPAD_CONTROLS
+    int32_t axes[UINPUT_GAMEPAD_CONTROLS];
+    /// Bit per control in GAMEPAD_CONTROLS, set for axes sampled since the last update
+    uint32_t dirty;
+    /// Button changes since the last update, in order, with the index of the control as code
+    struct uinput_raw_data presses[GAMEPAD_MAX_PRESSES];
+    /// Number of button changes held
+    size_t num_presses;
+};
+
+/// @brief Prepare a gamepad with nothing sampled
+/// @param gamepad The gamepad
+void gamepad_init(struct gamepad * gamepad);
+
+/// @brief Find a control by name
+/// @param name Name of the control (e.g. "rx" or "south")
+/// @param len Length of the name
+/// @return Index of the control in GAMEPAD_CONTROLS, -1 if not found
+int gamepad_find(const char * name, size_t len);
+
+/// @brief Find a control by event
+/// @param type EV_ABS or EV_KEY
+/// @param code The axis or button
+/// @return Index of the control in GAMEPAD_CONTROLS, -1 if not found
+int gamepad_find_code(uint16_t type, uint16_t code);
+
+/// @brief Parse a "<control>=<value>" sample
+/// @param token The sample, which needn't be NUL terminated
+/// @param len Length of the sample
+/// @param [out] control Index of the control in GAMEPAD_CONTROLS
+/// @param [out] value Value of the control
+/// @return 0 on success, 1 if malformed or the control is unknown
+int gamepad_parse(const char * token, size_t len, int * control, int32_t * value);
+
+/// @brief Take in a sample of a control, clamped to the control's range
+/// @param gamepad The gamepad
+/// @param control Index of the control in GAMEPAD_CONTROLS
+/// @param value Value of the control
+/// @return 0 on success, 1 if GAMEPAD_MAX_PRESSES button changes are already held
+int gamepad_set(struct gamepad * gamepad, int control, int32_t value);
+
+/// @brief Append frames for the gamepad device with everything sampled since the last update
+/// @details Usually a single frame. A button changing more than once gets a frame per change.
+/// Nothing is appended if nothing has been sampled
+/// @param batch The batch to append to
+/// @param gamepad The gamepad, left with nothing sampled
+/// @return 0 on success, 1 if error(s)
+int gamepad_batch(struct uinput_batch * batch, struct gamepad * gamepad);
+
+#endif // __GAMEPAD_H__
@@ -0,0 +1,160 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file gesture.c
+/// @author Harry Austen
+/// @brief Implementation of multitouch gestures on the virtual touchscreen
+
+// System includes
+#include <math.h>
+#include <stdio.h>
+
+// Local includes
+#include "gesture.h"
+
+/// Tracking ID given to the next finger touching down
+static uint16_t GESTURE_TRACKING_ID = 0;
+
+/// Finger count buttons, for readers that don't understand multitouch, indexed by fingers - 1
+static const uint16_t GESTURE_TOOLS[] = {
+    BTN_TOOL_FINGER, BTN_TOOL_DOUBLETAP, BTN_TOOL_TRIPLETAP, BTN_TOOL_QUADTAP, BTN_TOOL_QUINTTAP
+};
+
+/// Work out the positions of all fingers at a point of a gesture
+/// @param gesture The gesture
+/// @param t Progress from touching down (0) to lifting (1)
+/// @param [out] x Horizontal positions of the fingers
+/// @param [out] y Vertical positions of the fingers
+static void gesture_positions(const struct gesture * gesture, double t, int32_t * x, int32_t * y) {
+    for (uint32_t i = 0; i != gesture->fingers; ++i) {
+        double fx;
+        double fy;
+        if (gesture->kind == GESTURE_PINCH) {
+            double radius = gesture->radius_from + ((double)gesture->radius_to - gesture->radius_from) * t;
+            double angle = 2 * M_PI * i / gesture->fingers;
+            fx = gesture->x + radius * cos(angle);
+            fy = gesture->y + radius * sin(angle);
+        } else {
+            fx = gesture->x + GESTURE_SPACING * (i - (gesture->fingers - 1) / 2.0);
+            fy = gesture->y;
+            if (gesture->kind == GESTURE_SWIPE) {
+                fx += gesture->dx * t;
+                fy += gesture->dy * t;
+            }
+        }
+        x[i] = (int32_t)lround(fx);
+        y[i] = (int32_t)lround(fy);
+    }
+}
+
+/// Append the events placing the fingers, ending with the single touch position of the first
+/// @param batch The batch to append to
+/// @param fingers Number of fingers
+/// @param x Horizontal positions of the fingers
+/// @param y Vertical positions of the fingers
+/// @param tracking_id Tracking ID of the first finger to touch down, -1 if already down
+/// @return 0 on success, 1 if error(s)
+static int gesture_batch_fingers(struct uinput_batch * batch, uint32_t fingers, const int32_t * x, const int32_t * y, int32_t tracking_id) {
+    for (uint32_t i = 0; i != fingers; ++i) {
+        if (uinput_batch_add(batch, EV_ABS, ABS_MT_SLOT, (int32_t)i)
+                || (tracking_id != -1 && uinput_batch_add(batch, EV_ABS, ABS_MT_TRACKING_ID, (uint16_t)(tracking_id + (int32_t)i)))
+                || uinput_batch_add(batch, EV_ABS, ABS_MT_POSITION_X, x[i])
+                || uinput_batch_add(batch, EV_ABS, ABS_MT_POSITION_Y, y[i])) {
+            return 1;
+        }
+    }
+    return uinput_batch_add(batch, EV_ABS, ABS_X, x[0]) || uinput_batch_add(batch, EV_ABS, ABS_Y, y[0]);
+}
+
+/// Append the buttons of all fingers touching down or lifting, and end the frame
+/// @param batch The batch to append to
+/// @param fingers Number of fingers
+/// @param value 1 for touching down, 0 for lifting
+/// @return 0 on success, 1 if error(s)
+static int gesture_batch_touch(struct uinput_batch * batch, uint32_t fingers, int32_t value) {
+    if (uinput_batch_add(batch, EV_KEY, BTN_TOUCH, value)) {
+        return 1;
+    }
+    if (fingers <= sizeof(GESTURE_TOOLS) / sizeof(GESTURE_TOOLS[0]) && uinput_batch_add(batch, EV_KEY, GESTURE_TOOLS[fingers - 1], value)) {
+        return 1;
+    }
+    return uinput_batch_sync(batch);
+}
+
+// Frames of a gesture
+int gesture_batch(struct uinput_batch * batch, const struct gesture * gesture, uint64_t start_us) {
+    if (!gesture->fingers || gesture->fingers > UINPUT_TOUCH_SLOTS) {
+        fprintf(stderr, "Gestures take 1 to %d fingers\n", UINPUT_TOUCH_SLOTS);
+        return 1;
+    }
+    if (gesture->kind != GESTURE_TAP && !gesture->rate_hz) {
+        fprintf(stderr, "Gesture rate must be positive\n");
+        return 1;
+    }
+
+    int32_t x[UINPUT_TOUCH_SLOTS];
+    int32_t y[UINPUT_TOUCH_SLOTS];
+    uint32_t fingers = gesture->fingers;
+    uint64_t duration_us = (uint64_t)gesture->duration_ms * 1000;
+
+    // Touch down
+    int32_t tracking_id = GESTURE_TRACKING_ID;
+    GESTURE_TRACKING_ID = (uint16_t)(GESTURE_TRACKING_ID + fingers);
+    gesture_positions(gesture, 0, x, y);
+    if (uinput_batch_at(batch, start_us)
+            || uinput_batch_add(batch, UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_TOUCH)
+            || gesture_batch_fingers(batch, fingers, x, y, tracking_id)
+            || gesture_batch_touch(batch, fingers, 1)) {
+        return 1;
+    }
+
+    // Move, with the last step landing exactly at the end
+    if (gesture->kind != GESTURE_TAP) {
+        uint64_t steps = (uint64_t)gesture->duration_ms * gesture->rate_hz / 1000;
+        if (!steps) {
+            steps = 1;
+        }
+        for (uint64_t step = 1; step <= steps; ++step) {
+            gesture_positions(gesture, (double)step / (double)steps, x, y);
+            if (uinput_batch_at(batch, start_us + duration_us * step / steps)
+                    || uinput_batch_add(batch, UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_TOUCH)
+                    || gesture_batch_fingers(batch, fingers, x, y, -1)
+                    || uinput_batch_sync(batch)) {
+                return 1;
+            }
+        }
+    }
+
+    // Lift
+    if (uinput_batch_at(batch, start_us + duration_us)
+            || uinput_batch_add(batch, UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_TOUCH)) {
+        return 1;
+    }
+    for (uint32_t i = 0; i != fingers; ++i) {
+        if (uinput_batch_add(batch, EV_ABS, ABS_MT_SLOT, (int32_t)i)
+                || uinput_batch_add(batch, EV_ABS, ABS_MT_TRACKING_ID, -1)) {
+            return 1;
+        }
+    }
+    return gesture_batch_touch(batch, fingers, 0);
+}
+
+// Perform a gesture
+int gesture_perform(const struct gesture * gesture) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (gesture_batch(&batch, gesture, uinput_now_us())) {
+        uinput_batch_flush(&batch);
+        return 1;
+    }
+    return uinput_batch_flush(&batch);
+}
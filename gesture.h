@@ -0,0 +1,85 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file gesture.h
+/// @author Harry Austen
+/// @brief Interface for generating multitouch gestures on the virtual touchscreen
+
+#ifndef __GESTURE_H__
+#define __GESTURE_H__
+
+// System includes
+#include <stdint.h>
+
+// Local includes
+#include "uinput.h"
+
+/// Distance between neighbouring fingers of a tap or swipe in pixels
+#define GESTURE_SPACING 60
+
+/// Default time the fingers of a tap stay down in milliseconds
+#define GESTURE_TAP_MS 50
+
+/// Default time taken by a swipe or pinch in milliseconds
+#define GESTURE_MOVE_MS 300
+
+/// Default rate of frames whilst the fingers move in Hz
+#define GESTURE_RATE_DEFAULT 120
+
+/// @brief Kinds of touch gesture
+enum gesture_kind {
+    /// Fingers touch down side by side and lift again without moving
+    GESTURE_TAP,
+    /// Fingers touch down side by side and move together
+    GESTURE_SWIPE,
+    /// Fingers touch down evenly spread around a circle whose radius changes
+    GESTURE_PINCH,
+};
+
+/// @brief Touch gesture, expanded into frames for the touch device
+struct gesture {
+    /// Kind of gesture
+    enum gesture_kind kind;
+    /// Number of fingers, 1 to UINPUT_TOUCH_SLOTS
+    uint32_t fingers;
+    /// Horizontal position of the centre of the fingers as they touch down, in pixels
+    int32_t x;
+    /// Vertical position of the centre of the fingers as they touch down, in pixels
+    int32_t y;
+    /// Horizontal distance moved by a swipe
+    int32_t dx;
+    /// Vertical distance moved by a swipe
+    int32_t dy;
+    /// Radius of the circle of a pinch's fingers as they touch down
+    uint32_t radius_from;
+    /// Radius of the circle of a pinch's fingers as they lift (smaller to pinch, larger to spread)
+    uint32_t radius_to;
+    /// Time from the fingers touching down to them lifting in milliseconds
+    uint32_t duration_ms;
+    /// Rate of frames whilst the fingers move in Hz
+    uint32_t rate_hz;
+};
+
+/// @brief Append the frames of a gesture to a batch, each at its own deadline
+/// @details All frames are generated in one go. Each frame is handed over as a whole, so the
+/// fingers of a frame never cost more than one write
+/// @param batch The batch to append to
+/// @param gesture The gesture
+/// @param start_us CLOCK_MONOTONIC time in microseconds at which the fingers touch down
+/// @return 0 on success, 1 if error(s)
+int gesture_batch(struct uinput_batch * batch, const struct gesture * gesture, uint64_t start_us);
+
+/// @brief Perform a gesture on the touch device, returning once the fingers have lifted
+/// @param gesture The gesture
+/// @return 0 on success, 1 if error(s)
+int gesture_perform(const struct gesture * gesture);
+
+#endif // __GESTURE_H__
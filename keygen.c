@@ -0,0 +1,295 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file keygen.c
+/// @author Harry Austen
+/// @brief Build time generator of the key name perfect hash table (keyhash.h)
+/// @details Reads the kernel's KEY_* macros, as dumped by "cc -dM -E", from stdin. Names are
+/// placed with hash and displace: every name falls in a bucket by key_hash(0, ...), and each
+/// bucket gets the first seed for which key_hash(seed, ...) sends all of its names to free slots
+
+// System includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Local includes
+#include "uinput.h"
+
+/// Most names taken in
+#define KEYGEN_MAX_NAMES 2048
+
+/// Prefix of the kernel's key code macros
+#define KEYGEN_PREFIX "KEY_"
+
+/// @brief Key name to be placed in the table
+struct keygen_name {
+    /// Name of the key in capitals, without KEYGEN_PREFIX
+    char name[UINPUT_MAX_KEY_LEN];
+    /// Value of the macro, a number or the name of another macro
+    char value[UINPUT_MAX_KEY_LEN + sizeof(KEYGEN_PREFIX)];
+    /// Keycode, -1 until resolved
+    int code;
+};
+
+/// All names taken in, the modifier and function key names first
+static struct keygen_name NAMES[KEYGEN_MAX_NAMES];
+
+/// Number of names taken in
+static size_t NUM_NAMES = 0;
+
+/// Find a name taken in
+/// @param name The name, in capitals
+/// @return Index into NAMES, or -1 if not found
+static int keygen_find(const char * name) {
+    for (size_t i = 0; i != NUM_NAMES; ++i) {
+        if (!strcasecmp(NAMES[i].name, name)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/// Take in a name, unless an earlier one has it already
+/// @param name The name
+/// @param value Its keycode, as a number or the name of another KEY_* macro
+/// @return 0 on success, 1 if error(s)
+static int keygen_add(const char * name, const char * value) {
+    if (keygen_find(name) != -1) {
+        return 0;
+    }
+    if (NUM_NAMES == KEYGEN_MAX_NAMES) {
+        fprintf(stderr, "keygen: more than %d key names\n", KEYGEN_MAX_NAMES);
+        return 1;
+    }
+    if (strlen(name) >= sizeof(NAMES[0].name) || strlen(value) >= sizeof(NAMES[0].value)) {
+        fprintf(stderr, "keygen: key name %s too long\n", name);
+        return 1;
+    }
+
+    struct keygen_name * entry = &NAMES[NUM_NAMES++];
+    strcpy(entry->name, name);
+    strcpy(entry->value, value);
+    entry->code = -1;
+    return 0;
+}
+
+/// Read the kernel's key code macros
+/// @param file The output of "cc -dM -E" on linux/input-event-codes.h
+/// @return 0 on success, 1 if error(s)
+static int keygen_read(FILE * file) {
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char name[64];
+        char value[64];
+        if (sscanf(line, "#define " KEYGEN_PREFIX "%63s %63s", name, value) != 2) {
+            continue;
+        }
+
+        // Single characters are always looked up as characters, the rest aren't keys
+        if (strlen(name) == 1 || !strcmp(name, "RESERVED") || !strcmp(name, "MAX") || !strcmp(name, "CNT")
+                || !strcmp(name, "MIN_INTERESTING")) {
+            continue;
+        }
+        if (keygen_add(name, value)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/// Work out the keycode of every name, following macros defined as other macros
+/// @return 0 on success, 1 if error(s)
+static int keygen_resolve() {
+    for (size_t i = 0; i != NUM_NAMES; ++i) {
+        const char * value = NAMES[i].value;
+        for (int depth = 0; NAMES[i].code == -1; ++depth) {
+            char * end;
+            long code = strtol(value, &end, 0);
+            if (end != value && !*end) {
+                if (code <= 0 || code > KEY_MAX) {
+                    fprintf(stderr, "keygen: keycode of %s out of range\n", NAMES[i].name);
+                    return 1;
+                }
+                NAMES[i].code = (int)code;
+                break;
+            }
+
+            int other = strncmp(value, KEYGEN_PREFIX, strlen(KEYGEN_PREFIX)) ? -1 : keygen_find(value + strlen(KEYGEN_PREFIX));
+            if (other == -1 || depth == 8) {
+                fprintf(stderr, "keygen: can't work out the keycode of %s\n", NAMES[i].name);
+                return 1;
+            }
+            value = NAMES[other].value;
+        }
+    }
+    return 0;
+}
+
+/// Place every name in a slot
+/// @param slots Number of slots, a power of two
+/// @param buckets Number of buckets, a power of two
+/// @param [out] table Index into NAMES of each slot, -1 if empty
+/// @param [out] seeds Seed of each bucket
+/// @return 0 on success, 1 if error(s)
+static int keygen_place(size_t slots, size_t buckets, int * table, uint16_t * seeds) {
+    size_t * bucket_of = calloc(NUM_NAMES, sizeof(*bucket_of));
+    size_t * order = calloc(buckets, sizeof(*order));
+    size_t * sizes = calloc(buckets, sizeof(*sizes));
+    if (!bucket_of || !order || !sizes) {
+        fprintf(stderr, "keygen: out of memory\n");
+        free(bucket_of);
+        free(order);
+        free(sizes);
+        return 1;
+    }
+
+    for (size_t i = 0; i != NUM_NAMES; ++i) {
+        bucket_of[i] = key_hash(0, NAMES[i].name, strlen(NAMES[i].name)) & (buckets - 1);
+        sizes[bucket_of[i]]++;
+    }
+    for (size_t i = 0; i != slots; ++i) {
+        table[i] = -1;
+    }
+
+    // Fullest buckets first, while there are still plenty of free slots
+    for (size_t b = 0; b != buckets; ++b) {
+        size_t j = b;
+        for (; j && sizes[order[j - 1]] < sizes[b]; --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = b;
+    }
+
+    int ret = 0;
+    for (size_t b = 0; b != buckets && !ret; ++b) {
+        size_t bucket = order[b];
+        seeds[bucket] = 0;
+        if (!sizes[bucket]) {
+            continue;
+        }
+
+        ret = 1;
+        for (uint32_t seed = 1; seed <= UINT16_MAX && ret; ++seed) {
+            // Try the seed, taking back the names placed if any of them collide
+            size_t placed = 0;
+            for (size_t i = 0; i != NUM_NAMES; ++i) {
+                if (bucket_of[i] != bucket) {
+                    continue;
+                }
+                size_t slot = key_hash(seed, NAMES[i].name, strlen(NAMES[i].name)) & (slots - 1);
+                if (table[slot] != -1) {
+                    break;
+                }
+                table[slot] = (int)i;
+                ++placed;
+            }
+            if (placed == sizes[bucket]) {
+                seeds[bucket] = (uint16_t)seed;
+                ret = 0;
+                break;
+            }
+            for (size_t i = 0; i != slots; ++i) {
+                if (table[i] != -1 && bucket_of[table[i]] == bucket) {
+                    table[i] = -1;
+                }
+            }
+        }
+        if (ret) {
+            fprintf(stderr, "keygen: no seed places bucket %zu\n", bucket);
+        }
+    }
+
+    free(bucket_of);
+    free(order);
+    free(sizes);
+    return ret;
+}
+
+/// Write the table out as a C header
+/// @param slots Number of slots
+/// @param buckets Number of buckets
+/// @param table Index into NAMES of each slot, -1 if empty
+/// @param seeds Seed of each bucket
+static void keygen_write(size_t slots, size_t buckets, const int * table, const uint16_t * seeds) {
+    printf("/// @file keyhash.h\n");
+    printf("/// @brief Perfect hash table of key names, generated by keygen.c. Do not edit\n\n");
+    printf("#ifndef __KEYHASH_H__\n#define __KEYHASH_H__\n\n");
+    printf("// System includes\n#include <stddef.h>\n#include <stdint.h>\n\n");
+    printf("// Local includes\n#include \"uinput.h\"\n\n");
+    printf("/// Number of key names in the table\n#define KEY_HASH_NAMES %zu\n\n", NUM_NAMES);
+    printf("/// Number of buckets, a power of two\n#define KEY_HASH_BUCKETS %zu\n\n", buckets);
+    printf("/// Number of slots, a power of two\n#define KEY_HASH_SLOTS %zu\n\n", slots);
+
+    printf("/// Seed of the hash placing the names of each bucket, by key_hash(0, name) bucket\n");
+    printf("static const uint16_t KEY_HASH_SEEDS[KEY_HASH_BUCKETS] = {");
+    for (size_t i = 0; i != buckets; ++i) {
+        printf("%s%u,", i % 16 ? " " : "\n    ", seeds[i]);
+    }
+    printf("\n};\n\n");
+
+    printf("/// Key name of each slot, by key_hash(seed, name) slot\n");
+    printf("static const struct key_hash_entry KEY_HASH_TABLE[KEY_HASH_SLOTS] = {\n");
+    for (size_t i = 0; i != slots; ++i) {
+        if (table[i] == -1) {
+            printf("    { NULL, 0, 0 },\n");
+        } else {
+            const struct keygen_name * entry = &NAMES[table[i]];
+            printf("    { \"%s\", %zu, %d },\n", entry->name, strlen(entry->name), entry->code);
+        }
+    }
+    printf("};\n\n#endif // __KEYHASH_H__\n");
+}
+
+/// Main entrypoint for the key name table generator
+/// @return 0 on success, 1 if error(s)
+int main() {
+    // The modifier and function key names win over the kernel's names
+    char code[16];
+    for (size_t i = 0; i != NUM_MODIFIER_KEYS; ++i) {
+        snprintf(code, sizeof(code), "%u", MODIFIER_KEYS[i].code);
+        if (keygen_add(MODIFIER_KEYS[i].string, code)) {
+            return 1;
+        }
+    }
+    for (size_t i = 0; i != NUM_FUNCTION_KEYS; ++i) {
+        snprintf(code, sizeof(code), "%u", FUNCTION_KEYS[i].code);
+        if (keygen_add(FUNCTION_KEYS[i].string, code)) {
+            return 1;
+        }
+    }
+
+    size_t aliases = NUM_NAMES;
+    if (keygen_read(stdin) || keygen_resolve()) {
+        return 1;
+    }
+    if (NUM_NAMES == aliases) {
+        fprintf(stderr, "keygen: no " KEYGEN_PREFIX "* macros on stdin\n");
+        return 1;
+    }
+
+    // At most four fifths full, with at most four names to a bucket on average
+    size_t slots = 1;
+    while (slots < NUM_NAMES + NUM_NAMES / 4) {
+        slots *= 2;
+    }
+    size_t buckets = slots / 4;
+
+    int table[4 * KEYGEN_MAX_NAMES];
+    uint16_t seeds[KEYGEN_MAX_NAMES];
+    if (keygen_place(slots, buckets, table, seeds)) {
+        return 1;
+    }
+
+    keygen_write(slots, buckets, table, seeds);
+    return 0;
+}
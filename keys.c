@@ -0,0 +1,92 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file keys.c
+/// @author Harry Austen
+/// @brief Key names, shared by uinput and keygen, which builds the key name table from them
+
+// Local includes
+#include "uinput.h"
+
+/// All valid modifier keys
+/// Used for mapping the string representation to the uinput keycode
+const struct key_string MODIFIER_KEYS[] = {
+	{"ALT", KEY_LEFTALT},
+    {"ALT_L", KEY_LEFTALT},
+    {"ALT_R", KEY_RIGHTALT},
+	{"CTRL", KEY_LEFTCTRL},
+    {"CTRL_L", KEY_LEFTCTRL},
+    {"CTRL_R", KEY_RIGHTCTRL},
+	{"META", KEY_LEFTMETA},
+    {"META_L", KEY_LEFTMETA},
+    {"META_R", KEY_RIGHTMETA},
+	{"SHIFT", KEY_LEFTSHIFT},
+    {"SHIFT_L", KEY_LEFTSHIFT},
+    {"SHIFT_R", KEY_RIGHTSHIFT},
+	{"SUPER", KEY_LEFTMETA},
+    {"SUPER_L", KEY_LEFTMETA},
+    {"SUPER_R", KEY_RIGHTMETA}
+};
+
+/// All valid function keys
+/// Used for mapping the string representation to the uinput keycode
+const struct key_string FUNCTION_KEYS[] = {
+	{"BACKSPACE", KEY_BACKSPACE},
+    {"CAPSLOCK", KEY_CAPSLOCK},
+    {"DELETE", KEY_DELETE},
+    {"DOWN", KEY_DOWN},
+    {"END", KEY_END},
+    {"ENTER", KEY_ENTER},
+    {"ESC", KEY_ESC},
+	{"F1", KEY_F1},
+    {"F10", KEY_F10},
+    {"F11", KEY_F11},
+    {"F12", KEY_F12},
+    {"F2", KEY_F2},
+    {"F3", KEY_F3},
+    {"F4", KEY_F4},
+    {"F5", KEY_F5},
+    {"F6", KEY_F6},
+    {"F7", KEY_F7},
+    {"F8", KEY_F8},
+    {"F9", KEY_F9},
+    {"HOME", KEY_HOME},
+    {"INSERT", KEY_INSERT},
+    {"LEFT", KEY_LEFT},
+    {"NUMLOCK", KEY_NUMLOCK},
+    {"PAGEDOWN", KEY_PAGEDOWN},
+    {"PAGEUP", KEY_PAGEUP},
+    {"PAUSE", KEY_PAUSE},
+    {"RIGHT", KEY_RIGHT},
+    {"SCROLLLOCK", KEY_SCROLLLOCK},
+    {"SYSRQ", KEY_SYSRQ},
+	{"TAB", KEY_TAB},
+    {"UP", KEY_UP}
+};
+
+// Case-insensitive FNV-1a, finished with the MurmurHash3 mixer so every seed spreads well
+uint32_t key_hash(uint32_t seed, const char * name, size_t len) {
+    uint32_t h = 2166136261u ^ seed * 0x9e3779b1u;
+    for (size_t i = 0; i != len; ++i) {
+        uint32_t c = (unsigned char)name[i];
+        if (c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
@@ -0,0 +1,636 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file program.c
+/// @author Harry Austen
+/// @brief Implementation of the compiled event program encoder, compiler and interpreter
+
+// System includes
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Local includes
+#include "program.h"
+
+/// Number of event types tracked for delta encoding (EV_MAX + 1)
+#define PROGRAM_NUM_TYPES (EV_MAX + 1)
+
+/// Event tag flag: a code delta follows
+#define PROGRAM_TAG_CODE 0x20
+
+/// Event tag flag: a value delta follows
+#define PROGRAM_TAG_VALUE 0x40
+
+/// Event tag mask for the event type
+#define PROGRAM_TAG_TYPE 0x1f
+
+/// Maximum number of tokens on a script line
+#define PROGRAM_MAX_TOKENS 64
+
+/// Make sure the buffer can hold a number of extra bytes
+/// @param prog The buffer to grow
+/// @param extra Number of bytes needed
+/// @return 0 on success, 1 if error(s)
+static int program_reserve(struct program_buffer * prog, size_t extra) {
+    if (prog->len + extra <= prog->cap) {
+        return 0;
+    }
+    size_t cap = prog->cap ? prog->cap : 256;
+    while (cap < prog->len + extra) {
+        cap *= 2;
+    }
+    unsigned char * data = realloc(prog->data, cap);
+    if (!data) {
+        fprintf(stderr, "Failed to allocate %zu bytes for program\n", cap);
+        return 1;
+    }
+    prog->data = data;
+    prog->cap = cap;
+    return 0;
+}
+
+/// Append a byte to the program
+/// @param prog The program to append to
+/// @param byte The byte
+/// @return 0 on success, 1 if error(s)
+static int program_put_byte(struct program_buffer * prog, uint8_t byte) {
+    if (program_reserve(prog, 1)) {
+        return 1;
+    }
+    prog->data[prog->len++] = byte;
+    return 0;
+}
+
+/// Append an unsigned LEB128 varint to the program
+/// @param prog The program to append to
+/// @param value The number
+/// @return 0 on success, 1 if error(s)
+static int program_put_varint(struct program_buffer * prog, uint64_t value) {
+    if (program_reserve(prog, 10)) {
+        return 1;
+    }
+    while (value >= 0x80) {
+        prog->data[prog->len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    prog->data[prog->len++] = (unsigned char)value;
+    return 0;
+}
+
+/// Zigzag encode a signed number so that small magnitudes give small varints
+/// @param value The signed number
+/// @return The zigzag encoded number
+static uint64_t program_zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/// Decode a zigzag encoded number
+/// @param value The zigzag encoded number
+/// @return The signed number
+static int64_t program_unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/// Encode the collected events as a PROGRAM_OP_EVENTS block
+/// @param prog The program to encode into
+/// @return 0 on success, 1 if error(s)
+static int program_flush_events(struct program_buffer * prog) {
+    if (!prog->count) {
+        return 0;
+    }
+
+    uint16_t codes[PROGRAM_NUM_TYPES] = { 0 };
+    int32_t values[PROGRAM_NUM_TYPES] = { 0 };
+
+    if (program_put_byte(prog, PROGRAM_OP_EVENTS) || program_put_varint(prog, prog->count)) {
+        return 1;
+    }
+    for (size_t i = 0; i != prog->count; ++i) {
+        const struct uinput_raw_data * event = &prog->events[i];
+        if (event->type >= PROGRAM_NUM_TYPES) {
+            fprintf(stderr, "Invalid event type %u in program\n", event->type);
+            return 1;
+        }
+
+        uint8_t tag = (uint8_t)event->type;
+        if (event->code != codes[event->type]) {
+            tag |= PROGRAM_TAG_CODE;
+        }
+        if (event->value != values[event->type]) {
+            tag |= PROGRAM_TAG_VALUE;
+        }
+
+        if (program_put_byte(prog, tag)
+                || ((tag & PROGRAM_TAG_CODE) && program_put_varint(prog, program_zigzag((int64_t)event->code - codes[event->type])))
+                || ((tag & PROGRAM_TAG_VALUE) && program_put_varint(prog, program_zigzag((int64_t)event->value - values[event->type])))
+                ) {
+            return 1;
+        }
+        codes[event->type] = event->code;
+        values[event->type] = event->value;
+    }
+
+    prog->count = 0;
+    return 0;
+}
+
+// Empty program with header
+int program_begin(struct program_buffer * prog) {
+    memset(prog, 0, sizeof(*prog));
+    struct program_header header = { PROGRAM_MAGIC, PROGRAM_VERSION };
+    if (program_reserve(prog, sizeof(header))) {
+        return 1;
+    }
+    memcpy(prog->data, &header, sizeof(header));
+    prog->len = sizeof(header);
+    return 0;
+}
+
+// Collect events into the current block
+int program_add_events(struct program_buffer * prog, const struct uinput_raw_data * events, size_t count) {
+    if (prog->count + count > prog->events_cap) {
+        size_t cap = prog->events_cap ? prog->events_cap : UINPUT_BATCH_SIZE;
+        while (cap < prog->count + count) {
+            cap *= 2;
+        }
+        struct uinput_raw_data * tmp = realloc(prog->events, cap * sizeof(*tmp));
+        if (!tmp) {
+            fprintf(stderr, "Failed to allocate %zu events for program\n", cap);
+            return 1;
+        }
+        prog->events = tmp;
+        prog->events_cap = cap;
+    }
+    memcpy(prog->events + prog->count, events, count * sizeof(*events));
+    prog->count += count;
+    return 0;
+}
+
+// Delay operation
+int program_add_delay(struct program_buffer * prog, uint64_t delay_us) {
+    if (program_flush_events(prog) || program_put_byte(prog, PROGRAM_OP_DELAY) || program_put_varint(prog, delay_us)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Loop operation
+int program_add_loop(struct program_buffer * prog, uint64_t count) {
+    if (prog->depth == PROGRAM_MAX_LOOP_DEPTH) {
+        fprintf(stderr, "Loops nested more than %d deep\n", PROGRAM_MAX_LOOP_DEPTH);
+        return 1;
+    }
+    if (program_flush_events(prog) || program_put_byte(prog, PROGRAM_OP_LOOP) || program_put_varint(prog, count)) {
+        return 1;
+    }
+    prog->depth++;
+    return 0;
+}
+
+// End of loop operation
+int program_add_end(struct program_buffer * prog) {
+    if (!prog->depth) {
+        fprintf(stderr, "End without loop\n");
+        return 1;
+    }
+    if (program_flush_events(prog) || program_put_byte(prog, PROGRAM_OP_END)) {
+        return 1;
+    }
+    prog->depth--;
+    return 0;
+}
+
+// Write out the final events block
+int program_finish(struct program_buffer * prog) {
+    if (prog->depth) {
+        fprintf(stderr, "Loop without end\n");
+        return 1;
+    }
+    return program_flush_events(prog);
+}
+
+// Stream out what has been encoded
+int program_drain(struct program_buffer * prog, int fd) {
+    for (size_t off = 0; off != prog->len;) {
+        ssize_t rc = write(fd, prog->data + off, prog->len - off);
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rc <= 0) {
+            fprintf(stderr, "Failed to write program: %s\n", strerror(errno));
+            return 1;
+        }
+        off += (size_t)rc;
+    }
+    prog->len = 0;
+    return 0;
+}
+
+// Release memory
+void program_free(struct program_buffer * prog) {
+    free(prog->data);
+    free(prog->events);
+    memset(prog, 0, sizeof(*prog));
+}
+
+/// Program being compiled, receiving the output of the compiler's batch
+static struct program_buffer * COMPILING = NULL;
+
+/// Batch output collecting events into the program being compiled
+/// @param events The events to collect
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+static int program_capture(const struct uinput_raw_data * events, size_t count) {
+    return program_add_events(COMPILING, events, count);
+}
+
+/// Undo the escapes of a type step in place
+/// @param text The NUL terminated text
+static void program_unescape(char * text) {
+    char * out = text;
+    for (const char * in = text; *in; ++in) {
+        if (*in == '\\' && in[1]) {
+            ++in;
+            *out++ = *in == 'n' ? '\n' : *in == 't' ? '\t' : *in;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+}
+
+/// Parse a whole decimal number
+/// @param str The string to parse
+/// @param [out] value The number
+/// @return 0 on success, 1 if not a number
+static int program_parse_number(const char * str, int64_t * value) {
+    char * end;
+    errno = 0;
+    *value = strtoll(str, &end, 10);
+    return errno || end == str || *end;
+}
+
+/// Compile a single script line
+/// @param line The NUL terminated line, modified during parsing
+/// @param batch Batch collecting the line's events
+/// @param prog The program being compiled
+/// @return 0 on success, 1 if error(s)
+static int program_compile_line(char * line, struct uinput_batch * batch, struct program_buffer * prog) {
+    line += strspn(line, " \t");
+
+    // Text of a type step is the remainder of the line, spaces and all
+    if (!strncmp(line, "type ", 5)) {
+        program_unescape(line + 5);
+        return uinput_batch_type(batch, line + 5, strlen(line + 5), 0);
+    }
+
+    char * tokens[PROGRAM_MAX_TOKENS];
+    int count = 0;
+    for (char * tok = strtok(line, " \t"); tok; tok = strtok(NULL, " \t")) {
+        if (count == PROGRAM_MAX_TOKENS) {
+            fprintf(stderr, "Too many arguments\n");
+            return 1;
+        }
+        tokens[count++] = tok;
+    }
+    if (!count || tokens[0][0] == '#') {
+        return 0;
+    }
+
+    int64_t numbers[2];
+    if (!strcmp(tokens[0], "key") && count > 1) {
+        for (int i = 1; i != count; ++i) {
+            if (uinput_batch_enter_keys(batch, tokens[i])) {
+                return 1;
+            }
+        }
+    } else if (!strcmp(tokens[0], "mouse") && count == 3
+            && !program_parse_number(tokens[1], &numbers[0]) && !program_parse_number(tokens[2], &numbers[1])) {
+        return uinput_batch_move_mouse(batch, (int32_t)numbers[0], (int32_t)numbers[1]);
+    } else if (!strcmp(tokens[0], "mouse") && count == 4 && !strcmp(tokens[1], "--relative")
+            && !program_parse_number(tokens[2], &numbers[0]) && !program_parse_number(tokens[3], &numbers[1])) {
+        return uinput_batch_relative_move_mouse(batch, (int32_t)numbers[0], (int32_t)numbers[1]);
+    } else if (!strcmp(tokens[0], "click") && count == 2 && !program_parse_number(tokens[1], &numbers[0])) {
+        uint16_t keycode;
+        if (numbers[0] < 0 || numbers[0] > UINT16_MAX || uinput_button_to_keycode((uint16_t)numbers[0], &keycode)) {
+            return 1;
+        }
+        return uinput_batch_keypress(batch, keycode);
+    } else if (!strcmp(tokens[0], "delay") && count == 2 && !program_parse_number(tokens[1], &numbers[0]) && numbers[0] >= 0) {
+        return uinput_batch_flush(batch) || program_add_delay(prog, (uint64_t)numbers[0] * 1000);
+    } else if (!strcmp(tokens[0], "loop") && count == 2 && !program_parse_number(tokens[1], &numbers[0]) && numbers[0] >= 0) {
+        return uinput_batch_flush(batch) || program_add_loop(prog, (uint64_t)numbers[0]);
+    } else if (!strcmp(tokens[0], "end") && count == 1) {
+        return uinput_batch_flush(batch) || program_add_end(prog);
+    } else {
+        fprintf(stderr, "Invalid step '%s'\n", tokens[0]);
+        return 1;
+    }
+    return 0;
+}
+
+// Script text to program
+int program_compile(const char * script, size_t len, const char * name, struct program_buffer * prog) {
+    if (program_begin(prog)) {
+        return 1;
+    }
+
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    batch.emit = program_capture;
+    COMPILING = prog;
+
+    int ret = 0;
+    size_t line_no = 0;
+    char * line = NULL;
+    while (len && !ret) {
+        const char * end = memchr(script, '\n', len);
+        size_t line_len = end ? (size_t)(end - script) : len;
+        ++line_no;
+
+        char * tmp = realloc(line, line_len + 1);
+        if (!tmp) {
+            ret = 1;
+            break;
+        }
+        line = tmp;
+        memcpy(line, script, line_len);
+        line[line_len] = '\0';
+
+        if (program_compile_line(line, &batch, prog)) {
+            fprintf(stderr, "%s:%zu: failed to compile\n", name, line_no);
+            ret = 1;
+        }
+
+        script += line_len + (end ? 1 : 0);
+        len -= line_len + (end ? 1 : 0);
+    }
+    free(line);
+
+    if (ret || uinput_batch_flush(&batch) || program_finish(prog)) {
+        program_free(prog);
+        ret = 1;
+    }
+    COMPILING = NULL;
+    return ret;
+}
+
+/// Read an unsigned LEB128 varint
+/// @param [in,out] pos Position of the varint, moved past it
+/// @param end End of the program
+/// @param [out] value The number
+/// @return 0 on success, 1 if truncated or too long
+static int program_get_varint(const unsigned char ** pos, const unsigned char * end, uint64_t * value) {
+    *value = 0;
+    for (unsigned shift = 0; *pos != end && shift < 64; shift += 7) {
+        unsigned char byte = *(*pos)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/// Decode a PROGRAM_OP_EVENTS block into the batch
+/// @param [in,out] pos Position after the opcode, moved past the block
+/// @param end End of the program
+/// @param batch Batch the events are written through, NULL to skip them
+/// @return 0 on success, 1 if error(s)
+static int program_run_events(const unsigned char ** pos, const unsigned char * end, struct uinput_batch * batch) {
+    uint16_t codes[PROGRAM_NUM_TYPES] = { 0 };
+    int32_t values[PROGRAM_NUM_TYPES] = { 0 };
+    uint64_t count;
+
+    if (program_get_varint(pos, end, &count)) {
+        return 1;
+    }
+    while (count--) {
+        if (*pos == end) {
+            return 1;
+        }
+        uint8_t tag = *(*pos)++;
+        uint16_t type = tag & PROGRAM_TAG_TYPE;
+        uint64_t delta;
+
+        if (tag & PROGRAM_TAG_CODE) {
+            if (program_get_varint(pos, end, &delta)) {
+                return 1;
+            }
+            codes[type] = (uint16_t)(codes[type] + program_unzigzag(delta));
+        }
+        if (tag & PROGRAM_TAG_VALUE) {
+            if (program_get_varint(pos, end, &delta)) {
+                return 1;
+            }
+            values[type] = (int32_t)(values[type] + program_unzigzag(delta));
+        }
+        if (batch && uinput_batch_add(batch, type, codes[type], values[type])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Interpret a program
+int program_run(const unsigned char * data, size_t len, struct uinput_batch * batch, double speed) {
+    struct program_header header;
+    if (len < sizeof(header)) {
+        fprintf(stderr, "Program too short\n");
+        return 1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != PROGRAM_MAGIC || header.version != PROGRAM_VERSION) {
+        fprintf(stderr, "Not a version %d program\n", PROGRAM_VERSION);
+        return 1;
+    }
+
+    // Start of each loop body and the number of runs left
+    const unsigned char * loop_start[PROGRAM_MAX_LOOP_DEPTH];
+    uint64_t loop_left[PROGRAM_MAX_LOOP_DEPTH];
+    int depth = 0;
+
+    const unsigned char * end = data + len;
+    const unsigned char * pos = data + sizeof(header);
+    uint64_t time_us = 0;
+    while (pos != end) {
+        uint64_t value;
+        int ret = 0;
+
+        switch (*pos++) {
+            case PROGRAM_OP_EVENTS:
+                ret = program_run_events(&pos, end, batch);
+                break;
+            case PROGRAM_OP_DELAY:
+                ret = program_get_varint(&pos, end, &value);
+                if (!ret && !time_us) {
+                    // Count from once the first events are out, after any connection set up
+                    ret = uinput_batch_flush(batch);
+                    time_us = uinput_now_us();
+                }
+                if (!ret) {
+                    time_us += (uint64_t)((double)value / speed);
+                    ret = uinput_batch_at(batch, time_us);
+                }
+                break;
+            case PROGRAM_OP_LOOP:
+                ret = program_get_varint(&pos, end, &value) || depth == PROGRAM_MAX_LOOP_DEPTH;
+                if (ret) {
+                    break;
+                }
+                if (value) {
+                    loop_start[depth] = pos;
+                    loop_left[depth++] = value;
+                    break;
+                }
+                // Skip over a loop run zero times, decoding operands as they could look like opcodes
+                for (int nested = 1; nested && !ret;) {
+                    if (pos == end) {
+                        ret = 1;
+                        break;
+                    }
+                    switch (*pos++) {
+                        case PROGRAM_OP_EVENTS:
+                            ret = program_run_events(&pos, end, NULL);
+                            break;
+                        case PROGRAM_OP_LOOP:
+                            ++nested;
+                            // fallthrough
+                        case PROGRAM_OP_DELAY:
+                            ret = program_get_varint(&pos, end, &value);
+                            break;
+                        case PROGRAM_OP_END:
+                            --nested;
+                            break;
+                        default:
+                            ret = 1;
+                            break;
+                    }
+                }
+                break;
+            case PROGRAM_OP_END:
+                ret = !depth;
+                if (!ret && --loop_left[depth - 1]) {
+                    pos = loop_start[depth - 1];
+                } else if (!ret) {
+                    --depth;
+                }
+                break;
+            default:
+                ret = 1;
+                break;
+        }
+
+        if (ret) {
+            fprintf(stderr, "Malformed program at byte %zu\n", (size_t)(pos - data));
+            return 1;
+        }
+    }
+
+    if (depth) {
+        fprintf(stderr, "Malformed program, loop without end\n");
+        return 1;
+    }
+    return uinput_batch_flush(batch);
+}
+
+// Compile a script file
+int program_compile_file(const char * script_path, const char * program_path) {
+    FILE * in = fopen(script_path, "r");
+    if (!in) {
+        fprintf(stderr, "Failed to open %s: %s\n", script_path, strerror(errno));
+        return 1;
+    }
+
+    // Scripts are small, read the whole thing
+    char * script = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+    for (;;) {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 4096;
+            char * tmp = realloc(script, cap);
+            if (!tmp) {
+                free(script);
+                fclose(in);
+                return 1;
+            }
+            script = tmp;
+        }
+        size_t rc = fread(script + len, 1, cap - len, in);
+        if (!rc) {
+            break;
+        }
+        len += rc;
+    }
+    fclose(in);
+
+    struct program_buffer prog;
+    int ret = program_compile(script, len, script_path, &prog);
+    free(script);
+    if (ret) {
+        return 1;
+    }
+
+    FILE * out = fopen(program_path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to open %s: %s\n", program_path, strerror(errno));
+        program_free(&prog);
+        return 1;
+    }
+    if (fwrite(prog.data, 1, prog.len, out) != prog.len) {
+        fprintf(stderr, "Failed to write %s\n", program_path);
+        ret = 1;
+    }
+    if (fclose(out)) {
+        ret = 1;
+    }
+    program_free(&prog);
+    return ret;
+}
+
+// Run a program file
+int program_run_file(const char * path, double speed) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void * data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    madvise(data, len, MADV_SEQUENTIAL);
+
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    int ret = program_run(data, len, &batch, speed);
+
+    munmap(data, len);
+    return ret;
+}
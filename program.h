@@ -0,0 +1,162 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file program.h
+/// @author Harry Austen
+/// @brief Interface for compiled event programs
+/// @details A program file is a struct program_header followed by a sequence of operations,
+/// each starting with an opcode byte (enum program_op). Numbers are LEB128 varints, signed ones
+/// zigzag encoded first. Events are delta encoded against the previous event of the same type
+/// within their PROGRAM_OP_EVENTS block, so that a SYN_REPORT takes a single byte and a key
+/// release typically two
+
+#ifndef __PROGRAM_H__
+#define __PROGRAM_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Local includes
+#include "uinput.h"
+
+/// Magic number opening a program file ("YDOP" in little endian byte order)
+#define PROGRAM_MAGIC 0x504f4459
+
+/// Format version written by this build
+#define PROGRAM_VERSION 1
+
+/// Maximum nesting depth of loops
+#define PROGRAM_MAX_LOOP_DEPTH 16
+
+/// @brief Header at the start of every program file
+struct program_header {
+    /// Always PROGRAM_MAGIC
+    uint32_t magic;
+    /// Format version, PROGRAM_VERSION
+    uint32_t version;
+};
+
+/// @brief Operations making up a program
+enum program_op {
+    /// Varint number of events, followed by the delta encoded events
+    PROGRAM_OP_EVENTS = 1,
+    /// Varint number of microseconds to wait
+    PROGRAM_OP_DELAY = 2,
+    /// Varint number of times to run the operations up to the matching PROGRAM_OP_END
+    PROGRAM_OP_LOOP = 3,
+    /// End of the innermost loop
+    PROGRAM_OP_END = 4,
+};
+
+/// @brief Growable buffer a program is encoded into
+struct program_buffer {
+    /// Encoded program
+    unsigned char * data;
+    /// Number of bytes used
+    size_t len;
+    /// Number of bytes allocated
+    size_t cap;
+    /// Events of the PROGRAM_OP_EVENTS block being collected
+    struct uinput_raw_data * events;
+    /// Number of events collected
+    size_t count;
+    /// Number of events allocated
+    size_t events_cap;
+    /// Current loop nesting depth
+    int depth;
+};
+
+/// @brief Start a new, empty program
+/// @param [out] prog The buffer to encode into
+/// @return 0 on success, 1 if error(s)
+int program_begin(struct program_buffer * prog);
+
+/// @brief Append events to the program
+/// @details Consecutive events are collected into a single PROGRAM_OP_EVENTS block
+/// @param prog The program to append to
+/// @param events The events to append
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+int program_add_events(struct program_buffer * prog, const struct uinput_raw_data * events, size_t count);
+
+/// @brief Append a delay to the program
+/// @param prog The program to append to
+/// @param delay_us Delay in microseconds
+/// @return 0 on success, 1 if error(s)
+int program_add_delay(struct program_buffer * prog, uint64_t delay_us);
+
+/// @brief Start a loop, ended by program_add_end()
+/// @param prog The program to append to
+/// @param count Number of times to run the loop
+/// @return 0 on success, 1 if error(s)
+int program_add_loop(struct program_buffer * prog, uint64_t count);
+
+/// @brief End the innermost loop
+/// @param prog The program to append to
+/// @return 0 on success, 1 if error(s)
+int program_add_end(struct program_buffer * prog);
+
+/// @brief Finish encoding, after which prog->data and prog->len hold the whole program
+/// @param prog The program to finish
+/// @return 0 on success, 1 if error(s) (e.g. unterminated loop)
+int program_finish(struct program_buffer * prog);
+
+/// @brief Write out the operations encoded so far and empty the buffer, keeping memory use bounded
+/// @details Events still being collected into a PROGRAM_OP_EVENTS block are kept
+/// @param prog The program to write
+/// @param fd File descriptor to write to
+/// @return 0 on success, 1 if error(s)
+int program_drain(struct program_buffer * prog, int fd);
+
+/// @brief Free the memory held by a program buffer
+/// @param prog The program to free
+void program_free(struct program_buffer * prog);
+
+/// @brief Compile a script into a program
+/// @details Each line of the script is one step:
+///     type <text>                 (\n, \t and \\ escapes are understood)
+///     key <key sequence> ...
+///     mouse [--relative] <x> <y>
+///     click <button>
+///     delay <ms>
+///     loop <times> ... end
+/// Blank lines and lines starting with '#' are ignored
+/// @param script The script text
+/// @param len Length of the script in bytes
+/// @param name Name of the script, for error messages
+/// @param [out] prog The compiled program, finished on success
+/// @return 0 on success, 1 if error(s)
+int program_compile(const char * script, size_t len, const char * name, struct program_buffer * prog);
+
+/// @brief Run a compiled program
+/// @details Delays become deadlines of the batch (see uinput_batch_at()), counted from when the
+/// first events have been written, so that long programs keep their timing
+/// @param data The compiled program, including its header
+/// @param len Length of the program in bytes
+/// @param batch Batch the events are written through
+/// @param speed Factor the delays are divided by, e.g. 4 to run four times as fast
+/// @return 0 on success, 1 if error(s)
+int program_run(const unsigned char * data, size_t len, struct uinput_batch * batch, double speed);
+
+/// @brief Compile a script file into a program file
+/// @param script_path Path of the script
+/// @param program_path Path of the program file to write
+/// @return 0 on success, 1 if error(s)
+int program_compile_file(const char * script_path, const char * program_path);
+
+/// @brief Map a program file into memory and run it
+/// @param path Path of the program file
+/// @param speed Factor the delays are divided by
+/// @return 0 on success, 1 if error(s)
+int program_run_file(const char * path, double speed);
+
+#endif // __PROGRAM_H__
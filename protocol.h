@@ -0,0 +1,144 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file protocol.h
+/// @author Harry Austen
+/// @brief Wire protocol spoken between ydotool and the ydotoold daemon
+/// @details The daemon greets every client with a struct ydotool_hello as soon as it connects. A
+/// version 2 client waits for it before sending anything, and answers with its own. From then on
+/// the client sends messages, each a struct ydotool_msg_header followed by its payload. A legacy
+/// daemon never greets, so the client falls back to the legacy protocol without having sent it
+/// anything. Legacy clients ignore the greeting and send a plain stream of struct uinput_raw_data
+/// records. The two are told apart by the first 16 bits, which are the event type for a legacy
+/// client and can never match the magic number
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+// System includes
+#include <stdint.h>
+
+/// Path of the daemon's listening socket
+#define YDOTOOL_SOCKET_PATH "/tmp/.ydotool_socket"
+
+/// Magic number opening the handshake ("YDOT" in little endian byte order)
+#define YDOTOOL_PROTOCOL_MAGIC 0x544f4459
+
+/// Protocol version spoken by this build
+#define YDOTOOL_PROTOCOL_VERSION 2
+
+/// Maximum number of payload bytes carried by a single message
+#define YDOTOOL_MSG_MAX_PAYLOAD 8192
+
+/// Maximum number of events carried by a single YDOTOOL_MSG_EVENTS message
+#define YDOTOOL_MSG_MAX_EVENTS (YDOTOOL_MSG_MAX_PAYLOAD / 8)
+
+/// Maximum number of events in a single frame, including its SYN_REPORT. The daemon emits every
+/// frame in one piece, and drops frames that are longer
+#define YDOTOOL_MAX_FRAME_EVENTS 128
+
+/// @brief Handshake sent by the client and answered by the daemon
+struct ydotool_hello {
+    /// Always YDOTOOL_PROTOCOL_MAGIC
+    uint32_t magic;
+    /// Highest protocol version supported by the sender
+    uint32_t version;
+};
+
+/// @brief Kinds of message following the handshake
+enum ydotool_msg_kind {
+    /// Payload is count struct uinput_raw_data records, made up of whole frames. Frames starting
+    /// with a UINPUT_EV_DEVICE event are emitted by the virtual device it names, like anywhere else
+    /// events are passed (rings, macros, timed events and legacy clients)
+    YDOTOOL_MSG_EVENTS = 1,
+    /// Request for a shared memory ring, count being the number of event slots wanted (0 for
+    /// default). Answered with a YDOTOOL_MSG_SHM header whose count is the ring's number of slots,
+    /// carrying the ring's memfd and the daemon's eventfd as SCM_RIGHTS ancillary data. An answer
+    /// with count 0 and no file descriptors means the request was refused
+    YDOTOOL_MSG_SHM = 2,
+    /// Payload is count bytes of text, typed by the daemon itself
+    YDOTOOL_MSG_TYPE = 3,
+    /// Payload is count bytes: a struct ydotool_msg_key followed by NUL terminated key sequences
+    /// (e.g. "ctrl+alt+f1"), each pressed and released in turn by the daemon itself
+    YDOTOOL_MSG_KEY = 4,
+    /// Click of the mouse button given by arg (1: left, 2: right, 3: middle), no payload
+    YDOTOOL_MSG_CLICK = 5,
+    /// Payload is count bytes: a NUL terminated macro name followed by struct uinput_raw_data
+    /// records, stored by the daemon under that name. arg is YDOTOOL_MACRO_APPEND to add the events
+    /// to an existing macro (for macros too long for one message), 0 to replace it. Answered with a
+    /// YDOTOOL_MSG_MACRO_ID message. A macro growing beyond the daemon's limits is refused and forgotten
+    YDOTOOL_MSG_MACRO_DEFINE = 6,
+    /// Answer to YDOTOOL_MSG_MACRO_DEFINE and YDOTOOL_MSG_MACRO_UNDEFINE, count being the macro ID or
+    /// YDOTOOL_MACRO_NONE on failure, no payload
+    YDOTOOL_MSG_MACRO_ID = 7,
+    /// Payload is count bytes: a struct ydotool_msg_macro_run, followed by the NUL terminated macro
+    /// name if its id is YDOTOOL_MACRO_NONE
+    YDOTOOL_MSG_MACRO_RUN = 8,
+    /// Payload is count bytes: a struct ydotool_msg_time followed by struct uinput_raw_data records
+    /// making up whole frames, emitted by the daemon once the given time has come
+    YDOTOOL_MSG_TIMED_EVENTS = 9,
+    /// Payload is count bytes: a struct uinput_motion, expanded by the daemon into one frame per
+    /// step, each emitted at its own time from the moment the message arrives
+    YDOTOOL_MSG_MOTION = 10,
+    /// Payload is count bytes: the NUL terminated name of a macro for the daemon to forget.
+    /// Answered with a YDOTOOL_MSG_MACRO_ID message, count being the ID the macro had or
+    /// YDOTOOL_MACRO_NONE if there was no such macro
+    YDOTOOL_MSG_MACRO_UNDEFINE = 11,
+};
+
+/// YDOTOOL_MSG_MACRO_DEFINE arg appending to an existing macro
+#define YDOTOOL_MACRO_APPEND 1
+
+/// Macro ID meaning no macro, or lookup by name
+#define YDOTOOL_MACRO_NONE UINT32_MAX
+
+/// Maximum length of a macro name, including the NUL terminator
+#define YDOTOOL_MACRO_NAME_LEN 32
+
+/// @brief Header preceding every message after the handshake
+struct ydotool_msg_header {
+    /// One of enum ydotool_msg_kind
+    uint16_t kind;
+    /// Argument whose meaning depends on the kind of message (0 if unused)
+    uint16_t arg;
+    /// Number of payload items (e.g. events) following the header
+    uint32_t count;
+};
+
+/// @brief Fixed part of a YDOTOOL_MSG_KEY payload
+struct ydotool_msg_key {
+    /// Number of times to enter all of the key sequences
+    uint32_t repeats;
+};
+
+/// @brief Fixed part of a YDOTOOL_MSG_MACRO_RUN payload
+struct ydotool_msg_macro_run {
+    /// ID of the macro to run, or YDOTOOL_MACRO_NONE to look it up by the name that follows
+    uint32_t id;
+    /// Number of times to run the macro
+    uint32_t repeats;
+};
+
+/// @brief Fixed part of a YDOTOOL_MSG_TIMED_EVENTS payload
+struct ydotool_msg_time {
+    /// CLOCK_MONOTONIC time in microseconds at which to emit the events. Client and daemon share
+    /// the clock, so deadlines are absolute and long sequences don't drift
+    uint64_t time_us;
+};
+
+/// Maximum number of events carried by a single YDOTOOL_MSG_TIMED_EVENTS message
+#define YDOTOOL_MSG_MAX_TIMED_EVENTS ((YDOTOOL_MSG_MAX_PAYLOAD - sizeof(struct ydotool_msg_time)) / 8)
+
+/// Furthest ahead of the present, in microseconds, that timed events and a client's motion may
+/// end. The daemon drops anything due later
+#define YDOTOOL_TIMED_HORIZON_US 10000000
+
+#endif // __PROTOCOL_H__
@@ -0,0 +1,298 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file record.c
+/// @author Harry Austen
+/// @brief Implementation of the input device recorder
+
+// System includes
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+// Local includes
+#include "program.h"
+#include "record.h"
+#include "uinput.h"
+
+/// Number of events read from a device per system call
+#define RECORD_READ_EVENTS 256
+
+/// Maximum number of events held for a device's unfinished frame
+#define RECORD_FRAME_EVENTS 64
+
+/// Number of encoded bytes buffered before they are written out
+#define RECORD_WRITE_BYTES 65536
+
+/// @brief Device being recorded
+struct record_device {
+    /// evdev file descriptor, -1 once the device is gone
+    int fd;
+    /// Path the device was opened from
+    const char * path;
+    /// Non-zero if the kernel's timestamps can't be used, the frame is timestamped when read
+    int stamp_on_read;
+    /// Non-zero whilst discarding events after a SYN_DROPPED, up to the next SYN_REPORT
+    int dropping;
+    /// Number of events in frame
+    size_t count;
+    /// Events of the unfinished frame
+    struct uinput_raw_data frame[RECORD_FRAME_EVENTS + 1];
+};
+
+/// Set by the signal handler to stop recording
+static volatile sig_atomic_t RECORD_STOP = 0;
+
+/// Signal handler stopping the recording
+/// @param sig The signal received
+static void record_stop(int sig) {
+    (void)sig;
+    RECORD_STOP = 1;
+}
+
+/// Get the current CLOCK_MONOTONIC time in microseconds
+/// @return Microseconds since an arbitrary fixed point
+static uint64_t record_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/// Append a device's finished frame to the program, preceded by the time since the last frame
+/// @param dev The device
+/// @param time_us Timestamp of the frame
+/// @param [in,out] last_us Timestamp of the previous frame, 0 if none
+/// @param prog The program being recorded
+/// @param stats Counters for the recording
+/// @return 0 on success, 1 if error(s)
+static int record_frame(struct record_device * dev, uint64_t time_us, uint64_t * last_us, struct program_buffer * prog, struct record_stats * stats) {
+    dev->frame[dev->count++] = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
+
+    // Devices are read in turn, so frames of different devices can arrive slightly out of order
+    if (*last_us && time_us > *last_us && program_add_delay(prog, time_us - *last_us)) {
+        return 1;
+    }
+    if (time_us > *last_us) {
+        *last_us = time_us;
+    }
+
+    if (program_add_events(prog, dev->frame, dev->count)) {
+        return 1;
+    }
+    stats->frames++;
+    stats->events += dev->count;
+    dev->count = 0;
+    return 0;
+}
+
+/// Read all pending events of a device
+/// @param dev The device
+/// @param [in,out] last_us Timestamp of the previous frame, 0 if none
+/// @param prog The program being recorded
+/// @param stats Counters for the recording
+/// @return 0 on success, 1 if error(s) or the device is gone
+static int record_read(struct record_device * dev, uint64_t * last_us, struct program_buffer * prog, struct record_stats * stats) {
+    struct input_event events[RECORD_READ_EVENTS];
+
+    for (;;) {
+        ssize_t rc = read(dev->fd, events, sizeof(events));
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rc == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (rc <= 0) {
+            fprintf(stderr, "Stopped recording %s: %s\n", dev->path, rc ? strerror(errno) : "end of file");
+            return 1;
+        }
+
+        uint64_t read_us = dev->stamp_on_read ? record_now_us() : 0;
+        for (size_t i = 0; i != (size_t)rc / sizeof(events[0]); ++i) {
+            const struct input_event * ev = &events[i];
+
+            if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+                stats->drops++;
+                dev->dropping = 1;
+                dev->count = 0;
+            } else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+                if (dev->dropping) {
+                    dev->dropping = 0;
+                    dev->count = 0;
+                } else if (dev->count) {
+                    uint64_t time_us = read_us ? read_us : (uint64_t)ev->input_event_sec * 1000000 + (uint64_t)ev->input_event_usec;
+                    if (record_frame(dev, time_us, last_us, prog, stats)) {
+                        return 1;
+                    }
+                }
+            } else if (dev->dropping) {
+                continue;
+            } else if (!uinput_is_supported_event(ev->type, ev->code) || (ev->type == EV_KEY && ev->value == 2)) {
+                // Repeats of held keys come from the replaying device's own autorepeat
+                stats->filtered++;
+            } else if (dev->count == RECORD_FRAME_EVENTS) {
+                // Not expected from real devices, the rest of the frame is lost
+                stats->filtered++;
+            } else {
+                dev->frame[dev->count++] = (struct uinput_raw_data){ ev->type, ev->code, ev->value };
+            }
+        }
+
+        if (prog->len >= RECORD_WRITE_BYTES) {
+            return 0;
+        }
+    }
+}
+
+/// Open a device for recording
+/// @param [out] dev The device
+/// @param path Path of the device
+/// @param epfd epoll instance to add the device to
+/// @return 0 on success, 1 if error(s)
+static int record_open(struct record_device * dev, const char * path, int epfd) {
+    memset(dev, 0, sizeof(*dev));
+    dev->path = path;
+    dev->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (dev->fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    // Kernel timestamps are taken when the event is generated, unaffected by when we get to read it
+    int clock = CLOCK_MONOTONIC;
+    dev->stamp_on_read = ioctl(dev->fd, EVIOCSCLOCKID, &clock) == -1;
+
+    struct epoll_event ev = { EPOLLIN, { .ptr = dev } };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, dev->fd, &ev)) {
+        fprintf(stderr, "Failed to watch %s: %s\n", path, strerror(errno));
+        close(dev->fd);
+        dev->fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+// Record devices into a program
+int record_devices(const char * output, int count, char * const * paths, uint32_t duration_ms, struct record_stats * stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (count > RECORD_MAX_DEVICES) {
+        fprintf(stderr, "Can't record more than %d devices\n", RECORD_MAX_DEVICES);
+        return 1;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        fprintf(stderr, "Failed to create epoll instance: %s\n", strerror(errno));
+        return 1;
+    }
+
+    static struct record_device devices[RECORD_MAX_DEVICES];
+    int open_devices = 0;
+    int ret = 0;
+    for (int i = 0; i != count; ++i) {
+        devices[i].fd = -1;
+    }
+    for (int i = 0; i != count; ++i) {
+        if (record_open(&devices[i], paths[i], epfd)) {
+            ret = 1;
+            break;
+        }
+        ++open_devices;
+    }
+
+    // The output is only truncated once all devices are open, so a mistyped path keeps an earlier recording
+    int out = -1;
+    if (!ret) {
+        out = strcmp(output, "-") ? open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : STDOUT_FILENO;
+        if (out == -1) {
+            fprintf(stderr, "Failed to open %s: %s\n", output, strerror(errno));
+            ret = 1;
+        }
+    }
+
+    struct program_buffer prog;
+    if (!ret && program_begin(&prog)) {
+        ret = 1;
+    }
+
+    if (!ret) {
+        // No SA_RESTART, so that a signal interrupts epoll_wait()
+        struct sigaction act;
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = record_stop;
+        sigemptyset(&act.sa_mask);
+        sigaction(SIGINT, &act, NULL);
+        sigaction(SIGTERM, &act, NULL);
+
+        uint64_t deadline_us = duration_ms ? record_now_us() + (uint64_t)duration_ms * 1000 : 0;
+        uint64_t last_us = 0;
+
+        while (!RECORD_STOP && open_devices && !ret) {
+            int timeout = -1;
+            if (deadline_us) {
+                uint64_t now_us = record_now_us();
+                if (now_us >= deadline_us) {
+                    break;
+                }
+                timeout = (int)((deadline_us - now_us + 999) / 1000);
+            }
+
+            struct epoll_event events[RECORD_MAX_DEVICES];
+            int n = epoll_wait(epfd, events, RECORD_MAX_DEVICES, timeout);
+            if (n == -1 && errno != EINTR) {
+                fprintf(stderr, "Failed to wait for events: %s\n", strerror(errno));
+                ret = 1;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                struct record_device * dev = events[i].data.ptr;
+                if (record_read(dev, &last_us, &prog, stats)) {
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, dev->fd, NULL);
+                    close(dev->fd);
+                    dev->fd = -1;
+                    --open_devices;
+                }
+            }
+
+            if (prog.len >= RECORD_WRITE_BYTES && program_drain(&prog, out)) {
+                ret = 1;
+            }
+        }
+
+        // Unfinished frames are left out
+        if (program_finish(&prog) || program_drain(&prog, out)) {
+            ret = 1;
+        }
+        program_free(&prog);
+
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+    }
+
+    if (out != -1 && out != STDOUT_FILENO && close(out)) {
+        fprintf(stderr, "Failed to write %s: %s\n", output, strerror(errno));
+        ret = 1;
+    }
+    for (int i = 0; i != count; ++i) {
+        if (devices[i].fd != -1) {
+            close(devices[i].fd);
+        }
+    }
+    close(epfd);
+    return ret;
+}
@@ -0,0 +1,49 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file record.h
+/// @author Harry Austen
+/// @brief Interface for recording real input devices into a program file
+
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+// System includes
+#include <stdint.h>
+
+/// Maximum number of devices recorded at once
+#define RECORD_MAX_DEVICES 32
+
+/// @brief Counters reported at the end of a recording
+struct record_stats {
+    /// Frames written to the program
+    uint64_t frames;
+    /// Events written to the program, including SYN_REPORTs
+    uint64_t events;
+    /// Events left out because the virtual device can't emit them
+    uint64_t filtered;
+    /// Times the kernel reported SYN_DROPPED, each losing part of a frame
+    uint64_t drops;
+};
+
+/// @brief Record input devices into a program file until interrupted
+/// @details Frames are timestamped by the kernel using CLOCK_MONOTONIC and the gaps between them
+/// are stored as delays, so that running the program reproduces the original timing. Recording
+/// stops on SIGINT or SIGTERM, after the given duration, or once all devices are gone
+/// @param output Path of the program file to write, "-" for stdout
+/// @param count Number of devices
+/// @param paths Paths of the devices (e.g. /dev/input/event3)
+/// @param duration_ms Time to record for in milliseconds, 0 for no limit
+/// @param [out] stats Counters for the recording
+/// @return 0 on success, 1 if error(s)
+int record_devices(const char * output, int count, char * const * paths, uint32_t duration_ms, struct record_stats * stats);
+
+#endif // __RECORD_H__
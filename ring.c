@@ -0,0 +1,97 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file ring.c
+/// @author Harry Austen
+/// @brief Implementation of the shared memory event ring
+
+// System includes
+#include <string.h>
+
+// Local includes
+#include "ring.h"
+
+// Header plus event slots
+size_t ydotool_ring_bytes(uint32_t size) {
+    return sizeof(struct ydotool_ring) + size * sizeof(struct uinput_raw_data);
+}
+
+// Empty ring
+void ydotool_ring_init(struct ydotool_ring * ring, uint32_t size) {
+    ring->size = size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    // Consumer starts out waiting for the first events
+    atomic_init(&ring->waiting, 1);
+}
+
+// Producer side free space
+size_t ydotool_ring_space(struct ydotool_ring * ring) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return ring->size - (size_t)(head - tail);
+}
+
+// Producer side copy in
+size_t ydotool_ring_write(struct ydotool_ring * ring, const struct uinput_raw_data * events, size_t count) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t space = ydotool_ring_space(ring);
+    if (count > space) {
+        count = space;
+    }
+
+    // Copy in up to two pieces, either side of the wrap
+    size_t pos = (size_t)head & (ring->size - 1);
+    size_t first = ring->size - pos < count ? ring->size - pos : count;
+    memcpy(ring->events + pos, events, first * sizeof(*events));
+    memcpy(ring->events, events + first, (count - first) * sizeof(*events));
+
+    atomic_store_explicit(&ring->head, head + count, memory_order_seq_cst);
+    return count;
+}
+
+// Producer side wake up check
+int ydotool_ring_needs_wake(struct ydotool_ring * ring) {
+    // Pairs with the store to waiting in ydotool_ring_sleep(): at least one side sees the other
+    return atomic_exchange_explicit(&ring->waiting, 0, memory_order_seq_cst);
+}
+
+// Consumer side copy out
+size_t ydotool_ring_peek(struct ydotool_ring * ring, uint32_t size, struct uinput_raw_data * events, size_t max) {
+    // The counters are in shared memory too, so whatever they hold only slots of the ring are read
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t count = head - tail < size ? (size_t)(head - tail) : size;
+    if (count > max) {
+        count = max;
+    }
+
+    size_t pos = (size_t)tail & (size - 1);
+    size_t first = size - pos < count ? size - pos : count;
+    memcpy(events, ring->events + pos, first * sizeof(*events));
+    memcpy(events + first, ring->events, (count - first) * sizeof(*events));
+    return count;
+}
+
+// Consumer side release
+void ydotool_ring_advance(struct ydotool_ring * ring, size_t count) {
+    atomic_fetch_add_explicit(&ring->tail, count, memory_order_release);
+}
+
+// Consumer side wait announcement
+int ydotool_ring_sleep(struct ydotool_ring * ring) {
+    atomic_store_explicit(&ring->waiting, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->head, memory_order_seq_cst) != atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->waiting, 0, memory_order_relaxed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file ring.h
+/// @author Harry Austen
+/// @brief Single-producer, single-consumer ring of events in memory shared between processes
+/// @details The producer (ydotool) writes events straight into the ring and only signals the
+/// consumer's eventfd when the consumer (ydotoold) has announced it is about to sleep, so a busy
+/// stream of events costs no system calls at all
+
+#ifndef __RING_H__
+#define __RING_H__
+
+// System includes
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Local includes
+#include "uinput.h"
+
+/// Default number of event slots in a ring
+#define YDOTOOL_RING_DEFAULT_SIZE 65536
+
+/// Largest number of event slots accepted for a ring
+#define YDOTOOL_RING_MAX_SIZE (1 << 22)
+
+/// @brief Header of a shared ring, followed in memory by its event slots
+/// @details head and tail are free running counters, each on its own cache line
+struct ydotool_ring {
+    /// Number of event slots (a power of two)
+    uint32_t size;
+    /// Total number of events ever written, only modified by the producer
+    _Alignas(64) _Atomic uint64_t head;
+    /// Total number of events ever read, only modified by the consumer
+    _Alignas(64) _Atomic uint64_t tail;
+    /// Non-zero while the consumer is (about to be) waiting for a signal
+    _Alignas(64) atomic_int waiting;
+    /// Event slots
+    _Alignas(64) struct uinput_raw_data events[];
+};
+
+/// @brief Number of bytes of shared memory needed for a ring
+/// @param size Number of event slots
+/// @return Size in bytes
+size_t ydotool_ring_bytes(uint32_t size);
+
+/// @brief Initialise an empty ring in freshly mapped memory
+/// @param ring The ring to initialise
+/// @param size Number of event slots (must be a power of two)
+void ydotool_ring_init(struct ydotool_ring * ring, uint32_t size);
+
+/// @brief Number of free event slots, as seen by the producer
+/// @param ring The ring to be written to
+/// @return Number of events that can be written without blocking
+size_t ydotool_ring_space(struct ydotool_ring * ring);
+
+/// @brief Write as many of the given events as there is room for
+/// @param ring The ring to write to
+/// @param events The events to write
+/// @param count Number of events
+/// @return Number of events written
+size_t ydotool_ring_write(struct ydotool_ring * ring, const struct uinput_raw_data * events, size_t count);
+
+/// @brief Check, after writing, whether the consumer has to be signalled
+/// @param ring The ring written to
+/// @return Non-zero if the consumer is waiting and must be signalled
+int ydotool_ring_needs_wake(struct ydotool_ring * ring);
+
+/// @brief Copy events out of the ring without consuming them
+/// @details Only ever reads the ring's own slots, even if the producer has scribbled over the
+/// header, so a consumer that doesn't trust the producer stays within the mapping
+/// @param ring The ring to read from
+/// @param size Number of event slots the ring was set up with, kept by the consumer rather than
+/// read back from the shared header
+/// @param [out] events Buffer for the events
+/// @param max Maximum number of events to copy
+/// @return Number of events copied
+size_t ydotool_ring_peek(struct ydotool_ring * ring, uint32_t size, struct uinput_raw_data * events, size_t max);
+
+/// @brief Mark events as consumed, releasing their slots to the producer
+/// @param ring The ring read from
+/// @param count Number of events consumed
+void ydotool_ring_advance(struct ydotool_ring * ring, size_t count);
+
+/// @brief Announce that the consumer is about to wait for a signal
+/// @param ring The ring being consumed
+/// @return 0 if the ring is empty and the consumer may now wait, 1 if events arrived meanwhile
+int ydotool_ring_sleep(struct ydotool_ring * ring);
+
+#endif // __RING_H__
@@ -0,0 +1,146 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file stream.c
+/// @author Harry Austen
+/// @brief Implementation of fixed rate input stream sampling
+
+#define _GNU_SOURCE
+
+// System includes
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Local includes
+#include "stream.h"
+#include "uinput.h"
+
+/// Hand all complete lines or records in the buffer to the input callback
+/// @param stream The stream
+/// @param buf The buffer
+/// @param len Number of bytes in the buffer
+/// @param eof Non-zero if no more input will follow, so a final unterminated line is complete
+/// @param [out] used Number of bytes handled
+/// @return 0 on success, 1 if error(s)
+static int stream_parse(struct stream * stream, char * buf, size_t len, int eof, size_t * used) {
+    *used = 0;
+    while (*used != len) {
+        char * data = buf + *used;
+        size_t size = len - *used;
+        size_t next;
+
+        if (stream->record_size) {
+            if (size < stream->record_size) {
+                break;
+            }
+            size = stream->record_size;
+            next = size;
+        } else {
+            char * newline = memchr(data, '\n', size);
+            if (newline) {
+                size = (size_t)(newline - data);
+                next = size + 1;
+            } else if (eof || size == STREAM_BUF_SIZE - 1) {
+                next = size;
+            } else {
+                break;
+            }
+            data[size] = '\0';
+        }
+
+        stream->records++;
+        if (stream->input(stream, data, size)) {
+            return 1;
+        }
+        *used += next;
+    }
+    return 0;
+}
+
+// Read and sample the stream
+int stream_run(struct stream * stream) {
+    // Room for the NUL terminator of a line filling the buffer
+    static char buf[STREAM_BUF_SIZE];
+    size_t len = 0;
+    int eof = 0;
+    int pending = 0;
+    uint64_t next_us = 0;
+
+    while (!eof || pending) {
+        uint64_t now_us = uinput_now_us();
+
+        if (pending && now_us >= next_us) {
+            stream->ticks++;
+            if (stream->tick(stream)) {
+                return 1;
+            }
+            pending = 0;
+
+            // Keep to the rate, but don't rush to catch up after falling behind
+            next_us = next_us + stream->period_us > now_us ? next_us + stream->period_us : now_us + stream->period_us;
+            continue;
+        }
+
+        // Nothing to wait for but the next tick
+        if (eof) {
+            struct timespec ts = { (time_t)(next_us / 1000000), (long)(next_us % 1000000) * 1000 };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            continue;
+        }
+
+        // Wait for input, or until the next tick if there is input to emit
+        struct pollfd pfd = { stream->fd, POLLIN, 0 };
+        struct timespec timeout = { 0, 0 };
+        if (pending) {
+            uint64_t wait_us = next_us - now_us;
+            timeout.tv_sec = (time_t)(wait_us / 1000000);
+            timeout.tv_nsec = (long)(wait_us % 1000000) * 1000;
+        }
+        int rc = ppoll(&pfd, 1, pending ? &timeout : NULL, NULL);
+        if (rc == -1 && errno != EINTR) {
+            fprintf(stderr, "Failed to wait for input: %s\n", strerror(errno));
+            return 1;
+        }
+        if (rc <= 0) {
+            continue;
+        }
+
+        ssize_t got = read(stream->fd, buf + len, sizeof(buf) - 1 - len);
+        if (got == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (got == -1) {
+            fprintf(stderr, "Failed to read input: %s\n", strerror(errno));
+            return 1;
+        }
+        eof = !got;
+        len += (size_t)got;
+
+        size_t used;
+        uint64_t records = stream->records;
+        if (stream_parse(stream, buf, len, eof, &used)) {
+            return 1;
+        }
+        pending |= stream->records != records;
+        memmove(buf, buf + used, len - used);
+        len -= used;
+
+        if (eof && len) {
+            fprintf(stderr, "Ignoring %zu bytes of incomplete record at end of input\n", len);
+        }
+    }
+
+    return 0;
+}
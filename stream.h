@@ -0,0 +1,58 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file stream.h
+/// @author Harry Austen
+/// @brief Interface for reading input streams and sampling them at a fixed rate
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+
+/// Size of the buffer input is read into. Text lines must be shorter than this
+#define STREAM_BUF_SIZE 65536
+
+/// @brief Input stream sampled at a fixed rate
+/// @details Input is handed to the input callback a line or record at a time as soon as it
+/// arrives, so the caller can accumulate (coalesce) it. The tick callback then emits what has been
+/// accumulated, at most once per period and only when input has arrived since the last tick, so an
+/// idle stream costs nothing
+struct stream {
+    /// File descriptor the stream is read from (e.g. STDIN_FILENO)
+    int fd;
+    /// Size of a binary record in bytes, 0 for newline terminated text lines
+    size_t record_size;
+    /// Minimum time between ticks in microseconds
+    uint64_t period_us;
+    /// Called for each line (NUL terminated, newline removed) or record, in order
+    /// Returns 0 to carry on, 1 to stop with an error
+    int (*input)(struct stream * stream, const char * data, size_t len);
+    /// Called to emit the input accumulated since the last tick
+    /// Returns 0 to carry on, 1 to stop with an error
+    int (*tick)(struct stream * stream);
+    /// State of the caller, for use by the callbacks
+    void * ctx;
+    /// Number of lines or records received
+    uint64_t records;
+    /// Number of ticks
+    uint64_t ticks;
+};
+
+/// @brief Read and sample a stream until its end
+/// @details A final tick emits whatever is left once the end of the stream is reached
+/// @param stream The stream, with fd, record_size, period_us and the callbacks set
+/// @return 0 on success, 1 if error(s)
+int stream_run(struct stream * stream);
+
+#endif // __STREAM_H__
@@ -14,11 +14,19 @@
 /// @brief Program for testing the ydotool code
 
 // System includes
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 // Local includes
+#include "gamepad.h"
+#include "gesture.h"
+#include "program.h"
+#include "protocol.h"
+#include "ring.h"
 #include "uinput.h"
+#include "wheel.h"
 
 /// Check that the char/string to keycode mapping arrays are in chronological order
 /// The strings/characters are compared when using the binary search algorithm and
@@ -117,6 +125,382 @@ int uinput_test_keystring_to_keycode() {
         ret++;
     }
 
+    // Names are matched in any case, and include the kernel's names, following their aliases
+    const struct { const char * name; int code; } names[] = {
+        { "ctrl", KEY_LEFTCTRL }, { "aLT", KEY_LEFTALT }, { "Backspace", KEY_BACKSPACE }, { "f4", KEY_F4 },
+        { "VolumeUp", KEY_VOLUMEUP }, { "leftctrl", KEY_LEFTCTRL }, { "kbdinputassist_nextgroup", KEY_KBDINPUTASSIST_NEXTGROUP },
+        { "screenlock", KEY_COFFEE }, { "brightness_toggle", KEY_DISPLAYTOGGLE }, { "NOTAKEY", -1 }, { "max", -1 },
+        { "ctrl_", -1 }, { "", -1 },
+    };
+    for (size_t i = 0; i != sizeof(names) / sizeof(names[0]); ++i) {
+        code = 0;
+        int found = !uinput_keyname_to_keycode(names[i].name, strlen(names[i].name), &code);
+        if (found != (names[i].code != -1) || (found && code != names[i].code)) {
+            printf("Key name %s gave %d, expected %d\n", names[i].name, found ? code : -1, names[i].code);
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+/// Events captured by uinput_test_capture()
+static struct uinput_raw_data CAPTURED[4 * UINPUT_BATCH_SIZE];
+
+/// Number of events captured by uinput_test_capture()
+static size_t NUM_CAPTURED = 0;
+
+/// Batch output capturing events for inspection instead of emitting them
+/// @param events The events to capture
+/// @param count Number of events
+/// @return 0 on success, 1 if too many events
+int uinput_test_capture(const struct uinput_raw_data * events, size_t count) {
+    if (NUM_CAPTURED + count > sizeof(CAPTURED) / sizeof(CAPTURED[0])) {
+        return 1;
+    }
+    memcpy(CAPTURED + NUM_CAPTURED, events, count * sizeof(*events));
+    NUM_CAPTURED += count;
+    return 0;
+}
+
+/// Prepare a batch writing to uinput_test_capture()
+/// @param [out] batch The batch to prepare
+void uinput_test_capture_batch(struct uinput_batch * batch) {
+    uinput_batch_init(batch);
+    batch->emit = uinput_test_capture;
+    NUM_CAPTURED = 0;
+}
+
+/// Check that a key sequence presses all keys, then releases them all
+/// @return 0 on success, >0 if errors
+int uinput_test_enter_keys() {
+    int ret = 0;
+    struct uinput_batch batch;
+    const uint16_t expected[] = { KEY_LEFTCTRL, KEY_LEFTALT, KEY_F1 };
+
+    uinput_test_capture_batch(&batch);
+    if (uinput_batch_enter_keys(&batch, "CTRL+ALT+F1") || uinput_batch_flush(&batch)) {
+        printf("CTRL+ALT+F1 failed\n");
+        return 1;
+    }
+    if (NUM_CAPTURED != 12) {
+        printf("CTRL+ALT+F1 gave %zu events, expected 12\n", NUM_CAPTURED);
+        return 1;
+    }
+    for (size_t i = 0; i != 6; ++i) {
+        const struct uinput_raw_data * key = &CAPTURED[2 * i];
+        const struct uinput_raw_data * syn = &CAPTURED[2 * i + 1];
+        if (key->type != EV_KEY || key->code != expected[i % 3] || key->value != (i < 3)
+                || syn->type != EV_SYN || syn->code != SYN_REPORT) {
+            printf("CTRL+ALT+F1 frame %zu unexpected\n", i);
+            ret++;
+        }
+    }
+
+    uinput_test_capture_batch(&batch);
+    if (!uinput_batch_enter_keys(&batch, "CTRL+NOTAKEY")) {
+        printf("CTRL+NOTAKEY unexpectedly succeeded\n");
+        ret++;
+    }
+
+    return ret;
+}
+
+/// Check that a compiled key sequence enters the same frames as parsing it on the fly
+/// @return 0 on success, >0 if errors
+int uinput_test_chord() {
+    int ret = 0;
+    struct uinput_batch batch;
+    struct uinput_chord chord;
+
+    uinput_test_capture_batch(&batch);
+    if (uinput_chord_compile(&chord, "CTRL+ALT+F1") || uinput_batch_enter_keys(&batch, "CTRL+ALT+F1") || uinput_batch_flush(&batch)) {
+        printf("CTRL+ALT+F1 failed to compile\n");
+        return 1;
+    }
+    if (chord.press != 6 || chord.len != NUM_CAPTURED || memcmp(chord.events, CAPTURED, NUM_CAPTURED * sizeof(CAPTURED[0]))) {
+        printf("Compiled CTRL+ALT+F1 differs\n");
+        ret++;
+    }
+
+    // Pre-built frames appended past the end of a batch are written out whole
+    uinput_test_capture_batch(&batch);
+    for (size_t i = 0; i != 300; ++i) {
+        if (uinput_batch_events(&batch, chord.events, chord.len)) {
+            printf("Appending compiled CTRL+ALT+F1 failed\n");
+            return ret + 1;
+        }
+    }
+    uinput_batch_flush(&batch);
+    if (NUM_CAPTURED != 300 * chord.len || memcmp(CAPTURED + NUM_CAPTURED - chord.len, chord.events, sizeof(chord.events[0]) * chord.len)) {
+        printf("Repeated CTRL+ALT+F1 gave %zu events\n", NUM_CAPTURED);
+        ret++;
+    }
+    uinput_chord_free(&chord);
+
+    // Long sequences are compiled whole, even past the size of a batch
+    char sequence[2 * UINPUT_BATCH_SIZE];
+    strcpy(sequence, "A+B+C+D+E+F+G+H+I+J+K+L+M+N+O+P+Q+R+S+T+U+V+W+X+Y+Z");
+    for (int pass = 0; pass != 2; ++pass) {
+        uinput_test_capture_batch(&batch);
+        if (uinput_chord_compile(&chord, sequence) || uinput_batch_enter_keys(&batch, sequence) || uinput_batch_flush(&batch)) {
+            printf("Key sequence of %zu characters failed to compile\n", strlen(sequence));
+            return ret + 1;
+        }
+        if (chord.len != NUM_CAPTURED || memcmp(chord.events, CAPTURED, NUM_CAPTURED * sizeof(CAPTURED[0]))) {
+            printf("Compiled key sequence of %zu characters differs\n", strlen(sequence));
+            ret++;
+        }
+        uinput_chord_free(&chord);
+
+        strcpy(sequence, "a");
+        for (size_t i = 1; i != UINPUT_BATCH_SIZE / 2; ++i) {
+            strcat(sequence, "+a");
+        }
+    }
+
+    if (!uinput_chord_compile(&chord, "CTRL+NOTAKEY")) {
+        printf("Unknown key sequence compiled\n");
+        uinput_chord_free(&chord);
+        ret++;
+    }
+
+    return ret;
+}
+
+/// Count the Shift presses and all events captured
+/// @param [out] events Number of events captured
+/// @return Number of Shift presses
+static size_t uinput_test_count_shift(size_t * events) {
+    size_t presses = 0;
+    for (size_t i = 0; i != NUM_CAPTURED; ++i) {
+        presses += CAPTURED[i].type == EV_KEY && CAPTURED[i].code == KEY_LEFTSHIFT && CAPTURED[i].value == 1;
+    }
+    *events = NUM_CAPTURED;
+    return presses;
+}
+
+/// Check that typing holds Shift once over each run of shifted characters, and honours Caps Lock
+/// @return 0 on success, >0 if errors
+int uinput_test_type() {
+    int ret = 0;
+    struct uinput_batch batch;
+    size_t events;
+
+    // 11 keypresses, with Shift pressed and released around each run of capitals
+    uinput_test_capture_batch(&batch);
+    if (uinput_batch_type(&batch, "HELLO WORLD", 11, 0) || uinput_batch_flush(&batch)
+            || uinput_test_count_shift(&events) != 2 || events != 11 * 4 + 4 * 2
+            || CAPTURED[NUM_CAPTURED - 2].code != KEY_LEFTSHIFT || CAPTURED[NUM_CAPTURED - 2].value != 0) {
+        printf("Typing HELLO WORLD gave %zu events\n", NUM_CAPTURED);
+        ret++;
+    }
+
+    // With Caps Lock on, the capital is typed without Shift and the small letter with it
+    uinput_test_capture_batch(&batch);
+    if (uinput_batch_type(&batch, "Hi!", 3, UINPUT_TYPE_CAPS_LOCK) || uinput_batch_flush(&batch)
+            || uinput_test_count_shift(&events) != 1 || events != 3 * 4 + 2 * 2
+            || CAPTURED[0].code != KEY_H || CAPTURED[0].value != 1) {
+        printf("Typing Hi! with Caps Lock gave %zu events\n", NUM_CAPTURED);
+        ret++;
+    }
+
+    uinput_test_capture_batch(&batch);
+    if (!uinput_batch_type(&batch, "AB\x01", 3, 0) || (uinput_batch_flush(&batch), NUM_CAPTURED)) {
+        printf("Typing an untypeable character unexpectedly succeeded\n");
+        ret++;
+    }
+
+    // Untypeable characters both inside and after a whole block of 16 are all caught
+    const char blocks[] = "The quick brown\x7f fox\x80\n";
+    uinput_test_capture_batch(&batch);
+    if (!uinput_batch_type(&batch, blocks, sizeof(blocks) - 1, 0) || (uinput_batch_flush(&batch), NUM_CAPTURED)) {
+        printf("Typing untypeable characters after the first block unexpectedly succeeded\n");
+        ret++;
+    }
+
+    // The table typing text agrees with the key tables for every character
+    for (char c = ' '; c != 0x7f; ++c) {
+        uint16_t keycode = 0;
+        uint8_t shifted = 0;
+        struct uinput_typist typist;
+        struct uinput_raw_data typed[6];
+        size_t used;
+        uinput_typist_init(&typist, 0);
+        size_t count = uinput_typist_events(&typist, &c, 1, typed, 6, &used);
+        if (uinput_keychar_to_keycode(c, &keycode, &shifted) || count != (shifted ? 6u : 4u) || used != 1
+                || typed[count - 4].code != keycode || typist.shift != shifted) {
+            printf("Typing %c gave %zu events\n", c, count);
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+/// Check that characters outside ASCII are entered by their code point, and bad UTF-8 is refused
+/// @return 0 on success, >0 if errors
+int uinput_test_type_unicode() {
+    int ret = 0;
+    struct uinput_batch batch;
+
+    // a, then Ctrl+Shift+U, the four hex digits of U+00E9 and Space
+    const uint16_t digits[] = { KEY_0, KEY_0, KEY_E, KEY_9 };
+    uinput_test_capture_batch(&batch);
+    if (uinput_batch_type(&batch, "a\xc3\xa9", 3, 0) || uinput_batch_flush(&batch) || NUM_CAPTURED != 36
+            || CAPTURED[4].code != KEY_LEFTCTRL || CAPTURED[NUM_CAPTURED - 2].code != KEY_SPACE) {
+        printf("Typing a\xc3\xa9 gave %zu events\n", NUM_CAPTURED);
+        ret++;
+    } else {
+        for (size_t i = 0, digit = 0; i != NUM_CAPTURED && digit != 4; ++i) {
+            if (i > 12 && CAPTURED[i].type == EV_KEY && CAPTURED[i].value == 1 && CAPTURED[i].code != digits[digit++]) {
+                printf("Digit %zu of U+00E9 typed as key %u\n", digit, CAPTURED[i].code);
+                ret++;
+            }
+        }
+    }
+
+    // Bad and cut short UTF-8 is caught before anything is typed
+    const char * bad[] = { "\xc3(", "\xe2\x98", "\xc0\xaf", "\xed\xa0\x80" };
+    for (size_t i = 0; i != sizeof(bad) / sizeof(bad[0]); ++i) {
+        uinput_test_capture_batch(&batch);
+        if (!uinput_batch_type(&batch, bad[i], strlen(bad[i]), 0) || (uinput_batch_flush(&batch), NUM_CAPTURED)) {
+            printf("Typing bad UTF-8 %zu unexpectedly succeeded\n", i);
+            ret++;
+        }
+    }
+
+    if (uinput_text_complete("ab\xe2\x98", 4) != 2 || uinput_text_complete("ab\xe2\x98\x83", 5) != 5
+            || uinput_text_complete("ab\x80", 3) != 3 || uinput_text_char_len("\xe2\x98\x83!", 4) != 3) {
+        printf("Splitting UTF-8 at whole characters failed\n");
+        ret++;
+    }
+
+    // With entry by code point off, characters outside ASCII can't be typed
+    uinput_test_capture_batch(&batch);
+    if (uinput_set_unicode(NULL, NULL) || !uinput_batch_type(&batch, "\xc3\xa9", 2, 0) || (uinput_batch_flush(&batch), NUM_CAPTURED)) {
+        printf("Typing U+00E9 with entry by code point off unexpectedly succeeded\n");
+        ret++;
+    }
+    if (!uinput_set_unicode("CTRL+NOSUCHKEY", "SPACE")) {
+        printf("Setting a bad code point entry sequence unexpectedly succeeded\n");
+        ret++;
+    }
+    if (uinput_set_unicode(UINPUT_UNICODE_START_DEFAULT, UINPUT_UNICODE_END_DEFAULT)) {
+        printf("Restoring the code point entry sequences failed\n");
+        ret++;
+    }
+
+    return ret;
+}
+
+/// Check that the event filter matches the virtual device's capabilities
+/// @return 0 on success, >0 if errors
+int uinput_test_supported_event() {
+    int ret = 0;
+    const struct { uint16_t type; uint16_t code; int supported; } cases[] = {
+        { EV_KEY, KEY_A, 1 }, { EV_KEY, BTN_LEFT, 1 }, { EV_KEY, KEY_F12, 1 }, { EV_KEY, KEY_PLAYPAUSE, 1 },
+        { EV_KEY, KEY_MAX + 1, 0 }, { EV_REL, REL_X, 1 }, { EV_SYN, SYN_REPORT, 1 }, { EV_SYN, SYN_DROPPED, 0 },
+        { EV_MSC, MSC_SCAN, 0 }, { EV_LED, LED_CAPSL, 0 }, { EV_REL, REL_WHEEL_HI_RES, 1 }, { EV_REL, REL_DIAL, 0 },
+        { EV_KEY, BTN_SOUTH, 0 },
+    };
+
+    for (size_t i = 0; i != sizeof(cases) / sizeof(cases[0]); ++i) {
+        if (uinput_is_supported_event(cases[i].type, cases[i].code) != cases[i].supported) {
+            printf("Event type %u code %u wrongly %s\n", cases[i].type, cases[i].code, cases[i].supported ? "filtered" : "supported");
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+/// Check that motion steps add up exactly to relative movement and end on absolute targets
+/// @return 0 on success, >0 if errors
+int uinput_test_motion() {
+    int ret = 0;
+    struct uinput_batch batch;
+
+    // Relative steps of a fraction of a pixel are left out, not rounded away
+    struct uinput_motion motion = { 0, 0, 1000, -7, 0, 0, 0, 0, 100, 300, UINPUT_MOTION_RELATIVE };
+    uint32_t steps = uinput_motion_steps(&motion);
+    int32_t x = 0;
+    int32_t y = 0;
+    int64_t sum_x = 0;
+    int64_t sum_y = 0;
+    uinput_test_capture_batch(&batch);
+    for (uint32_t step = 0; step <= steps; ++step) {
+        uinput_batch_motion_step(&batch, &motion, step, &x, &y);
+    }
+    uinput_batch_flush(&batch);
+    for (size_t i = 0; i != NUM_CAPTURED; ++i) {
+        if (CAPTURED[i].type == EV_REL) {
+            *(CAPTURED[i].code == REL_X ? &sum_x : &sum_y) += CAPTURED[i].value;
+        } else if (i && CAPTURED[i - 1].type == EV_SYN) {
+            printf("Relative motion gave an empty frame\n");
+            ret++;
+        }
+    }
+    if (steps != 30 || sum_x != 1000 || sum_y != -7) {
+        printf("Relative motion of %" PRIu32 " steps moved %" PRId64 ",%" PRId64 "\n", steps, sum_x, sum_y);
+        ret++;
+    }
+
+    // Absolute motion starts by putting the pointer in place, with frames for the tablet device
+    motion = (struct uinput_motion){ 10, 20, 500, 400, 600, 0, 0, 600, 1000, 60, UINPUT_MOTION_BEZIER | UINPUT_MOTION_FROM };
+    x = motion.from_x;
+    y = motion.from_y;
+    uinput_test_capture_batch(&batch);
+    for (uint32_t step = 0; step <= uinput_motion_steps(&motion); ++step) {
+        uinput_batch_motion_step(&batch, &motion, step, &x, &y);
+    }
+    uinput_batch_flush(&batch);
+    if (NUM_CAPTURED < 8 || CAPTURED[0].type != UINPUT_EV_DEVICE || CAPTURED[0].value != UINPUT_DEVICE_TABLET
+            || CAPTURED[1].value != 10 || CAPTURED[2].value != 20
+            || CAPTURED[NUM_CAPTURED - 3].value != 500 || CAPTURED[NUM_CAPTURED - 2].value != 400) {
+        printf("Absolute motion doesn't go from 10,20 to 500,400\n");
+        ret++;
+    }
+
+    return ret;
+}
+
+/// Check that a spread out scroll adds up exactly, with whole notches alongside high resolution steps
+/// @return 0 on success, >0 if errors
+int uinput_test_scroll() {
+    int ret = 0;
+    struct uinput_batch batch;
+
+    // Two and a half notches down in 10 steps, completing a notch at the 4th and 8th
+    int64_t hi_res = 0;
+    int64_t notches = 0;
+    size_t frames = 0;
+    uinput_test_capture_batch(&batch);
+    if (uinput_batch_scroll(&batch, 0, -UINPUT_SCROLL_NOTCH * 5 / 2, 100, 100, 1) || uinput_batch_flush(&batch)) {
+        printf("Scroll failed\n");
+        return 1;
+    }
+    for (size_t i = 0; i != NUM_CAPTURED; ++i) {
+        if (CAPTURED[i].type == EV_REL && CAPTURED[i].code == REL_WHEEL_HI_RES) {
+            hi_res += CAPTURED[i].value;
+        } else if (CAPTURED[i].type == EV_REL && CAPTURED[i].code == REL_WHEEL) {
+            notches += CAPTURED[i].value;
+            if (frames != 3 && frames != 7) {
+                printf("Scroll notch in frame %zu\n", frames);
+                ret++;
+            }
+        } else if (CAPTURED[i].type == EV_SYN) {
+            frames++;
+        } else {
+            printf("Unexpected scroll event type %u code %u\n", CAPTURED[i].type, CAPTURED[i].code);
+            ret++;
+        }
+    }
+    if (frames != 10 || hi_res != -300 || notches != -2) {
+        printf("Scroll of %zu frames moved %" PRId64 " (%" PRId64 " notches)\n", frames, hi_res, notches);
+        ret++;
+    }
+
     return ret;
 }
 
@@ -127,16 +511,352 @@ int uinput_test() {
 
     ret += uinput_test_array_order();
     ret += uinput_test_keystring_to_keycode();
+    ret += uinput_test_enter_keys();
+    ret += uinput_test_chord();
+    ret += uinput_test_type();
+    ret += uinput_test_type_unicode();
+    ret += uinput_test_supported_event();
+    ret += uinput_test_motion();
+    ret += uinput_test_scroll();
+
+    return ret;
+}
+
+/// Check that the protocol handshake can't be mistaken for the first event of a legacy client
+/// and that the wire structures have no padding
+/// @return 0 on success, >0 if errors
+int protocol_test_layout() {
+    int ret = 0;
+
+    if ((YDOTOOL_PROTOCOL_MAGIC & 0xffff) <= EV_MAX) {
+        printf("Protocol magic 0x%x is a valid legacy event type\n", YDOTOOL_PROTOCOL_MAGIC);
+        ret++;
+    }
+
+    if (sizeof(struct ydotool_hello) != 8 || sizeof(struct ydotool_msg_header) != 8 || sizeof(struct uinput_raw_data) != 8
+            || sizeof(struct uinput_motion) != 44) {
+        printf("Unexpected wire structure sizes\n");
+        ret++;
+    }
+
+    return ret;
+}
+
+/// Check that the consumer of a ring stays within its slots whatever the producer writes to the header
+/// @return 0 on success, >0 if errors
+int protocol_test_ring() {
+    int ret = 0;
+    const uint32_t size = 16;
+    struct ydotool_ring * ring = aligned_alloc(64, ydotool_ring_bytes(size));
+    if (!ring) {
+        printf("Failed to allocate ring\n");
+        return 1;
+    }
+    ydotool_ring_init(ring, size);
+
+    struct uinput_raw_data events[64];
+    ring->size = UINT32_MAX;
+    atomic_store(&ring->tail, 5);
+    atomic_store(&ring->head, UINT64_MAX);
+    if (ydotool_ring_peek(ring, size, events, 64) != size) {
+        printf("Ring with a bad header gave more events than it has slots\n");
+        ret++;
+    }
+    atomic_store(&ring->head, 3);
+    if (ydotool_ring_peek(ring, size, events, 64) != size) {
+        printf("Ring with head behind tail gave more events than it has slots\n");
+        ret++;
+    }
+
+    free(ring);
+    return ret;
+}
+
+/// Check that the timer wheel gives out timers in deadline order, only once they are due
+/// @return 0 on success, >0 if errors
+int protocol_test_wheel() {
+    static struct ydotool_wheel wheel;
+    ydotool_wheel_init(&wheel);
+
+    // Deadlines out of order, two in the same tick, one a rotation or more away and one late
+    const uint64_t now = 10000000;
+    const struct {
+        uint64_t time_us;
+        int32_t value;
+    } timers[] = {
+        { now + 5000, 3 },
+        { now + 1500, 1 },
+        { now + 1500, 2 },
+        { now + 3 * YDOTOOL_WHEEL_SLOTS * YDOTOOL_WHEEL_TICK_US, 5 },
+        { now + 1200 + YDOTOOL_WHEEL_SLOTS * YDOTOOL_WHEEL_TICK_US, 4 },
+        { now - 2000, 0 },
+    };
+    for (size_t i = 0; i != sizeof(timers) / sizeof(timers[0]); ++i) {
+        struct uinput_raw_data event = { EV_KEY, KEY_A, timers[i].value };
+        if (!ydotool_wheel_add(&wheel, timers[i].time_us, now, &event, 1)) {
+            printf("Failed to add timer\n");
+            ydotool_wheel_clear(&wheel);
+            return 1;
+        }
+    }
+
+    int ret = 0;
+    if (ydotool_wheel_next(&wheel) != now - 2000) {
+        printf("Timer wheel's next deadline %" PRIu64 " is not the earliest\n", ydotool_wheel_next(&wheel));
+        ret++;
+    }
+
+    // Each check time gives out the timers up to the given value, and no more
+    const struct {
+        uint64_t now_us;
+        int32_t last;
+    } checks[] = {
+        { now, 0 },
+        { now + 1499, 0 },
+        { now + 1500, 2 },
+        { now + 4999, 2 },
+        { now + 6000, 3 },
+        { now + 1199 + YDOTOOL_WHEEL_SLOTS * YDOTOOL_WHEEL_TICK_US, 3 },
+        { now + 1200 + YDOTOOL_WHEEL_SLOTS * YDOTOOL_WHEEL_TICK_US, 4 },
+        { now + 4 * YDOTOOL_WHEEL_SLOTS * YDOTOOL_WHEEL_TICK_US, 5 },
+    };
+    int32_t expected = 0;
+    for (size_t i = 0; i != sizeof(checks) / sizeof(checks[0]); ++i) {
+        struct ydotool_timer * timer;
+        while ((timer = ydotool_wheel_pop(&wheel, checks[i].now_us))) {
+            if (timer->events[0].value != expected || expected > checks[i].last || timer->time_us > checks[i].now_us) {
+                printf("Timer %" PRId32 " given out at %" PRIu64 ", expected %" PRId32 " up to %" PRId32 "\n",
+                    timer->events[0].value, checks[i].now_us - now, expected, checks[i].last);
+                ret++;
+            }
+            expected = timer->events[0].value + 1;
+            free(timer);
+        }
+        if (expected != checks[i].last + 1) {
+            printf("Timer %" PRId32 " not given out by %" PRIu64 "\n", expected, checks[i].now_us - now);
+            ret++;
+            expected = checks[i].last + 1;
+        }
+    }
+    if (wheel.events || ydotool_wheel_next(&wheel)) {
+        printf("Timer wheel not empty after all deadlines\n");
+        ret++;
+    }
+
+    ydotool_wheel_clear(&wheel);
+    return ret;
+}
+
+/// Tests for the protocol.h definitions
+/// @return 0 on success, >0 if errors
+int protocol_test() {
+    return protocol_test_layout() + protocol_test_ring() + protocol_test_wheel();
+}
+
+/// Check that running a compiled script gives the same events as entering its steps directly,
+/// and that truncated programs are rejected
+/// @return 0 on success, >0 if errors
+int program_test_round_trip() {
+    const char script[] =
+        "# comment\n"
+        "loop 2\n"
+        "    type Hi!\\n\n"
+        "    loop 0\n"
+        "        key CTRL+C\n"
+        "    end\n"
+        "end\n"
+        "delay 0\n"
+        "key CTRL+ALT+F1 A\n"
+        "mouse --relative -300 70000\n"
+        "click 2";
+    struct uinput_raw_data expected[4 * UINPUT_BATCH_SIZE];
+    struct uinput_batch batch;
+
+    uinput_test_capture_batch(&batch);
+    for (int i = 0; i != 2; ++i) {
+        for (const char * c = "Hi!\n"; *c; ++c) {
+            uinput_batch_enter_char(&batch, *c);
+        }
+    }
+    uinput_batch_enter_keys(&batch, "CTRL+ALT+F1");
+    uinput_batch_enter_keys(&batch, "A");
+    uinput_batch_relative_move_mouse(&batch, -300, 70000);
+    uinput_batch_keypress(&batch, BTN_RIGHT);
+    uinput_batch_flush(&batch);
+    size_t num_expected = NUM_CAPTURED;
+    memcpy(expected, CAPTURED, num_expected * sizeof(*expected));
+
+    struct program_buffer prog;
+    if (program_compile(script, strlen(script), "test", &prog)) {
+        printf("Failed to compile test script\n");
+        return 1;
+    }
+
+    int ret = 0;
+    if (prog.len >= num_expected * sizeof(struct uinput_raw_data) / 2) {
+        printf("Program of %zu bytes for %zu events is not compact\n", prog.len, num_expected);
+        ret++;
+    }
+
+    uinput_test_capture_batch(&batch);
+    if (program_run(prog.data, prog.len, &batch, 1)) {
+        printf("Failed to run test program\n");
+        ret++;
+    } else if (NUM_CAPTURED != num_expected || memcmp(CAPTURED, expected, num_expected * sizeof(*expected))) {
+        printf("Test program gave %zu events, expected %zu\n", NUM_CAPTURED, num_expected);
+        ret++;
+    }
+
+    // Inside the outer loop, or part way through the last events block
+    const size_t truncated[] = { sizeof(struct program_header) - 1, sizeof(struct program_header) + 2, 20, prog.len - 1 };
+    for (size_t i = 0; i != sizeof(truncated) / sizeof(truncated[0]); ++i) {
+        uinput_test_capture_batch(&batch);
+        if (!program_run(prog.data, truncated[i], &batch, 1)) {
+            printf("Program truncated to %zu bytes unexpectedly succeeded\n", truncated[i]);
+            ret++;
+        }
+    }
+
+    program_free(&prog);
+
+    const char * bad[] = { "loop 2\ntype a\n", "end\n", "key NOTAKEY\n", "delay -1\n", "jump 4\n" };
+    for (size_t i = 0; i != sizeof(bad) / sizeof(bad[0]); ++i) {
+        if (!program_compile(bad[i], strlen(bad[i]), "test", &prog)) {
+            printf("Compiling bad script %zu unexpectedly succeeded\n", i);
+            program_free(&prog);
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+/// Tests for the program.c/h functions
+/// @return 0 on success, >0 if errors
+int program_test() {
+    return program_test_round_trip();
+}
+
+/// Check that a swipe touches down, moves and lifts all fingers in whole touchscreen frames
+/// @return 0 on success, >0 if errors
+int gesture_test_swipe() {
+    int ret = 0;
+    struct uinput_batch batch;
+    struct gesture swipe = { GESTURE_SWIPE, 3, 500, 300, 200, -100, 0, 0, 100, 100 };
+
+    uinput_test_capture_batch(&batch);
+    if (gesture_batch(&batch, &swipe, 0) || uinput_batch_flush(&batch)) {
+        printf("Swipe failed\n");
+        return 1;
+    }
+
+    // Touch down, 10 moves and lift
+    size_t frames = 0;
+    int touching = 0;
+    int32_t middle_x = 0;
+    int32_t middle_y = 0;
+    int32_t slot = -1;
+    for (size_t i = 0; i != NUM_CAPTURED; ++i) {
+        const struct uinput_raw_data * ev = &CAPTURED[i];
+        if (i == 0 || (CAPTURED[i - 1].type == EV_SYN && CAPTURED[i - 1].code == SYN_REPORT)) {
+            if (ev->type != UINPUT_EV_DEVICE || ev->value != UINPUT_DEVICE_TOUCH) {
+                printf("Swipe frame %zu not for the touchscreen\n", frames);
+                ret++;
+            }
+        }
+        if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+            frames++;
+        } else if (ev->type == EV_ABS && ev->code == ABS_MT_SLOT) {
+            slot = ev->value;
+        } else if (ev->type == EV_ABS && ev->code == ABS_MT_TRACKING_ID) {
+            touching += ev->value == -1 ? -1 : 1;
+        } else if (ev->type == EV_ABS && ev->code == ABS_MT_POSITION_X && slot == 1) {
+            middle_x = ev->value;
+        } else if (ev->type == EV_ABS && ev->code == ABS_MT_POSITION_Y && slot == 1) {
+            middle_y = ev->value;
+        }
+    }
+    if (frames != 12 || touching != 0 || middle_x != 700 || middle_y != 200) {
+        printf("Swipe gave %zu frames, %d fingers left down, middle finger at %" PRId32 ",%" PRId32 "\n", frames, touching, middle_x, middle_y);
+        ret++;
+    }
+
+    swipe.fingers = UINPUT_TOUCH_SLOTS + 1;
+    uinput_test_capture_batch(&batch);
+    if (!gesture_batch(&batch, &swipe, 0)) {
+        printf("Swipe with %d fingers unexpectedly succeeded\n", UINPUT_TOUCH_SLOTS + 1);
+        ret++;
+    }
+
+    return ret;
+}
+
+/// Tests for the gesture.c/h functions
+/// @return 0 on success, >0 if errors
+int gesture_test() {
+    return gesture_test_swipe();
+}
+
+/// Check that axes are coalesced and clamped, while every button change gets through
+/// @return 0 on success, >0 if errors
+int gamepad_test_coalesce() {
+    int ret = 0;
+    struct uinput_batch batch;
+    struct gamepad gamepad;
+    const char * samples[] = { "x=100", "south=1", "x=200", "z=999", "south=0", "hat0y=-1", "east=1" };
+    const struct uinput_raw_data expected[] = {
+        { UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_GAMEPAD }, { EV_ABS, ABS_X, 200 }, { EV_ABS, ABS_Z, 255 }, { EV_ABS, ABS_HAT0Y, -1 },
+        { EV_KEY, BTN_SOUTH, 1 }, { EV_SYN, SYN_REPORT, 0 },
+        { UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_GAMEPAD }, { EV_KEY, BTN_SOUTH, 0 }, { EV_KEY, BTN_EAST, 1 }, { EV_SYN, SYN_REPORT, 0 },
+    };
+
+    gamepad_init(&gamepad);
+    for (size_t i = 0; i != sizeof(samples) / sizeof(samples[0]); ++i) {
+        int control;
+        int32_t value;
+        if (gamepad_parse(samples[i], strlen(samples[i]), &control, &value) || gamepad_set(&gamepad, control, value)) {
+            printf("Gamepad sample %s rejected\n", samples[i]);
+            ret++;
+        }
+    }
+    uinput_test_capture_batch(&batch);
+    gamepad_batch(&batch, &gamepad);
+    gamepad_batch(&batch, &gamepad);
+    uinput_batch_flush(&batch);
+    if (NUM_CAPTURED != sizeof(expected) / sizeof(expected[0]) || memcmp(CAPTURED, expected, sizeof(expected))) {
+        printf("Gamepad gave %zu unexpected events\n", NUM_CAPTURED);
+        ret++;
+    }
+
+    const char * malformed[] = { "x", "x=", "=1", "foo=1", "x=1a", "start1" };
+    for (size_t i = 0; i != sizeof(malformed) / sizeof(malformed[0]); ++i) {
+        int control;
+        int32_t value;
+        if (!gamepad_parse(malformed[i], strlen(malformed[i]), &control, &value)) {
+            printf("Malformed gamepad sample %s accepted\n", malformed[i]);
+            ret++;
+        }
+    }
 
     return ret;
 }
 
+/// Tests for the gamepad.c/h functions
+/// @return 0 on success, >0 if errors
+int gamepad_test() {
+    return gamepad_test_coalesce();
+}
+
 /// Main entrypoint for the test executable
 /// @return 0 on success, >0 if errors
 int main() {
     int ret = 0;
 
     ret += uinput_test();
+    ret += protocol_test();
+    ret += program_test();
+    ret += gesture_test();
+    ret += gamepad_test();
 
     if (ret) {
         printf("FAILED %d tests\n", ret);
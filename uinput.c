@@ -17,17 +17,33 @@
 
 // System includes
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Local includes
+#include "protocol.h"
+#include "keyhash.h"
+#include "ring.h"
 #include "uinput.h"
 
 /// Wrapper macro for errno error check
@@ -37,11 +53,92 @@
 #define NUM_KEYCODES 91
 
 /// Total number of event codes that can be sent
-#define NUM_EVCODES 4
+#define NUM_EVCODES 3
+
+/// Total number of relative axes of the main device
+#define NUM_RELCODES 6
 
 /// uinput file descriptor
 static int FD = -1;
 
+/// Maximum number of events written to the device per system call
+/// Kept below the size of an evdev client buffer (at least 64 events)
+#define UINPUT_WRITE_SIZE 64
+
+/// Time to wait for the daemon to answer the protocol handshake
+#define HANDSHAKE_TIMEOUT_MS 250
+
+/// Protocol version spoken with the ydotool daemon, or 0 if FD is the uinput device itself
+/// Version 1 is the legacy raw event stream without handshake
+static int BACKEND_DAEMON = 0;
+
+/// Non-zero to ask the daemon for a shared memory ring
+static int USE_SHM = 0;
+
+/// Shared memory ring the daemon reads events from, if in use
+static struct ydotool_ring * RING = NULL;
+
+/// Daemon's eventfd, signalled when writing to an idle ring
+static int FD_RING = -1;
+
+/// Time to sleep whilst waiting for space in a full ring
+#define RING_FULL_WAIT_US 100
+
+/// Time ahead of their deadline at which timed events are handed to the daemon, which does the
+/// precise wait. Also bounds how much of a long timed sequence the daemon has to hold
+#define SCHEDULE_LOOKAHEAD_US 50000
+
+/// Latest deadline of the timed events handed to the daemon
+static uint64_t SCHEDULED_US = 0;
+
+/// Inter-frame gap used until (or unless) the pacer has readback information
+#define PACER_DEFAULT_GAP_US 50
+
+/// Upper bound on the inter-frame gap
+#define PACER_MAX_GAP_US 20000
+
+/// Interval at which the readback node is drained, modelling a consumer that is only
+/// scheduled once per millisecond. Drops seen at this cadence mean we are writing faster
+/// than such a consumer can keep up with
+#define PACER_POLL_US 1000
+
+/// Default time to wait for a newly created device to be picked up by a reader
+#define INIT_TIMEOUT_DEFAULT_MS 1000
+
+/// Maximum time to wait for a newly created device to be picked up by a reader
+static uint32_t INIT_TIMEOUT_MS = INIT_TIMEOUT_DEFAULT_MS;
+
+/// Read only file descriptor for the evdev node of the created device, used to pace writes
+static int FD_READBACK = -1;
+
+/// Timestamp (us) at which the readback node was last drained
+static uint64_t PACER_LAST_POLL = 0;
+
+/// Frames written since the readback node was last drained
+static uint64_t PACER_PENDING = 0;
+
+/// Current pacing state
+static struct uinput_pacer_stats PACER = { PACER_DEFAULT_GAP_US, 0, 0, 0 };
+
+/// File descriptors of the virtual devices other than the main one (FD), -1 until created
+static int FD_DEVICE[UINPUT_NUM_DEVICES] = { -1, -1, -1, -1 };
+
+/// Screen width spanned by the absolute pointer and touch devices
+static uint32_t SCREEN_WIDTH = UINPUT_SCREEN_WIDTH_DEFAULT;
+
+/// Screen height spanned by the absolute pointer and touch devices
+static uint32_t SCREEN_HEIGHT = UINPUT_SCREEN_HEIGHT_DEFAULT;
+
+/// Time a key is held on the main device before the kernel repeats it, 0 for no autorepeat
+static uint32_t REPEAT_DELAY_MS = UINPUT_REPEAT_DELAY_DEFAULT;
+
+/// Time between the kernel's repeats of a key held on the main device
+static uint32_t REPEAT_PERIOD_MS = UINPUT_REPEAT_PERIOD_DEFAULT;
+
+/// Resolution of the screen spanning axes in units (pixels) per mm, that of a roughly 100 dpi
+/// screen, so that physical sizes derived from it are plausible
+#define SCREEN_RESOLUTION 4
+
 /// All valid keycodes
 static const int KEYCODES[NUM_KEYCODES] = {
     BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5,
@@ -63,10 +160,45 @@ static const int KEYCODES[NUM_KEYCODES] = {
 static const int EVCODES[NUM_EVCODES] = {
     EV_KEY,
     EV_REL,
-    EV_ABS,
     EV_SYN
 };
 
+/// All relative axes of the main device
+static const int RELCODES[NUM_RELCODES] = {
+    REL_X,
+    REL_Y,
+    REL_WHEEL,
+    REL_HWHEEL,
+    REL_WHEEL_HI_RES,
+    REL_HWHEEL_HI_RES
+};
+
+/// Controls of the gamepad device, laid out like common (Xbox style) controllers. The triggers
+/// are the Z axes and the d-pad is the hat, as the kernel's own gamepad drivers report them
+const struct uinput_gamepad_control GAMEPAD_CONTROLS[] = {
+    {"x",      EV_ABS, ABS_X,      INT16_MIN, INT16_MAX},
+    {"y",      EV_ABS, ABS_Y,      INT16_MIN, INT16_MAX},
+    {"rx",     EV_ABS, ABS_RX,     INT16_MIN, INT16_MAX},
+    {"ry",     EV_ABS, ABS_RY,     INT16_MIN, INT16_MAX},
+    {"z",      EV_ABS, ABS_Z,      0,         UINT8_MAX},
+    {"rz",     EV_ABS, ABS_RZ,     0,         UINT8_MAX},
+    {"hat0x",  EV_ABS, ABS_HAT0X,  -1,        1        },
+    {"hat0y",  EV_ABS, ABS_HAT0Y,  -1,        1        },
+    {"south",  EV_KEY, BTN_SOUTH,  0,         1        },
+    {"east",   EV_KEY, BTN_EAST,   0,         1        },
+    {"north",  EV_KEY, BTN_NORTH,  0,         1        },
+    {"west",   EV_KEY, BTN_WEST,   0,         1        },
+    {"tl",     EV_KEY, BTN_TL,     0,         1        },
+    {"tr",     EV_KEY, BTN_TR,     0,         1        },
+    {"tl2",    EV_KEY, BTN_TL2,    0,         1        },
+    {"tr2",    EV_KEY, BTN_TR2,    0,         1        },
+    {"select", EV_KEY, BTN_SELECT, 0,         1        },
+    {"start",  EV_KEY, BTN_START,  0,         1        },
+    {"mode",   EV_KEY, BTN_MODE,   0,         1        },
+    {"thumbl", EV_KEY, BTN_THUMBL, 0,         1        },
+    {"thumbr", EV_KEY, BTN_THUMBR, 0,         1        },
+};
+
 /// All valid non-shifted characters
 /// Used for mapping the char representation to the uinput keycode
 const struct key_char NORMAL_KEYS[] = {
@@ -174,94 +306,6 @@ const struct key_char SHIFTED_KEYS[] = {
     {'~', KEY_BACKSLASH}
 };
 
-/// All valid modifier keys
-/// Used for mapping the string representation to the uinput keycode
-const struct key_string MODIFIER_KEYS[] = {
-	{"ALT", KEY_LEFTALT},
-    {"ALT_L", KEY_LEFTALT},
-    {"ALT_R", KEY_RIGHTALT},
-	{"CTRL", KEY_LEFTCTRL},
-    {"CTRL_L", KEY_LEFTCTRL},
-    {"CTRL_R", KEY_RIGHTCTRL},
-	{"META", KEY_LEFTMETA},
-    {"META_L", KEY_LEFTMETA},
-    {"META_R", KEY_RIGHTMETA},
-	{"SHIFT", KEY_LEFTSHIFT},
-    {"SHIFT_L", KEY_LEFTSHIFT},
-    {"SHIFT_R", KEY_RIGHTSHIFT},
-	{"SUPER", KEY_LEFTMETA},
-    {"SUPER_L", KEY_LEFTMETA},
-    {"SUPER_R", KEY_RIGHTMETA}
-};
-
-/// All valid function keys
-/// Used for mapping the string representation to the uinput keycode
-const struct key_string FUNCTION_KEYS[] = {
-	{"BACKSPACE", KEY_BACKSPACE},
-    {"CAPSLOCK", KEY_CAPSLOCK},
-    {"DELETE", KEY_DELETE},
-    {"DOWN", KEY_DOWN},
-    {"END", KEY_END},
-    {"ENTER", KEY_ENTER},
-    {"ESC", KEY_ESC},
-	{"F1", KEY_F1},
-    {"F10", KEY_F10},
-    {"F11", KEY_F11},
-    {"F12", KEY_F12},
-    {"F2", KEY_F2},
-    {"F3", KEY_F3},
-    {"F4", KEY_F4},
-    {"F5", KEY_F5},
-    {"F6", KEY_F6},
-    {"F7", KEY_F7},
-    {"F8", KEY_F8},
-    {"F9", KEY_F9},
-    {"HOME", KEY_HOME},
-    {"INSERT", KEY_INSERT},
-    {"LEFT", KEY_LEFT},
-    {"NUMLOCK", KEY_NUMLOCK},
-    {"PAGEDOWN", KEY_PAGEDOWN},
-    {"PAGEUP", KEY_PAGEUP},
-    {"PAUSE", KEY_PAUSE},
-    {"RIGHT", KEY_RIGHT},
-    {"SCROLLLOCK", KEY_SCROLLLOCK},
-    {"SYSRQ", KEY_SYSRQ},
-	{"TAB", KEY_TAB},
-    {"UP", KEY_UP}
-};
-
-/// Search the given array for a given string and return its keycode
-/// @param arr Array of *keys* to be searched
-/// @param len Length of arr
-/// @param str The character array to be found
-/// @param [out] code The keycode associated with str, if found
-/// @return 0 on success, 1 if error(s)
-int uinput_binary_search_string(const struct key_string * arr, size_t len, const char * str, uint16_t * code) {
-    size_t lo = 0;
-    size_t hi = len-1;
-    while (lo <= hi) {
-        // Calculate middle element index
-        size_t mid = (hi + lo)/2;
-
-        // If middle element equals target string, found!
-        if (!strcmp(arr[mid].string, str)) {
-            *code = arr[mid].code;
-            return 0;
-        }
-
-        // If middle element less than target string, remove lower half
-        if (strcmp(arr[mid].string, str) < 0) {
-            lo = mid + 1;
-        // If middle element greater than target string, remove upper half
-        } else {
-            hi = mid - 1;
-        }
-    }
-
-    // If we reach here, string is not found
-    return 1;
-}
-
 /// Search the given array for a given character and return its keycode
 /// @param arr Array of *keys* to be searched
 /// @param len Length of arr
@@ -269,11 +313,12 @@ int uinput_binary_search_string(const struct key_string * arr, size_t len, const
 /// @param [out] code The keycode associated with c, if found
 /// @return 0 on success, 1 if error(s)
 int uinput_binary_search_char(const struct key_char * arr, size_t len, char c, uint16_t * code) {
+    // Search the half open range [lo, hi), so that hi never drops below 0
     size_t lo = 0;
-    size_t hi = len-1;
-    while (lo <= hi) {
+    size_t hi = len;
+    while (lo < hi) {
         // Calculate middle element index
-        size_t mid = (hi + lo)/2;
+        size_t mid = lo + (hi - lo)/2;
 
         // If middle element equals target char, found!
         if (arr[mid].character == c) {
@@ -286,7 +331,7 @@ int uinput_binary_search_char(const struct key_char * arr, size_t len, char c, u
             lo = mid + 1;
         // If middle element greater than target char, remove upper half
         } else {
-            hi = mid - 1;
+            hi = mid;
         }
     }
 
@@ -294,255 +339,2203 @@ int uinput_binary_search_char(const struct key_char * arr, size_t len, char c, u
     return 1;
 }
 
-/// Create socket to talk to ydotool daemon
-/// @return 0 on succes, 1 if error(s)
-int uinput_connect_socket() {
-    const char * path_socket = "/tmp/.ydotool_socket";
-    FD = socket(AF_UNIX, SOCK_STREAM, 0);
+/// CHAR_KEYS flag of characters typed with Shift held
+#define CHAR_KEY_SHIFT 0x8000
 
-    if (FD == -1) {
-        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
-        return 1;
-    }
+/// CHAR_KEYS flag of letters, whose Shift Caps Lock swaps
+#define CHAR_KEY_LETTER 0x4000
 
-    struct sockaddr_un addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sun_family = AF_UNIX;
-    strncpy(addr.sun_path, path_socket, sizeof(addr.sun_path)-1);
+/// CHAR_KEYS bits holding the keycode
+#define CHAR_KEY_CODE 0x3fff
 
-    if (connect(FD, (struct sockaddr *)&addr, sizeof(addr))) {
-        fprintf(stderr, "Failed to connect to socket: %s\n", strerror(errno));
-        return 1;
-    }
+/// Keycode and CHAR_KEY_* flags of every byte, 0 if it can't be typed.
+/// Built from NORMAL_KEYS and SHIFTED_KEYS by uinput_char_keys_build()
+static uint16_t CHAR_KEYS[256];
 
-    return 0;
-}
+/// Non-zero if every printable ASCII character, tab and newline can be typed, so whole blocks of
+/// them can be passed by uinput_check_text() without looking each one up
+static int CHAR_KEYS_ASCII = 0;
 
-// Initialise the input device
-int uinput_init() {
-    // Attempt to connect to ydotoold backend if running
-    if (!uinput_connect_socket()) {
-        printf("Using ydotoold backend\n");
-        return 0;
-    }
+/// Guard building CHAR_KEYS once, as the daemon may type from more than one thread
+static pthread_once_t CHAR_KEYS_ONCE = PTHREAD_ONCE_INIT;
 
-    // Check write access to uinput driver device
-    if (access("/dev/uinput", W_OK)) {
-        fprintf(stderr, "Do not have access to write to /dev/uinput!\n"
-            "Try running as root\n");
-        return 1;
-    }
+/// Number of bits of the index of a UNICODE_CACHE slot
+#define UNICODE_CACHE_BITS 8
 
-    // Confirm availability of uinput kernel module
-    struct utsname uname_buffer;
-    CHECK( uname(&uname_buffer) );
-    char kernel_mod_dir[50] = "/lib/modules/";
-    strcat(kernel_mod_dir, uname_buffer.release);
-    struct stat stats;
-    stat(kernel_mod_dir, &stats);
-    if (!S_ISDIR(stats.st_mode)) {
-        fprintf(stderr, "Dir (%s) doesn't exist!\n"
-            "Have you recently updated your kernel version?\n"
-            "Restart your system to use new kernel modules\n", kernel_mod_dir);
-        return 1;
-    }
+/// Most events of the frames kept in a UNICODE_CACHE slot
+#define UNICODE_CACHE_EVENTS 48
 
-    // Open uinput driver device
-    CHECK( (FD = open("/dev/uinput", O_WRONLY|O_NONBLOCK)) );
+/// Most events of each code point entry sequence, so that a whole character always fits in a batch
+#define UNICODE_CHORD_EVENTS 128
+
+/// @brief Frames entering one character by its code point
+struct uinput_unicode_frames {
+    /// The code point, 0 for an empty slot
+    uint32_t code_point;
+    /// Number of events
+    uint32_t len;
+    /// UNICODE_START, the code point's hex digits, then UNICODE_END
+    struct uinput_raw_data events[UNICODE_CACHE_EVENTS];
+};
+
+/// Non-zero if characters outside ASCII can be typed by their code points
+static int UNICODE_ENABLED = 0;
+
+/// Non-zero if the code point entry sequences aren't the ones ydotoold uses
+static int UNICODE_CUSTOM = 0;
+
+/// Key sequence starting the entry of a code point
+static struct uinput_chord UNICODE_START;
 
-    // Events/Keys setup
-    for (int i = 0; i != NUM_KEYCODES; ++i) {
-        CHECK( ioctl(FD, UI_SET_KEYBIT, KEYCODES[i]) );
+/// Key sequence ending the entry of a code point
+static struct uinput_chord UNICODE_END;
+
+/// Frames of the code points typed so far, built once each, in slots picked by a hash of the
+/// code point
+static struct uinput_unicode_frames UNICODE_CACHE[1 << UNICODE_CACHE_BITS];
+
+/// Guard UNICODE_CACHE
+static pthread_mutex_t UNICODE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/// Fill in CHAR_KEYS from the sorted key tables, and set up the default code point entry
+static void uinput_char_keys_build() {
+    for (size_t i = 0; i != NUM_NORMAL_KEYS; ++i) {
+        CHAR_KEYS[(unsigned char)NORMAL_KEYS[i].character] = (uint16_t)NORMAL_KEYS[i].code;
+    }
+    for (size_t i = 0; i != NUM_SHIFTED_KEYS; ++i) {
+        unsigned char c = (unsigned char)SHIFTED_KEYS[i].character;
+        if (!CHAR_KEYS[c]) {
+            CHAR_KEYS[c] = (uint16_t)(SHIFTED_KEYS[i].code | CHAR_KEY_SHIFT);
+        }
     }
-    for (int i = 0; i != NUM_EVCODES; ++i) {
-        CHECK( ioctl(FD, UI_SET_EVBIT, EVCODES[i]) );
+    for (int c = 'a'; c <= 'z'; ++c) {
+        CHAR_KEYS[c] = CHAR_KEYS[c] ? (uint16_t)(CHAR_KEYS[c] | CHAR_KEY_LETTER) : 0;
+        CHAR_KEYS[c - 'a' + 'A'] = CHAR_KEYS[c - 'a' + 'A'] ? (uint16_t)(CHAR_KEYS[c - 'a' + 'A'] | CHAR_KEY_LETTER) : 0;
     }
 
-    // uinput device setup
-    struct uinput_setup usetup = {
-        {
-            BUS_USB,
-            0x1234,
-            0x5678,
-            0
-        },
-        "ydotool virtual device",
-        0
-    };
+    CHAR_KEYS_ASCII = CHAR_KEYS['\t'] && CHAR_KEYS['\n'];
+    for (int c = ' '; c != 0x7f; ++c) {
+        CHAR_KEYS_ASCII = CHAR_KEYS_ASCII && CHAR_KEYS[c];
+    }
+
+    UNICODE_ENABLED = !uinput_chord_compile(&UNICODE_START, UINPUT_UNICODE_START_DEFAULT)
+        && !uinput_chord_compile(&UNICODE_END, UINPUT_UNICODE_END_DEFAULT);
+}
 
-    CHECK( ioctl(FD, UI_DEV_SETUP, &usetup) );
-    CHECK( ioctl(FD, UI_DEV_CREATE) );
+/// Decode the UTF-8 sequence at the start of a text
+/// @param text The text
+/// @param len Length of the text, at least 1
+/// @param [out] code_point The code point
+/// @return Length of the sequence, 0 if the text ends part way through it, -1 if it isn't valid
+/// UTF-8 (including overlong forms and surrogates)
+static int uinput_utf8_decode(const char * text, size_t len, uint32_t * code_point) {
+    const unsigned char * bytes = (const unsigned char *)text;
+    uint32_t value;
+    uint32_t minimum;
+    size_t n;
 
-    // Wait for device to come up
-    usleep(1000000);
+    if (bytes[0] < 0x80) {
+        *code_point = bytes[0];
+        return 1;
+    } else if ((bytes[0] & 0xe0) == 0xc0) {
+        n = 2;
+        value = bytes[0] & 0x1f;
+        minimum = 0x80;
+    } else if ((bytes[0] & 0xf0) == 0xe0) {
+        n = 3;
+        value = bytes[0] & 0x0f;
+        minimum = 0x800;
+    } else if ((bytes[0] & 0xf8) == 0xf0) {
+        n = 4;
+        value = bytes[0] & 0x07;
+        minimum = 0x10000;
+    } else {
+        return -1;
+    }
 
-    return 0;
+    for (size_t i = 1; i != n; ++i) {
+        if (i == len) {
+            return 0;
+        }
+        if ((bytes[i] & 0xc0) != 0x80) {
+            return -1;
+        }
+        value = value << 6 | (bytes[i] & 0x3f);
+    }
+    if (value < minimum || value > 0x10ffff || (value >= 0xd800 && value <= 0xdfff)) {
+        return -1;
+    }
+
+    *code_point = value;
+    return (int)n;
 }
 
-// Delete the input device
-int uinput_destroy() {
-    if (FD != -1) {
-        ioctl(FD, UI_DEV_DESTROY);
-        close(FD);
-        FD = -1;
+/// Count the hex digits a code point is entered with, at least four as it is usually written
+/// @param code_point The code point
+/// @return Number of digits
+static size_t uinput_unicode_digits(uint32_t code_point) {
+    size_t digits = 4;
+    while (digits != 8 && code_point >> (4 * digits)) {
+        ++digits;
     }
-    return 0;
+    return digits;
 }
 
-int uinput_keychar_to_keycode(const char c, uint16_t * keycode, uint8_t * shifted) {
-    // Search normal keys
-    if (!uinput_binary_search_char(NORMAL_KEYS, NUM_NORMAL_KEYS, c, keycode)) {
-        return 0;
+/// Build the frames entering a character by its code point
+/// @param code_point The code point
+/// @param [out] events Room for the frames
+/// @return Number of events written
+static size_t uinput_unicode_build(uint32_t code_point, struct uinput_raw_data * events) {
+    struct uinput_raw_data * event = events;
+    memcpy(event, UNICODE_START.events, UNICODE_START.len * sizeof(*event));
+    event += UNICODE_START.len;
+
+    for (size_t digit = uinput_unicode_digits(code_point); digit--;) {
+        uint16_t code = CHAR_KEYS[(unsigned char)"0123456789abcdef"[(code_point >> (4 * digit)) & 0xf]] & CHAR_KEY_CODE;
+        *event++ = (struct uinput_raw_data){ EV_KEY, code, 1 };
+        *event++ = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
+        *event++ = (struct uinput_raw_data){ EV_KEY, code, 0 };
+        *event++ = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
     }
-    // Search shifted keys
-    if (!uinput_binary_search_char(SHIFTED_KEYS, NUM_SHIFTED_KEYS, c, keycode)) {
-        *shifted = 1;
-        return 0;
+
+    memcpy(event, UNICODE_END.events, UNICODE_END.len * sizeof(*event));
+    event += UNICODE_END.len;
+    return (size_t)(event - events);
+}
+
+/// Write out the frames entering a character by its code point, built once and then kept
+/// @param code_point The code point
+/// @param [out] events Room for the frames
+/// @return Number of events written
+static size_t uinput_unicode_frames(uint32_t code_point, struct uinput_raw_data * events) {
+    size_t len = UNICODE_START.len + 4 * uinput_unicode_digits(code_point) + UNICODE_END.len;
+    if (len > UNICODE_CACHE_EVENTS) {
+        return uinput_unicode_build(code_point, events);
     }
 
-    fprintf(stderr, "Failed to find key char %c!\n", c);
-    return 1;
+    struct uinput_unicode_frames * frames = &UNICODE_CACHE[(code_point * 0x9e3779b1u) >> (32 - UNICODE_CACHE_BITS)];
+    pthread_mutex_lock(&UNICODE_LOCK);
+    if (frames->code_point != code_point) {
+        frames->len = (uint32_t)uinput_unicode_build(code_point, frames->events);
+        frames->code_point = code_point;
+    }
+    memcpy(events, frames->events, len * sizeof(*events));
+    pthread_mutex_unlock(&UNICODE_LOCK);
+    return len;
 }
 
-int uinput_keystring_to_keycode(const char * key_string, uint16_t * keycode, uint8_t * shifted) {
-    *shifted = 0;
+/// Negotiate the protocol version with the daemon
+/// @details The daemon speaks first, so nothing is sent until it is known to understand it.
+/// Daemons that don't greet the client in time are spoken to with the legacy protocol, which
+/// costs every connection to them the whole HANDSHAKE_TIMEOUT_MS
+/// @return The protocol version to use
+static int uinput_handshake() {
+    struct ydotool_hello hello;
 
-    if (strlen(key_string) == 1) {
-        return uinput_keychar_to_keycode(key_string[0], keycode, shifted);
+    struct pollfd pfd = { FD, POLLIN, 0 };
+    if (poll(&pfd, 1, HANDSHAKE_TIMEOUT_MS) != 1
+            || recv(FD, &hello, sizeof(hello), MSG_WAITALL) != sizeof(hello)
+            || hello.magic != YDOTOOL_PROTOCOL_MAGIC
+            || hello.version < 2
+            ) {
+        return 1;
     }
 
-    // Search modifier keys
-    if (!uinput_binary_search_string(MODIFIER_KEYS, NUM_MODIFIER_KEYS, key_string, keycode)) {
-        return 0;
+    int version = hello.version < YDOTOOL_PROTOCOL_VERSION ? (int)hello.version : YDOTOOL_PROTOCOL_VERSION;
+    hello.magic = YDOTOOL_PROTOCOL_MAGIC;
+    hello.version = YDOTOOL_PROTOCOL_VERSION;
+    if (write(FD, &hello, sizeof(hello)) != sizeof(hello)) {
+        return 1;
     }
-    // Search function keys
-    if (!uinput_binary_search_string(FUNCTION_KEYS, NUM_FUNCTION_KEYS, key_string, keycode)) {
-        return 0;
+    return version;
+}
+
+/// Ask the daemon for a shared memory ring to write events to
+/// @details Events keep going over the socket if the daemon refuses
+/// @return 0 on success, 1 if error(s)
+static int uinput_request_ring() {
+    struct ydotool_msg_header header = { YDOTOOL_MSG_SHM, 0, 0 };
+    if (write(FD, &header, sizeof(header)) != sizeof(header)) {
+        return 1;
     }
 
-    fprintf(stderr, "Failed to find key string %s!\n", key_string);
-    return 1;
-}
+    // Answer carries the memfd and eventfd
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { &header, sizeof(header) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
 
-int uinput_enter_key(const char * key_string, int32_t value) {
-    uint8_t shifted = 0;
-    uint16_t keycode = 0;
+    if (recvmsg(FD, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(header) || header.kind != YDOTOOL_MSG_SHM) {
+        fprintf(stderr, "Failed to receive ring from daemon\n");
+        return 1;
+    }
 
-    if (!uinput_keystring_to_keycode(key_string, &keycode, &shifted)) {
-        if (shifted) {
-            if (uinput_send_key(KEY_LEFTSHIFT, value) || uinput_send_key(keycode, value)) {
-                return 1;
-            }
-        } else {
-            if (uinput_send_key(keycode, value)) {
-                return 1;
-            }
-        }
-        return 0;
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    if (!header.count || !cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        fprintf(stderr, "Daemon refused shared memory ring, using socket\n");
+        return 1;
     }
 
-    return 1;
+    int fds[2];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    void * mem = mmap(NULL, ydotool_ring_bytes(header.count), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "Failed to map ring: %s\n", strerror(errno));
+        close(fds[1]);
+        return 1;
+    }
+
+    RING = mem;
+    FD_RING = fds[1];
+    return 0;
 }
 
-// Emulate typing the given character on the vitual device
-int uinput_enter_char(char c) {
-    uint8_t shifted = 0;
-    uint16_t keycode = 0;
+/// Write events to the shared memory ring, signalling the daemon if it is idle
+/// @details Only whole frames are published where possible, so the daemon never has to wait
+/// for the rest of a frame
+/// @param events Array of events to be written, in order
+/// @param count Number of events in the array
+/// @return 0 on success, 1 if error(s)
+static int uinput_ring_events(const struct uinput_raw_data * events, size_t count) {
+    while (count) {
+        size_t space = ydotool_ring_space(RING);
 
-    if (!uinput_keychar_to_keycode(c, &keycode, &shifted)) {
-        if (shifted) {
-            if (uinput_send_shifted_keypress(keycode)) {
-                return 1;
+        size_t len = count;
+        if (len > space) {
+            // Cut at the last frame boundary that fits, or wait for space
+            len = space;
+            while (len && !(events[len - 1].type == EV_SYN && events[len - 1].code == SYN_REPORT)) {
+                --len;
             }
-        } else {
-            if (uinput_send_keypress(keycode)) {
-                return 1;
+            if (!len && space != RING->size) {
+                if (ydotool_ring_needs_wake(RING)) {
+                    eventfd_write(FD_RING, 1);
+                }
+                usleep(RING_FULL_WAIT_US);
+                continue;
+            }
+            if (!len) {
+                len = space;
             }
         }
-        return 0;
-    }
 
-    return 1;
+        ydotool_ring_write(RING, events, len);
+        if (ydotool_ring_needs_wake(RING)) {
+            CHECK( eventfd_write(FD_RING, 1) );
+        }
+
+        events += len;
+        count -= len;
+    }
+    return 0;
 }
 
-// Trigger an input event
-int uinput_emit(uint16_t type, uint16_t code, int32_t value) {
-    struct input_event ie = {
-        // Ignore timestamp values
-        {0,0},
-        type,
-        code,
-        value
-    };
+/// Create socket to talk to ydotool daemon
+/// @return 0 on succes, 1 if error(s)
+int uinput_connect_socket() {
+    FD = socket(AF_UNIX, SOCK_STREAM, 0);
 
     if (FD == -1) {
-        if (uinput_init()) {
-            return 1;
-        }
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return 1;
     }
 
-    CHECK( write(FD, &ie, sizeof(ie)) );
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, YDOTOOL_SOCKET_PATH, sizeof(addr.sun_path)-1);
 
-    // Allow processing time for uinput before sending next event
-    usleep( 50 );
+    if (connect(FD, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Failed to connect to socket: %s\n", strerror(errno));
+        close(FD);
+        FD = -1;
+        return 1;
+    }
 
+    BACKEND_DAEMON = uinput_handshake();
+    if (USE_SHM && BACKEND_DAEMON >= 2) {
+        uinput_request_ring();
+    }
     return 0;
 }
 
-// Single key event and report
-int uinput_send_key(uint16_t code, int32_t value) {
-    if (uinput_emit(EV_KEY, code, value) || uinput_emit(EV_SYN, SYN_REPORT, 0)) {
-        return 1;
-    }
-    return 0;
+// Ask for a shared memory ring when connecting to the daemon
+void uinput_set_shm(int enable) {
+    USE_SHM = enable;
 }
 
-// Emulate a quick key press
-int uinput_send_keypress(uint16_t code) {
-    // send press followed by release
-    if (uinput_send_key(code, 1) || uinput_send_key(code, 0)) {
-        return 1;
-    }
-    return 0;
+// Current CLOCK_MONOTONIC time
+uint64_t uinput_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
-// Emulate a shifted key press
-int uinput_send_shifted_keypress(uint16_t code) {
-    // Send shift press, keypress, shift release
-    if (uinput_send_key(KEY_LEFTSHIFT, 1)
-            || uinput_send_keypress(code)
-            || uinput_send_key(KEY_LEFTSHIFT, 0)
-            ) {
+/// Find the evdev node (e.g. /dev/input/event5) of a created uinput device
+/// @param fd uinput file descriptor of the device
+/// @param [out] path Buffer to hold the path to the device node
+/// @param len Length of the path buffer
+/// @return 0 on success, 1 if error(s)
+static int uinput_device_node(int fd, char * path, size_t len) {
+    char sysname[32];
+    char sysdir[64];
+
+    CHECK( ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) );
+    snprintf(sysdir, sizeof(sysdir), "/sys/devices/virtual/input/%s", sysname);
+
+    DIR * dir = opendir(sysdir);
+    if (!dir) {
+        fprintf(stderr, "Failed to open %s: %s\n", sysdir, strerror(errno));
         return 1;
     }
-    return 0;
+
+    // The event handler shows up as an "eventN" entry of the input device
+    int ret = 1;
+    struct dirent * entry;
+    while ((entry = readdir(dir))) {
+        if (!strncmp(entry->d_name, "event", 5)) {
+            snprintf(path, len, "/dev/input/%s", entry->d_name);
+            ret = 0;
+            break;
+        }
+    }
+
+    closedir(dir);
+    return ret;
 }
 
-// Move the cursor to a given (x,y) position
-int uinput_move_mouse(int32_t x, int32_t y) {
-    if (uinput_emit(EV_ABS, ABS_X, x)
-            || uinput_emit(EV_ABS, ABS_Y, y)
-            || uinput_emit(EV_SYN, SYN_REPORT, 0)
-            ) {
+/// Wait for the given device node to appear in /dev/input
+/// @param node Path to the device node
+/// @param deadline CLOCK_MONOTONIC time (us) after which to give up
+/// @return 0 if the node exists, 1 on timeout or error(s)
+static int uinput_wait_node(const char * node, uint64_t deadline) {
+    // Usually already created by devtmpfs, so avoid inotify setup costs
+    if (!access(node, F_OK)) {
+        return 0;
+    }
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    CHECK( fd );
+    if (inotify_add_watch(fd, "/dev/input", IN_CREATE | IN_ATTRIB) == -1) {
+        fprintf(stderr, "Failed to watch /dev/input: %s\n", strerror(errno));
+        close(fd);
         return 1;
     }
-    return 0;
-}
 
-// Move the cursor a given (x,y) relative to the current position
-int uinput_relative_move_mouse(int32_t x, int32_t y) {
-    if (x) {
-        if (uinput_emit(EV_REL, REL_X, x)) {
-            return 1;
+    // Check again in case the node was created before the watch was added
+    int ret = 1;
+    while ((ret = access(node, F_OK) ? 1 : 0)) {
+        uint64_t now = uinput_now_us();
+        if (now >= deadline) {
+            break;
         }
-    }
-    if (y) {
-        if (uinput_emit(EV_REL, REL_Y, y)) {
-            return 1;
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) <= 0) {
+            continue;
         }
+
+        // Contents don't matter, just clear the notification
+        char buf[4096];
+        while (read(fd, buf, sizeof(buf)) > 0) {}
     }
-    if (uinput_emit(EV_SYN, SYN_REPORT, 0)) {
-        return 1;
-    }
-    return 0;
+
+    close(fd);
+    return ret;
+}
+
+/// Look through all processes' open files, once, for readers of input device nodes
+/// @param node Path to the device node
+/// @param [out] readers Set to non-zero if another process has any input device node open
+/// @return 1 if another process has the given node open, 0 if not
+static int uinput_node_has_reader(const char * node, int * readers) {
+    *readers = 0;
+    DIR * proc = opendir("/proc");
+    if (!proc) {
+        // Can't tell, so assume somebody picks the device up
+        *readers = 1;
+        return 0;
+    }
+
+    pid_t self = getpid();
+    int found = 0;
+    struct dirent * pid_entry;
+    while (!found && (pid_entry = readdir(proc))) {
+        char * end;
+        long pid = strtol(pid_entry->d_name, &end, 10);
+        if (*end || pid <= 0 || pid == self) {
+            continue;
+        }
+
+        char fd_dir[64];
+        snprintf(fd_dir, sizeof(fd_dir), "/proc/%ld/fd", pid);
+        DIR * fds = opendir(fd_dir);
+        if (!fds) {
+            continue;
+        }
+
+        struct dirent * fd_entry;
+        while (!found && (fd_entry = readdir(fds))) {
+            char link[320];
+            char target[64];
+            snprintf(link, sizeof(link), "%s/%s", fd_dir, fd_entry->d_name);
+            ssize_t len = readlink(link, target, sizeof(target) - 1);
+            if (len > 0) {
+                target[len] = '\0';
+                found = !strcmp(target, node);
+                *readers |= !strncmp(target, "/dev/input/event", 16);
+            }
+        }
+        closedir(fds);
+    }
+
+    closedir(proc);
+    return found;
+}
+
+/// Wait until a created device has been opened by a reader (e.g. the compositor)
+/// @details Opens of the node are watched with inotify, so /proc is only looked through once,
+/// for a reader that was quicker than the watch. Nothing is waited for if the node can't be
+/// found, or if no other process reads any input device (e.g. on a text console, where the
+/// kernel consumes the events itself), as then nobody is going to open this one either
+/// @param fd uinput file descriptor of the device
+/// @return 0 if a reader was found, 1 if not
+static int uinput_wait_ready(int fd) {
+    uint64_t deadline = uinput_now_us() + (uint64_t)INIT_TIMEOUT_MS * 1000;
+    char node[64];
+    if (!INIT_TIMEOUT_MS || uinput_device_node(fd, node, sizeof(node)) || uinput_wait_node(node, deadline)) {
+        return 1;
+    }
+
+    int fd_notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_notify == -1 || inotify_add_watch(fd_notify, node, IN_OPEN) == -1) {
+        fprintf(stderr, "Failed to watch %s: %s\n", node, strerror(errno));
+        if (fd_notify != -1) {
+            close(fd_notify);
+        }
+        return 1;
+    }
+
+    // The watch is in place, so any reader opening the node from now on is seen
+    int readers;
+    int ret = !uinput_node_has_reader(node, &readers);
+    while (ret && readers) {
+        uint64_t now = uinput_now_us();
+        if (now >= deadline) {
+            break;
+        }
+
+        struct pollfd pfd = { fd_notify, POLLIN, 0 };
+        if (poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) > 0) {
+            ret = 0;
+        }
+    }
+
+    close(fd_notify);
+    return ret;
+}
+
+// Set maximum time to wait for the device to come up
+void uinput_set_init_timeout(uint32_t timeout_ms) {
+    INIT_TIMEOUT_MS = timeout_ms;
+}
+
+// Set the screen size spanned by the absolute pointer device
+void uinput_set_screen_size(uint32_t width, uint32_t height) {
+    SCREEN_WIDTH = width;
+    SCREEN_HEIGHT = height;
+}
+
+// Set the kernel's autorepeat of held keys
+void uinput_set_autorepeat(uint32_t delay_ms, uint32_t period_ms) {
+    REPEAT_DELAY_MS = delay_ms;
+    REPEAT_PERIOD_MS = period_ms;
+}
+
+/// Open the evdev node of the created device to read back written frames for pacing
+/// @return 0 on success, 1 if error(s)
+static int uinput_pacer_open() {
+    char node[64];
+
+    if (uinput_device_node(FD, node, sizeof(node))) {
+        return 1;
+    }
+
+    FD_READBACK = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (FD_READBACK == -1) {
+        fprintf(stderr, "Failed to open %s for pacing, using fixed delays: %s\n", node, strerror(errno));
+        return 1;
+    }
+
+    PACER_LAST_POLL = uinput_now_us();
+    return 0;
+}
+
+/// Drain the readback node and adjust the inter-frame gap
+/// @details A SYN_DROPPED means the evdev client buffer overflowed between two reads, so
+/// the gap is doubled. Fewer SYN_REPORTs than frames written alone is no loss: the input core
+/// swallows frames that change nothing, such as a 0,0 move or pressing a key already held.
+/// Each clean read shrinks the gap slightly, so that the pacer settles just below the highest
+/// rate at which frames are delivered without loss
+static void uinput_pacer_poll() {
+    struct input_event buf[UINPUT_WRITE_SIZE];
+    uint64_t received = 0;
+    int dropped = 0;
+
+    for (;;) {
+        ssize_t rc = read(FD_READBACK, buf, sizeof(buf));
+        if (rc <= 0) {
+            break;
+        }
+        for (size_t i = 0; i != (size_t)rc / sizeof(buf[0]); ++i) {
+            if (buf[i].type != EV_SYN) {
+                continue;
+            }
+            if (buf[i].code == SYN_REPORT) {
+                ++received;
+            } else if (buf[i].code == SYN_DROPPED) {
+                dropped = 1;
+            }
+        }
+    }
+
+    if (dropped) {
+        PACER.drops += PACER_PENDING > received ? PACER_PENDING - received : 1;
+        PACER.gap_us = PACER.gap_us ? PACER.gap_us * 2 : 1;
+        if (PACER.gap_us > PACER_MAX_GAP_US) {
+            PACER.gap_us = PACER_MAX_GAP_US;
+        }
+    } else if (PACER.gap_us) {
+        PACER.gap_us -= PACER.gap_us / 16 + 1;
+    }
+
+    PACER_PENDING = 0;
+    PACER_LAST_POLL = uinput_now_us();
+}
+
+/// Account for frames just written and wait for the current inter-frame gap
+/// @param frames Number of complete frames in the last write
+static void uinput_pacer_wait(size_t frames) {
+    PACER.frames += frames;
+    PACER.writes++;
+
+    if (FD_READBACK == -1) {
+        // No readback available, keep a fixed gap
+        usleep( (useconds_t)(PACER.gap_us * (frames ? frames : 1)) );
+        return;
+    }
+
+    PACER_PENDING += frames;
+    if (PACER.gap_us) {
+        usleep( (useconds_t)(PACER.gap_us * frames) );
+    }
+    if (uinput_now_us() - PACER_LAST_POLL >= PACER_POLL_US) {
+        uinput_pacer_poll();
+    }
+}
+
+// Current pacing state
+void uinput_get_pacer_stats(struct uinput_pacer_stats * stats) {
+    *stats = PACER;
+}
+
+// Human readable pacing state
+void uinput_print_pacer_stats(FILE * stream) {
+    if (PACER.gap_us) {
+        fprintf(stream, "pacing: gap %" PRIu32 "us (max %" PRIu32 " frames/s)", PACER.gap_us, 1000000 / PACER.gap_us);
+    } else {
+        fprintf(stream, "pacing: no gap (unthrottled)");
+    }
+    fprintf(stream, ", %" PRIu64 " frames in %" PRIu64 " writes, %" PRIu64 " dropped%s\n",
+        PACER.frames, PACER.writes, PACER.drops, FD_READBACK == -1 ? " (no readback)" : "");
+}
+
+/// Set up an absolute axis of a virtual device
+/// @param fd uinput file descriptor of the device
+/// @param code The axis (e.g. ABS_X)
+/// @param minimum Lowest value of the axis
+/// @param maximum Highest value of the axis
+/// @param resolution Units per mm, 0 if not applicable
+/// @return 0 on success, 1 if error(s)
+static int uinput_setup_abs(int fd, uint16_t code, int32_t minimum, uint32_t maximum, int32_t resolution) {
+    struct uinput_abs_setup abs;
+    memset(&abs, 0, sizeof(abs));
+    abs.code = code;
+    abs.absinfo.minimum = minimum;
+    abs.absinfo.maximum = maximum > 1 && maximum <= INT32_MAX ? (int32_t)maximum : 1;
+    abs.absinfo.resolution = resolution;
+    CHECK( ioctl(fd, UI_ABS_SETUP, &abs) );
+    return 0;
+}
+
+/// Enable the capabilities of a virtual device being set up
+/// @param fd uinput file descriptor of the device
+/// @param device Which of the virtual devices it is
+/// @return 0 on success, 1 if error(s)
+static int uinput_setup_capabilities(int fd, enum uinput_device device) {
+    switch (device) {
+        case UINPUT_DEVICE_MAIN:
+            for (int i = 0; i != NUM_KEYCODES; ++i) {
+                CHECK( ioctl(fd, UI_SET_KEYBIT, KEYCODES[i]) );
+            }
+            // Every key that can be named can be entered
+            for (int i = 0; i != KEY_HASH_SLOTS; ++i) {
+                if (KEY_HASH_TABLE[i].name) {
+                    CHECK( ioctl(fd, UI_SET_KEYBIT, KEY_HASH_TABLE[i].code) );
+                }
+            }
+            for (int i = 0; i != NUM_EVCODES; ++i) {
+                CHECK( ioctl(fd, UI_SET_EVBIT, EVCODES[i]) );
+            }
+            for (int i = 0; i != NUM_RELCODES; ++i) {
+                CHECK( ioctl(fd, UI_SET_RELBIT, RELCODES[i]) );
+            }
+            // Held keys are repeated by the kernel, rather than by a stream of presses
+            if (REPEAT_DELAY_MS) {
+                CHECK( ioctl(fd, UI_SET_EVBIT, EV_REP) );
+            }
+            return 0;
+
+        case UINPUT_DEVICE_TABLET:
+            // Buttons make desktops treat it as a pointer, mapping the axes' range onto the screen
+            CHECK( ioctl(fd, UI_SET_EVBIT, EV_KEY) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_LEFT) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE) );
+            CHECK( ioctl(fd, UI_SET_EVBIT, EV_ABS) );
+            return uinput_setup_abs(fd, ABS_X, 0, SCREEN_WIDTH - 1, SCREEN_RESOLUTION)
+                || uinput_setup_abs(fd, ABS_Y, 0, SCREEN_HEIGHT - 1, SCREEN_RESOLUTION);
+
+        case UINPUT_DEVICE_TOUCH:
+            // A direct touch device is mapped onto the screen, the single touch axes and finger
+            // count buttons are for readers that don't understand multitouch
+            CHECK( ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT) );
+            CHECK( ioctl(fd, UI_SET_EVBIT, EV_KEY) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_FINGER) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_DOUBLETAP) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_TRIPLETAP) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_QUADTAP) );
+            CHECK( ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_QUINTTAP) );
+            CHECK( ioctl(fd, UI_SET_EVBIT, EV_ABS) );
+            return uinput_setup_abs(fd, ABS_X, 0, SCREEN_WIDTH - 1, SCREEN_RESOLUTION)
+                || uinput_setup_abs(fd, ABS_Y, 0, SCREEN_HEIGHT - 1, SCREEN_RESOLUTION)
+                || uinput_setup_abs(fd, ABS_MT_SLOT, 0, UINPUT_TOUCH_SLOTS - 1, 0)
+                || uinput_setup_abs(fd, ABS_MT_TRACKING_ID, 0, UINT16_MAX, 0)
+                || uinput_setup_abs(fd, ABS_MT_POSITION_X, 0, SCREEN_WIDTH - 1, SCREEN_RESOLUTION)
+                || uinput_setup_abs(fd, ABS_MT_POSITION_Y, 0, SCREEN_HEIGHT - 1, SCREEN_RESOLUTION);
+
+        case UINPUT_DEVICE_GAMEPAD:
+            CHECK( ioctl(fd, UI_SET_EVBIT, EV_KEY) );
+            CHECK( ioctl(fd, UI_SET_EVBIT, EV_ABS) );
+            for (int i = 0; i != UINPUT_GAMEPAD_CONTROLS; ++i) {
+                const struct uinput_gamepad_control * control = &GAMEPAD_CONTROLS[i];
+                if (control->type == EV_KEY) {
+                    CHECK( ioctl(fd, UI_SET_KEYBIT, control->code) );
+                } else if (uinput_setup_abs(fd, control->code, control->minimum, (uint32_t)control->maximum, 0)) {
+                    return 1;
+                }
+            }
+            return 0;
+
+        default:
+            return 1;
+    }
+}
+
+/// Set the autorepeat delay and period of a created device
+/// @details The input core starts off with its own defaults, which EV_REP events written to the
+/// device replace
+/// @param fd uinput file descriptor of the device
+/// @return 0 on success, 1 if error(s)
+static int uinput_setup_repeat(int fd) {
+    struct input_event events[2];
+    memset(events, 0, sizeof(events));
+    events[0].type = EV_REP;
+    events[0].code = REP_DELAY;
+    events[0].value = REPEAT_DELAY_MS < INT32_MAX ? (int32_t)REPEAT_DELAY_MS : INT32_MAX;
+    events[1].type = EV_REP;
+    events[1].code = REP_PERIOD;
+    events[1].value = REPEAT_PERIOD_MS < INT32_MAX ? (int32_t)REPEAT_PERIOD_MS : INT32_MAX;
+
+    CHECK( write(fd, events, sizeof(events)) );
+    return 0;
+}
+
+/// Create one of the virtual devices and wait for it to come up
+/// @param device Which of the virtual devices to create
+/// @return uinput file descriptor of the device, -1 if error(s)
+static int uinput_create_device(enum uinput_device device) {
+    static const char * const names[UINPUT_NUM_DEVICES] = {
+        "ydotool virtual device",
+        "ydotool virtual tablet",
+        "ydotool virtual touchscreen",
+        "ydotool virtual gamepad",
+    };
+
+    // Open uinput driver device
+    int fd = open("/dev/uinput", O_WRONLY|O_NONBLOCK);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open /dev/uinput: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // uinput device setup, each device with its own product ID
+    struct uinput_setup usetup = {
+        {
+            BUS_USB,
+            0x1234,
+            (uint16_t)(0x5678 + device),
+            0
+        },
+        "",
+        0
+    };
+    strncpy(usetup.name, names[device], sizeof(usetup.name) - 1);
+
+    if (uinput_setup_capabilities(fd, device)
+            || ioctl(fd, UI_DEV_SETUP, &usetup) == -1
+            || ioctl(fd, UI_DEV_CREATE) == -1
+            || (device == UINPUT_DEVICE_MAIN && REPEAT_DELAY_MS && uinput_setup_repeat(fd))) {
+        fprintf(stderr, "Failed to create %s: %s\n", names[device], strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Wait for device to come up. Compositors leave gamepads alone, games open them when they start
+    if (device != UINPUT_DEVICE_GAMEPAD) {
+        uinput_wait_ready(fd);
+    }
+
+    return fd;
+}
+
+/// Get the file descriptor to write a device's frames to, creating the device on first use
+/// @param device Value of the frame's UINPUT_EV_DEVICE event
+/// @return File descriptor, -1 if error(s)
+static int uinput_device_fd(int32_t device) {
+    if (device == UINPUT_DEVICE_MAIN) {
+        return FD;
+    }
+    if (device < 0 || device >= UINPUT_NUM_DEVICES) {
+        fprintf(stderr, "Invalid virtual device %" PRId32 "\n", device);
+        return -1;
+    }
+    if (FD_DEVICE[device] == -1) {
+        FD_DEVICE[device] = uinput_create_device((enum uinput_device)device);
+    }
+    return FD_DEVICE[device];
+}
+
+/// Sleep until a given CLOCK_MONOTONIC time
+/// @param time_us Time to wake up at in microseconds
+static void uinput_sleep_until(uint64_t time_us) {
+    struct timespec ts = { (time_t)(time_us / 1000000), (long)(time_us % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+/// Wait until the timed events handed to the daemon are due
+/// @details The daemon holds them until their deadline, so events sent any earlier, by this
+/// process or the next one, would overtake them
+static void uinput_wait_scheduled() {
+    if (SCHEDULED_US) {
+        uinput_sleep_until(SCHEDULED_US);
+        SCHEDULED_US = 0;
+    }
+}
+
+// Initialise the input device
+int uinput_init() {
+    // Attempt to connect to ydotoold backend if running
+    if (!uinput_connect_socket()) {
+        printf("Using ydotoold backend\n");
+        return 0;
+    }
+
+    // Check write access to uinput driver device
+    if (access("/dev/uinput", W_OK)) {
+        fprintf(stderr, "Do not have access to write to /dev/uinput!\n"
+            "Try running as root\n");
+        return 1;
+    }
+
+    // Confirm availability of uinput kernel module
+    struct utsname uname_buffer;
+    CHECK( uname(&uname_buffer) );
+    char kernel_mod_dir[50] = "/lib/modules/";
+    strcat(kernel_mod_dir, uname_buffer.release);
+    struct stat stats;
+    stat(kernel_mod_dir, &stats);
+    if (!S_ISDIR(stats.st_mode)) {
+        fprintf(stderr, "Dir (%s) doesn't exist!\n"
+            "Have you recently updated your kernel version?\n"
+            "Restart your system to use new kernel modules\n", kernel_mod_dir);
+        return 1;
+    }
+
+    FD = uinput_create_device(UINPUT_DEVICE_MAIN);
+    if (FD == -1) {
+        return 1;
+    }
+
+    // Pacing falls back to fixed delays if the device node can't be read
+    uinput_pacer_open();
+
+    return 0;
+}
+
+// Delete the input device
+int uinput_destroy() {
+    if (FD != -1) {
+        uinput_wait_scheduled();
+        if (!BACKEND_DAEMON) {
+            ioctl(FD, UI_DEV_DESTROY);
+        }
+        close(FD);
+        FD = -1;
+        BACKEND_DAEMON = 0;
+    }
+    for (int device = UINPUT_DEVICE_MAIN + 1; device != UINPUT_NUM_DEVICES; ++device) {
+        if (FD_DEVICE[device] != -1) {
+            ioctl(FD_DEVICE[device], UI_DEV_DESTROY);
+            close(FD_DEVICE[device]);
+            FD_DEVICE[device] = -1;
+        }
+    }
+    if (FD_READBACK != -1) {
+        close(FD_READBACK);
+        FD_READBACK = -1;
+    }
+    if (RING) {
+        munmap(RING, ydotool_ring_bytes(RING->size));
+        RING = NULL;
+        close(FD_RING);
+        FD_RING = -1;
+    }
+    return 0;
+}
+
+int uinput_keychar_to_keycode(const char c, uint16_t * keycode, uint8_t * shifted) {
+    // Search normal keys
+    if (!uinput_binary_search_char(NORMAL_KEYS, NUM_NORMAL_KEYS, c, keycode)) {
+        return 0;
+    }
+    // Search shifted keys
+    if (!uinput_binary_search_char(SHIFTED_KEYS, NUM_SHIFTED_KEYS, c, keycode)) {
+        *shifted = 1;
+        return 0;
+    }
+
+    fprintf(stderr, "Failed to find key char %c!\n", c);
+    return 1;
+}
+
+// Key name through the perfect hash table
+int uinput_keyname_to_keycode(const char * name, size_t len, uint16_t * keycode) {
+    uint32_t seed = KEY_HASH_SEEDS[key_hash(0, name, len) & (KEY_HASH_BUCKETS - 1)];
+    const struct key_hash_entry * entry = &KEY_HASH_TABLE[key_hash(seed, name, len) & (KEY_HASH_SLOTS - 1)];
+    if (!entry->name || entry->len != len || strncasecmp(entry->name, name, len)) {
+        return 1;
+    }
+    *keycode = entry->code;
+    return 0;
+}
+
+/// Convert a character or key name, which needn't be NUL terminated, to its keycode
+/// @param key_string The character or key name
+/// @param len Length of key_string
+/// @param [out] keycode The integer keycode for the given key
+/// @param [out] shifted 1 if keycode represents a shifted key, 0 if normal
+/// @return 0 on success, 1 if error(s)
+static int uinput_keyname_to_keycode_shifted(const char * key_string, size_t len, uint16_t * keycode, uint8_t * shifted) {
+    *shifted = 0;
+
+    if (len == 1) {
+        return uinput_keychar_to_keycode(key_string[0], keycode, shifted);
+    }
+    if (!uinput_keyname_to_keycode(key_string, len, keycode)) {
+        return 0;
+    }
+
+    fprintf(stderr, "Failed to find key string %.*s!\n", (int)len, key_string);
+    return 1;
+}
+
+int uinput_keystring_to_keycode(const char * key_string, uint16_t * keycode, uint8_t * shifted) {
+    return uinput_keyname_to_keycode_shifted(key_string, strlen(key_string), keycode, shifted);
+}
+
+int uinput_enter_key(const char * key_string, int32_t value) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_enter_key(&batch, key_string, value) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Emulate typing the given character on the vitual device
+int uinput_enter_char(char c) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_enter_char(&batch, c) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+/// Write the whole of the given buffers to a file descriptor
+/// @param fd The file descriptor, the daemon's socket or a uinput device
+/// @param iov Array of buffers to be written, modified to track progress
+/// @param iovcnt Number of buffers
+/// @return 0 on success, 1 if error(s)
+static int uinput_writev_all(int fd, struct iovec * iov, int iovcnt) {
+    while (iovcnt) {
+        ssize_t rc = writev(fd, iov, iovcnt);
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        CHECK( rc );
+
+        // Skip over whatever has been written
+        size_t done = (size_t)rc;
+        while (iovcnt && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return 0;
+}
+
+/// Send events to the daemon
+/// @param events Array of events to be sent, in order
+/// @param count Number of events in the array
+/// @return 0 on success, 1 if error(s)
+static int uinput_send_events(const struct uinput_raw_data * events, size_t count) {
+    uinput_wait_scheduled();
+    if (RING) {
+        return uinput_ring_events(events, count);
+    }
+
+    // The legacy daemon takes the raw event data as is, all of it for its single device
+    if (BACKEND_DAEMON == 1) {
+        for (size_t i = 0; i != count; ++i) {
+            if (events[i].type == UINPUT_EV_DEVICE) {
+                fprintf(stderr, "ydotoold too old for the tablet, touchscreen and gamepad, update or stop it\n");
+                return 1;
+            }
+        }
+
+        struct iovec iov = { (void *)events, count * sizeof(*events) };
+        return uinput_writev_all(FD, &iov, 1);
+    }
+
+    while (count) {
+        size_t len = count < YDOTOOL_MSG_MAX_EVENTS ? count : YDOTOOL_MSG_MAX_EVENTS;
+        struct ydotool_msg_header header = { YDOTOOL_MSG_EVENTS, 0, (uint32_t)len };
+        struct iovec iov[2] = {
+            { &header, sizeof(header) },
+            { (void *)events, len * sizeof(*events) }
+        };
+
+        if (uinput_writev_all(FD, iov, 2)) {
+            return 1;
+        }
+
+        events += len;
+        count -= len;
+    }
+    return 0;
+}
+
+// Write a number of events with as few system calls as possible
+int uinput_emit_batch(const struct uinput_raw_data * events, size_t count) {
+    if (FD == -1) {
+        if (uinput_init()) {
+            return 1;
+        }
+    }
+
+    if (BACKEND_DAEMON) {
+        return uinput_send_events(events, count);
+    }
+
+    struct input_event buf[UINPUT_WRITE_SIZE];
+    int ret = 0;
+    int fd = FD;
+    while (count) {
+        // A frame for another device is written to it on its own
+        if (events->type == UINPUT_EV_DEVICE) {
+            fd = uinput_device_fd(events->value);
+            ++events;
+            --count;
+            if (fd == -1) {
+                // Drop the frame, but carry on with the rest
+                while (count && !(events->type == EV_SYN && events->code == SYN_REPORT)) {
+                    ++events;
+                    --count;
+                }
+                if (count) {
+                    ++events;
+                    --count;
+                }
+                fd = FD;
+                ret = 1;
+            }
+            continue;
+        }
+
+        size_t len = count < UINPUT_WRITE_SIZE ? count : UINPUT_WRITE_SIZE;
+
+        // Only split writes on frame boundaries where possible
+        size_t frames = 0;
+        size_t end = 0;
+        for (size_t i = 0; i != len; ++i) {
+            if (events[i].type == UINPUT_EV_DEVICE) {
+                len = i;
+                break;
+            }
+            if (events[i].type == EV_SYN && events[i].code == SYN_REPORT) {
+                ++frames;
+                end = i + 1;
+                if (fd != FD) {
+                    len = end;
+                    break;
+                }
+            }
+        }
+        if (end && count > len) {
+            len = end;
+        }
+
+        for (size_t i = 0; i != len; ++i) {
+            // Ignore timestamp values
+            buf[i].time.tv_sec = 0;
+            buf[i].time.tv_usec = 0;
+            buf[i].type = events[i].type;
+            buf[i].code = events[i].code;
+            buf[i].value = events[i].value;
+        }
+
+        struct iovec iov = { buf, len * sizeof(*buf) };
+        if (uinput_writev_all(fd, &iov, 1)) {
+            return 1;
+        }
+
+        // Allow processing time for the consumers before sending the next batch. Only the main
+        // device is read back, so the pacer only accounts for its frames
+        if (fd == FD) {
+            uinput_pacer_wait(frames);
+        } else if (frames) {
+            fd = FD;
+        }
+
+        events += len;
+        count -= len;
+    }
+
+    return ret;
+}
+
+/// Send a semantic command to the daemon
+/// @param kind One of enum ydotool_msg_kind
+/// @param arg Argument of the message
+/// @param head Fixed part of the payload, may be NULL
+/// @param head_len Length of head in bytes
+/// @param body Variable part of the payload, may be NULL
+/// @param body_len Length of body in bytes
+/// @return 0 on success, 1 if error(s)
+static int uinput_send_command(uint16_t kind, uint16_t arg, const void * head, size_t head_len, const void * body, size_t body_len) {
+    if (kind != YDOTOOL_MSG_TIMED_EVENTS) {
+        uinput_wait_scheduled();
+    }
+    struct ydotool_msg_header header = { kind, arg, (uint32_t)(head_len + body_len) };
+    struct iovec iov[3] = {
+        { &header, sizeof(header) },
+        { (void *)head, head_len },
+        { (void *)body, body_len }
+    };
+    return uinput_writev_all(FD, iov, 3);
+}
+
+/// Hand timed events over to the daemon straight away
+/// @param events The events, made up of whole frames
+/// @param count Number of events
+/// @param time_us CLOCK_MONOTONIC time in microseconds at which the events are due
+/// @return 0 on success, 1 if error(s)
+static int uinput_send_timed(const struct uinput_raw_data * events, size_t count, uint64_t time_us) {
+    if (time_us > SCHEDULED_US) {
+        SCHEDULED_US = time_us;
+    }
+
+    struct ydotool_msg_time when = { time_us };
+    while (count) {
+        size_t len = count < YDOTOOL_MSG_MAX_TIMED_EVENTS ? count : YDOTOOL_MSG_MAX_TIMED_EVENTS;
+
+        // Only split messages on frame boundaries where possible
+        size_t end = len;
+        while (count > len && end && events[end - 1].type != EV_SYN) {
+            --end;
+        }
+        if (end) {
+            len = end;
+        }
+
+        if (uinput_send_command(YDOTOOL_MSG_TIMED_EVENTS, 0, &when, sizeof(when), events, len * sizeof(*events))) {
+            return 1;
+        }
+        events += len;
+        count -= len;
+    }
+    return 0;
+}
+
+// Emit events once their time has come, timed by the daemon if possible
+int uinput_emit_at(const struct uinput_raw_data * events, size_t count, uint64_t time_us) {
+    if (FD == -1 && uinput_init()) {
+        return 1;
+    }
+
+    if (BACKEND_DAEMON < 2) {
+        uinput_sleep_until(time_us);
+        return uinput_emit_batch(events, count);
+    }
+
+    if (time_us > SCHEDULE_LOOKAHEAD_US) {
+        uinput_sleep_until(time_us - SCHEDULE_LOOKAHEAD_US);
+    }
+    return uinput_send_timed(events, count, time_us);
+}
+
+// Trigger an input event
+int uinput_emit(uint16_t type, uint16_t code, int32_t value) {
+    struct uinput_raw_data event = { type, code, value };
+    return uinput_emit_batch(&event, 1);
+}
+
+// Prepare an empty batch
+void uinput_batch_init(struct uinput_batch * batch) {
+    batch->len = 0;
+    batch->emit = uinput_emit_batch;
+    batch->time_us = 0;
+}
+
+/// Write out the first events held by a batch, at the batch's time if it has one
+/// @param batch The batch
+/// @param count Number of events to write
+/// @return 0 on success, 1 if error(s)
+static int uinput_batch_emit(struct uinput_batch * batch, size_t count) {
+    if (batch->time_us && batch->emit == uinput_emit_batch) {
+        return uinput_emit_at(batch->events, count, batch->time_us);
+    }
+    return batch->emit(batch->events, count);
+}
+
+// Write out all complete frames held by the batch
+int uinput_batch_flush(struct uinput_batch * batch) {
+    if (!batch->len) {
+        return 0;
+    }
+    int ret = uinput_batch_emit(batch, batch->len);
+    batch->len = 0;
+    return ret;
+}
+
+// Flush and move on to a new deadline
+int uinput_batch_at(struct uinput_batch * batch, uint64_t time_us) {
+    int ret = uinput_batch_flush(batch);
+    batch->time_us = time_us;
+    return ret;
+}
+
+// Append a single event, making room first if the batch is full
+int uinput_batch_add(struct uinput_batch * batch, uint16_t type, uint16_t code, int32_t value) {
+    if (batch->len == UINPUT_BATCH_SIZE) {
+        // Only write up to the last SYN_REPORT, so frames are never split across writes
+        size_t end = batch->len;
+        while (end && batch->events[end - 1].type != EV_SYN) {
+            --end;
+        }
+        // A single frame filling the whole batch has to be split
+        if (!end) {
+            end = batch->len;
+        }
+
+        if (uinput_batch_emit(batch, end)) {
+            batch->len = 0;
+            return 1;
+        }
+
+        // Move any partial frame to the start of the batch
+        memmove(batch->events, batch->events + end, (batch->len - end) * sizeof(batch->events[0]));
+        batch->len -= end;
+    }
+
+    struct uinput_raw_data * event = &batch->events[batch->len++];
+    event->type = type;
+    event->code = code;
+    event->value = value;
+    return 0;
+}
+
+// Terminate the current frame
+int uinput_batch_sync(struct uinput_batch * batch) {
+    return uinput_batch_add(batch, EV_SYN, SYN_REPORT, 0);
+}
+
+// Single key event and report
+int uinput_batch_key(struct uinput_batch * batch, uint16_t code, int32_t value) {
+    if (uinput_batch_add(batch, EV_KEY, code, value) || uinput_batch_sync(batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Quick key press
+int uinput_batch_keypress(struct uinput_batch * batch, uint16_t code) {
+    // Press followed by release
+    if (uinput_batch_key(batch, code, 1) || uinput_batch_key(batch, code, 0)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Shifted key press
+int uinput_batch_shifted_keypress(struct uinput_batch * batch, uint16_t code) {
+    // Shift press, keypress, shift release
+    if (uinput_batch_key(batch, KEY_LEFTSHIFT, 1)
+            || uinput_batch_keypress(batch, code)
+            || uinput_batch_key(batch, KEY_LEFTSHIFT, 0)
+            ) {
+        return 1;
+    }
+    return 0;
+}
+
+/// Append the key frame(s) for a character or key name, which needn't be NUL terminated
+/// @param batch The batch to append to
+/// @param key_string The character or key name
+/// @param len Length of key_string
+/// @param value 1 for press, 0 for release
+/// @return 0 on success, 1 if error(s)
+static int uinput_batch_enter_name(struct uinput_batch * batch, const char * key_string, size_t len, int32_t value) {
+    uint8_t shifted = 0;
+    uint16_t keycode = 0;
+
+    if (uinput_keyname_to_keycode_shifted(key_string, len, &keycode, &shifted)) {
+        return 1;
+    }
+    if (shifted && uinput_batch_key(batch, KEY_LEFTSHIFT, value)) {
+        return 1;
+    }
+    return uinput_batch_key(batch, keycode, value);
+}
+
+// Key event for the string representation of a key
+int uinput_batch_enter_key(struct uinput_batch * batch, const char * key_string, int32_t value) {
+    return uinput_batch_enter_name(batch, key_string, strlen(key_string), value);
+}
+
+// Typing the given character
+int uinput_batch_enter_char(struct uinput_batch * batch, char c) {
+    uint8_t shifted = 0;
+    uint16_t keycode = 0;
+
+    if (uinput_keychar_to_keycode(c, &keycode, &shifted)) {
+        return 1;
+    }
+    if (shifted) {
+        return uinput_batch_shifted_keypress(batch, keycode);
+    }
+    return uinput_batch_keypress(batch, keycode);
+}
+
+// Start typing with Shift released
+void uinput_typist_init(struct uinput_typist * typist, uint32_t flags) {
+    typist->flags = flags;
+    typist->shift = 0;
+}
+
+// Frames typing a checked text
+size_t uinput_typist_events(struct uinput_typist * typist, const char * text, size_t len, struct uinput_raw_data * events, size_t room, size_t * used) {
+    pthread_once(&CHAR_KEYS_ONCE, uinput_char_keys_build);
+
+    // Caps Lock swaps the case of letters, and only letters
+    uint16_t caps = typist->flags & UINPUT_TYPE_CAPS_LOCK ? CHAR_KEY_LETTER : 0;
+    int shift = typist->shift;
+    struct uinput_raw_data * event = events;
+    struct uinput_raw_data * end = events + room;
+
+    size_t i = 0;
+    while (i != len) {
+        if ((unsigned char)text[i] < 0x80) {
+            if (end - event < 6) {
+                break;
+            }
+
+            uint16_t key = CHAR_KEYS[(unsigned char)text[i]];
+            uint16_t code = key & CHAR_KEY_CODE;
+            int shifted = !(key & CHAR_KEY_SHIFT) != !(key & caps);
+
+            if (shifted != shift) {
+                shift = shifted;
+                *event++ = (struct uinput_raw_data){ EV_KEY, KEY_LEFTSHIFT, shift };
+                *event++ = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
+            }
+            *event++ = (struct uinput_raw_data){ EV_KEY, code, 1 };
+            *event++ = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
+            *event++ = (struct uinput_raw_data){ EV_KEY, code, 0 };
+            *event++ = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
+            ++i;
+            continue;
+        }
+
+        // Anything else is entered by its code point, which brings its own modifiers
+        uint32_t code_point;
+        int n = uinput_utf8_decode(text + i, len - i, &code_point);
+        if (n <= 0 || (size_t)(end - event) < 2 + UNICODE_START.len + 4 * uinput_unicode_digits(code_point) + UNICODE_END.len) {
+            break;
+        }
+        if (shift) {
+            shift = 0;
+            *event++ = (struct uinput_raw_data){ EV_KEY, KEY_LEFTSHIFT, 0 };
+            *event++ = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
+        }
+        event += uinput_unicode_frames(code_point, event);
+        i += (size_t)n;
+    }
+
+    typist->shift = shift;
+    *used = i;
+    return (size_t)(event - events);
+}
+
+// Type a checked text, keeping Shift as it is where possible
+int uinput_batch_type_text(struct uinput_batch * batch, struct uinput_typist * typist, const char * text, size_t len) {
+    // Translate straight into the batch, making room whenever the next character doesn't fit
+    while (len) {
+        size_t used;
+        batch->len += uinput_typist_events(typist, text, len, batch->events + batch->len, UINPUT_BATCH_SIZE - batch->len, &used);
+        if (used) {
+            text += used;
+            len -= used;
+        } else if (!batch->len) {
+            fprintf(stderr, "Failed to type a character cut short at the end of the text\n");
+            return 1;
+        } else if (uinput_batch_flush(batch)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Release Shift after typing
+int uinput_batch_type_end(struct uinput_batch * batch, struct uinput_typist * typist) {
+    if (!typist->shift) {
+        return 0;
+    }
+    typist->shift = 0;
+    return uinput_batch_key(batch, KEY_LEFTSHIFT, 0);
+}
+
+// Length of the first character of a checked text
+size_t uinput_text_char_len(const char * text, size_t len) {
+    uint32_t code_point;
+    int n = uinput_utf8_decode(text, len, &code_point);
+    return n > 0 ? (size_t)n : 1;
+}
+
+// Text up to any character cut short at its end
+size_t uinput_text_complete(const char * text, size_t len) {
+    // A character cut short starts at most three bytes from the end
+    for (size_t back = 1; back <= 3 && back <= len; ++back) {
+        unsigned char c = (unsigned char)text[len - back];
+        if ((c & 0xc0) != 0x80) {
+            uint32_t code_point;
+            return c >= 0x80 && !uinput_utf8_decode(text + len - back, back, &code_point) ? len - back : len;
+        }
+    }
+    return len;
+}
+
+// Code point entry sequences
+int uinput_set_unicode(const char * start, const char * end) {
+    pthread_once(&CHAR_KEYS_ONCE, uinput_char_keys_build);
+
+    pthread_mutex_lock(&UNICODE_LOCK);
+    for (size_t i = 0; i != sizeof(UNICODE_CACHE) / sizeof(UNICODE_CACHE[0]); ++i) {
+        UNICODE_CACHE[i].code_point = 0;
+    }
+    pthread_mutex_unlock(&UNICODE_LOCK);
+
+    UNICODE_CUSTOM = !start || strcasecmp(start, UINPUT_UNICODE_START_DEFAULT) || strcasecmp(end, UINPUT_UNICODE_END_DEFAULT);
+    uinput_chord_free(&UNICODE_START);
+    uinput_chord_free(&UNICODE_END);
+    UNICODE_ENABLED = start && !uinput_chord_compile(&UNICODE_START, start) && !uinput_chord_compile(&UNICODE_END, end);
+    if (UNICODE_ENABLED && (UNICODE_START.len > UNICODE_CHORD_EVENTS || UNICODE_END.len > UNICODE_CHORD_EVENTS)) {
+        fprintf(stderr, "Code point entry sequences %s and %s too long\n", start, end);
+        UNICODE_ENABLED = 0;
+    }
+    return start && !UNICODE_ENABLED;
+}
+
+/// Report a character that can't be typed
+/// @param text The text
+/// @param len Length of the text
+/// @param i Offset of the character in the text
+/// @param offset Offset of the text in the whole input
+static void uinput_report_char(const char * text, size_t len, size_t i, uint64_t offset) {
+    unsigned char c = (unsigned char)text[i];
+    uint32_t code_point;
+    if (c >= ' ' && c < 0x7f) {
+        fprintf(stderr, "Failed to find key char %c at offset %" PRIu64 "!\n", c, offset + i);
+    } else if (c >= 0x80 && uinput_utf8_decode(text + i, len - i, &code_point) > 0) {
+        fprintf(stderr, "Failed to find key char U+%04" PRIX32 " at offset %" PRIu64 "!\n", code_point, offset + i);
+    } else if (c >= 0x80) {
+        fprintf(stderr, "Invalid UTF-8 at offset %" PRIu64 "!\n", offset + i);
+    } else {
+        fprintf(stderr, "Failed to find key char 0x%02x at offset %" PRIu64 "!\n", c, offset + i);
+    }
+}
+
+// Check that a text can be typed
+int uinput_check_text(const char * text, size_t len) {
+    return uinput_check_text_at(text, len, 0);
+}
+
+// Check that a piece of a longer text can be typed
+int uinput_check_text_at(const char * text, size_t len, uint64_t offset) {
+    pthread_once(&CHAR_KEYS_ONCE, uinput_char_keys_build);
+
+    size_t i = 0;
+    int ret = 0;
+    while (i < len) {
+        size_t block_end = len;
+#ifdef __SSE2__
+        // Skip blocks of printable ASCII, tabs and newlines without looking them up, then look
+        // at the rest of the first block with anything else in it one character at a time.
+        // Bytes from 0x80 up are negative as signed chars, so fall below the printable range
+        if (CHAR_KEYS_ASCII) {
+            const __m128i below = _mm_set1_epi8(' ' - 1);
+            const __m128i above = _mm_set1_epi8(0x7f);
+            const __m128i tab = _mm_set1_epi8('\t');
+            const __m128i newline = _mm_set1_epi8('\n');
+
+            for (; i + 16 <= len; i += 16) {
+                __m128i block = _mm_loadu_si128((const __m128i *)(const void *)(text + i));
+                __m128i typable = _mm_or_si128(
+                    _mm_and_si128(_mm_cmpgt_epi8(block, below), _mm_cmplt_epi8(block, above)),
+                    _mm_or_si128(_mm_cmpeq_epi8(block, tab), _mm_cmpeq_epi8(block, newline)));
+                if (_mm_movemask_epi8(typable) != 0xffff) {
+                    break;
+                }
+            }
+            block_end = i + 16 < len ? i + 16 : len;
+        }
+#endif
+
+        while (i < block_end) {
+            unsigned char c = (unsigned char)text[i];
+            if (c < 0x80) {
+                if (!CHAR_KEYS[c]) {
+                    uinput_report_char(text, len, i, offset);
+                    ret = 1;
+                }
+                ++i;
+                continue;
+            }
+
+            uint32_t code_point;
+            int n = uinput_utf8_decode(text + i, len - i, &code_point);
+            if (n <= 0 || !UNICODE_ENABLED) {
+                uinput_report_char(text, len, i, offset);
+                ret = 1;
+            }
+            i += n > 0 ? (size_t)n : 1;
+        }
+    }
+    return ret;
+}
+
+// Type a text with as few Shift presses as possible
+int uinput_batch_type(struct uinput_batch * batch, const char * text, size_t len, uint32_t flags) {
+    if (uinput_check_text(text, len)) {
+        return 1;
+    }
+
+    struct uinput_typist typist;
+    uinput_typist_init(&typist, flags);
+    if (uinput_batch_type_text(batch, &typist, text, len)) {
+        return 1;
+    }
+    return uinput_batch_type_end(batch, &typist);
+}
+
+// Press or release all keys of a sequence
+int uinput_batch_sequence(struct uinput_batch * batch, const char * sequence, int32_t value) {
+    const char * ptr = sequence;
+    while (*ptr) {
+        size_t len = strcspn(ptr, "+");
+        if (len && uinput_batch_enter_name(batch, ptr, len, value)) {
+            return 1;
+        }
+        ptr += len;
+        if (*ptr) {
+            ++ptr;
+        }
+    }
+    return 0;
+}
+
+/// Key sequence being compiled, collecting the frames written out by its batch
+static struct uinput_chord * CHORD_COMPILED = NULL;
+
+/// Guard CHORD_COMPILED
+static pthread_mutex_t CHORD_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/// Batch output of a key sequence being compiled, appending the events to CHORD_COMPILED
+/// @param events The events
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+static int uinput_chord_append(const struct uinput_raw_data * events, size_t count) {
+    struct uinput_chord * chord = CHORD_COMPILED;
+    struct uinput_raw_data * tmp = realloc(chord->events, (chord->len + count) * sizeof(*events));
+    if (!tmp) {
+        fprintf(stderr, "Failed to allocate key sequence\n");
+        return 1;
+    }
+    chord->events = tmp;
+    memcpy(chord->events + chord->len, events, count * sizeof(*events));
+    chord->len += count;
+    return 0;
+}
+
+// Parse a key sequence once
+int uinput_chord_compile(struct uinput_chord * chord, const char * sequence) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    batch.emit = uinput_chord_append;
+    chord->press = 0;
+    chord->len = 0;
+
+    // Room for one event up front, so that even an empty sequence has an allocation
+    chord->events = malloc(sizeof(*chord->events));
+    if (!chord->events) {
+        fprintf(stderr, "Failed to allocate key sequence\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&CHORD_LOCK);
+    CHORD_COMPILED = chord;
+    int ret = uinput_batch_sequence(&batch, sequence, 1) || uinput_batch_flush(&batch);
+    chord->press = chord->len;
+    ret = ret || uinput_batch_sequence(&batch, sequence, 0) || uinput_batch_flush(&batch);
+    CHORD_COMPILED = NULL;
+    pthread_mutex_unlock(&CHORD_LOCK);
+
+    if (ret) {
+        uinput_chord_free(chord);
+    }
+    return ret;
+}
+
+// Free a compiled key sequence
+void uinput_chord_free(struct uinput_chord * chord) {
+    free(chord->events);
+    chord->press = 0;
+    chord->len = 0;
+    chord->events = NULL;
+}
+
+// Append events as they are
+int uinput_batch_events(struct uinput_batch * batch, const struct uinput_raw_data * events, size_t count) {
+    while (count) {
+        // A full batch makes room the usual way, writing out its complete frames
+        if (batch->len == UINPUT_BATCH_SIZE) {
+            if (uinput_batch_add(batch, events->type, events->code, events->value)) {
+                return 1;
+            }
+            ++events;
+            --count;
+            continue;
+        }
+
+        size_t room = UINPUT_BATCH_SIZE - batch->len;
+        size_t len = count < room ? count : room;
+        memcpy(batch->events + batch->len, events, len * sizeof(*events));
+        batch->len += len;
+        events += len;
+        count -= len;
+    }
+    return 0;
+}
+
+// Press all keys of a sequence, then release them all
+int uinput_batch_enter_keys(struct uinput_batch * batch, const char * sequence) {
+    if (uinput_batch_sequence(batch, sequence, 1) || uinput_batch_sequence(batch, sequence, 0)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Mouse button number to keycode
+int uinput_button_to_keycode(uint16_t button, uint16_t * keycode) {
+    switch (button) {
+        case 1:
+            *keycode = BTN_LEFT;
+            return 0;
+        case 2:
+            *keycode = BTN_RIGHT;
+            return 0;
+        case 3:
+            *keycode = BTN_MIDDLE;
+            return 0;
+        default:
+            fprintf(stderr, "Invalid button %" PRIu16 "!\n", button);
+            return 1;
+    }
+}
+
+/// Bitmap of the keycodes enabled on the device, filled on first use
+static uint8_t SUPPORTED_KEYS[KEY_MAX / 8 + 1];
+
+/// Non-zero once SUPPORTED_KEYS has been filled
+static int SUPPORTED_KEYS_READY = 0;
+
+// Event filter matching the device's capabilities
+int uinput_is_supported_event(uint16_t type, uint16_t code) {
+    if (!SUPPORTED_KEYS_READY) {
+        for (int i = 0; i != NUM_KEYCODES; ++i) {
+            SUPPORTED_KEYS[KEYCODES[i] / 8] |= (uint8_t)(1 << (KEYCODES[i] % 8));
+        }
+        for (int i = 0; i != KEY_HASH_SLOTS; ++i) {
+            if (KEY_HASH_TABLE[i].name) {
+                SUPPORTED_KEYS[KEY_HASH_TABLE[i].code / 8] |= (uint8_t)(1 << (KEY_HASH_TABLE[i].code % 8));
+            }
+        }
+        SUPPORTED_KEYS_READY = 1;
+    }
+
+    switch (type) {
+        case EV_SYN:
+            return code == SYN_REPORT;
+        case EV_KEY:
+            return code <= KEY_MAX && (SUPPORTED_KEYS[code / 8] >> (code % 8)) & 1;
+        case EV_REL:
+            for (int i = 0; i != NUM_RELCODES; ++i) {
+                if (RELCODES[i] == code) {
+                    return 1;
+                }
+            }
+            return 0;
+        default:
+            for (int i = 0; i != NUM_EVCODES; ++i) {
+                if (EVCODES[i] == type) {
+                    return 1;
+                }
+            }
+            return 0;
+    }
+}
+
+// Absolute cursor movement
+int uinput_batch_move_mouse(struct uinput_batch * batch, int32_t x, int32_t y) {
+    if (uinput_batch_add(batch, UINPUT_EV_DEVICE, 0, UINPUT_DEVICE_TABLET)
+            || uinput_batch_add(batch, EV_ABS, ABS_X, x)
+            || uinput_batch_add(batch, EV_ABS, ABS_Y, y)
+            || uinput_batch_sync(batch)
+            ) {
+        return 1;
+    }
+    return 0;
+}
+
+// Relative cursor movement
+int uinput_batch_relative_move_mouse(struct uinput_batch * batch, int32_t x, int32_t y) {
+    if (x && uinput_batch_add(batch, EV_REL, REL_X, x)) {
+        return 1;
+    }
+    if (y && uinput_batch_add(batch, EV_REL, REL_Y, y)) {
+        return 1;
+    }
+    return uinput_batch_sync(batch);
+}
+
+// Frames of a scroll
+int uinput_batch_scroll(struct uinput_batch * batch, int horizontal, int32_t amount, uint32_t duration_ms, uint32_t rate_hz, uint64_t start_us) {
+    if (duration_ms && !rate_hz) {
+        fprintf(stderr, "Scroll rate must be positive\n");
+        return 1;
+    }
+
+    uint16_t wheel = horizontal ? REL_HWHEEL : REL_WHEEL;
+    uint16_t wheel_hi_res = horizontal ? REL_HWHEEL_HI_RES : REL_WHEEL_HI_RES;
+    uint64_t duration_us = (uint64_t)duration_ms * 1000;
+    uint64_t steps = (uint64_t)duration_ms * rate_hz / 1000;
+    if (!steps) {
+        steps = 1;
+    }
+
+    // Distances are taken between rounded totals, so the last step lands exactly on the amount
+    int64_t done = 0;
+    for (uint64_t step = 1; step <= steps; ++step) {
+        int64_t total = (int64_t)amount * (int64_t)step / (int64_t)steps;
+        if (total == done) {
+            continue;
+        }
+        int32_t notches = (int32_t)(total / UINPUT_SCROLL_NOTCH - done / UINPUT_SCROLL_NOTCH);
+        if (uinput_batch_at(batch, start_us + duration_us * step / steps)
+                || uinput_batch_add(batch, EV_REL, wheel_hi_res, (int32_t)(total - done))
+                || (notches && uinput_batch_add(batch, EV_REL, wheel, notches))
+                || uinput_batch_sync(batch)) {
+            return 1;
+        }
+        done = total;
+    }
+    return 0;
+}
+
+// Number of steps of a motion
+uint32_t uinput_motion_steps(const struct uinput_motion * motion) {
+    uint64_t steps = (uint64_t)motion->duration_ms * motion->rate_hz / 1000;
+    if (!steps) {
+        return 1;
+    }
+    return steps < UINT32_MAX ? (uint32_t)steps : UINT32_MAX;
+}
+
+/// Round a coordinate to the nearest integer within range
+/// @param value The coordinate
+/// @return The rounded coordinate
+static int32_t uinput_motion_round(double value) {
+    if (value >= INT32_MAX) {
+        return INT32_MAX;
+    }
+    if (value <= INT32_MIN) {
+        return INT32_MIN;
+    }
+    return (int32_t)(value < 0 ? value - 0.5 : value + 0.5);
+}
+
+// Pointer position at a step of a motion
+void uinput_motion_point(const struct uinput_motion * motion, uint32_t step, int32_t * x, int32_t * y) {
+    int relative = motion->flags & UINPUT_MOTION_RELATIVE;
+    double x0 = relative ? 0 : motion->from_x;
+    double y0 = relative ? 0 : motion->from_y;
+    double t = (double)step / uinput_motion_steps(motion);
+    double u = 1 - t;
+
+    if (motion->flags & UINPUT_MOTION_BEZIER) {
+        double a = u * u * u;
+        double b = 3 * u * u * t;
+        double c = 3 * u * t * t;
+        double d = t * t * t;
+        *x = uinput_motion_round(a * x0 + b * motion->c1_x + c * motion->c2_x + d * motion->to_x);
+        *y = uinput_motion_round(a * y0 + b * motion->c1_y + c * motion->c2_y + d * motion->to_y);
+    } else {
+        *x = uinput_motion_round(u * x0 + t * motion->to_x);
+        *y = uinput_motion_round(u * y0 + t * motion->to_y);
+    }
+}
+
+// Frame moving the pointer to a step of a motion
+int uinput_batch_motion_step(struct uinput_batch * batch, const struct uinput_motion * motion, uint32_t step, int32_t * x, int32_t * y) {
+    int relative = motion->flags & UINPUT_MOTION_RELATIVE;
+    int32_t next_x;
+    int32_t next_y;
+    uinput_motion_point(motion, step, &next_x, &next_y);
+    if ((step || relative) && next_x == *x && next_y == *y) {
+        return 0;
+    }
+
+    // Relative steps are taken between rounded positions, so rounding errors don't add up
+    int32_t dx = (int32_t)((int64_t)next_x - *x);
+    int32_t dy = (int32_t)((int64_t)next_y - *y);
+    *x = next_x;
+    *y = next_y;
+    if (relative) {
+        return uinput_batch_relative_move_mouse(batch, dx, dy);
+    }
+    return uinput_batch_move_mouse(batch, next_x, next_y);
+}
+
+// Single key event and report
+int uinput_send_key(uint16_t code, int32_t value) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_key(&batch, code, value) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Emulate a quick key press
+int uinput_send_keypress(uint16_t code) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_keypress(&batch, code) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Emulate a shifted key press
+int uinput_send_shifted_keypress(uint16_t code) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_shifted_keypress(&batch, code) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Move the cursor to a given (x,y) position
+int uinput_move_mouse(int32_t x, int32_t y) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_move_mouse(&batch, x, y) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+// Move the cursor a given (x,y) relative to the current position
+int uinput_relative_move_mouse(int32_t x, int32_t y) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_relative_move_mouse(&batch, x, y) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+    return 0;
+}
+
+/// Check whether semantic commands can be passed to the daemon rather than expanded here
+/// @return Non-zero if the daemon takes semantic commands
+static int uinput_daemon_commands() {
+    if (FD == -1 && uinput_init()) {
+        return 0;
+    }
+    return BACKEND_DAEMON >= 2;
+}
+
+/// Connect to the daemon for commands that only it can carry out, never creating a local device
+/// @return Non-zero if connected to a daemon that takes semantic commands
+static int uinput_daemon_only() {
+    if (FD == -1) {
+        if (uinput_connect_socket()) {
+            return 0;
+        }
+        printf("Using ydotoold backend\n");
+    }
+    return BACKEND_DAEMON >= 2;
+}
+
+// Type text, expanded by the daemon if possible
+int uinput_type_text(const char * text, size_t len, uint32_t key_delay_us, uint32_t flags) {
+    // Make sure the whole text can be typed before typing any of it
+    if (uinput_check_text(text, len)) {
+        return 1;
+    }
+
+    // The daemon types with Caps Lock off, and enters code points the default way
+    if (!key_delay_us && (flags || UNICODE_CUSTOM || !uinput_daemon_commands())) {
+        struct uinput_batch batch;
+        uinput_batch_init(&batch);
+        if (uinput_batch_type(&batch, text, len, flags)) {
+            uinput_batch_flush(&batch);
+            return 1;
+        }
+        return uinput_batch_flush(&batch);
+    }
+
+    if (key_delay_us) {
+        struct uinput_batch batch;
+        uinput_batch_init(&batch);
+        struct uinput_typist typist;
+        uinput_typist_init(&typist, flags);
+        uint64_t time_us = uinput_now_us();
+
+        for (size_t i = 0, n; i != len; i += n) {
+            n = uinput_text_char_len(text + i, len - i);
+            uinput_batch_at(&batch, time_us);
+            time_us += key_delay_us;
+            if (uinput_batch_type_text(&batch, &typist, text + i, n)) {
+                uinput_batch_type_end(&batch, &typist);
+                uinput_batch_flush(&batch);
+                return 1;
+            }
+        }
+        if (uinput_batch_type_end(&batch, &typist)) {
+            uinput_batch_flush(&batch);
+            return 1;
+        }
+        return uinput_batch_flush(&batch);
+    }
+
+    while (len) {
+        // Each message holds whole characters, as the daemon checks them one message at a time
+        size_t chunk = len < YDOTOOL_MSG_MAX_PAYLOAD ? len : uinput_text_complete(text, YDOTOOL_MSG_MAX_PAYLOAD);
+        if (uinput_send_command(YDOTOOL_MSG_TYPE, 0, NULL, 0, text, chunk)) {
+            return 1;
+        }
+        text += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/// Free compiled key sequences and the array holding them
+/// @param chords The compiled sequences
+/// @param count Number of sequences
+static void uinput_chords_free(struct uinput_chord * chords, int count) {
+    for (int i = 0; i != count; ++i) {
+        uinput_chord_free(&chords[i]);
+    }
+    free(chords);
+}
+
+/// Append a held chord to a batch: its press at the batch's time, its release at a later deadline
+/// @details ydotoold gets the release together with the press when it is due within the daemon's
+/// horizon, so that the chord is released even if this process goes away whilst it is held
+/// @param batch The batch, emitting at its time
+/// @param chord The chord
+/// @param release_us CLOCK_MONOTONIC time in microseconds at which to release the chord
+/// @return 0 on success, 1 if error(s)
+static int uinput_batch_hold(struct uinput_batch * batch, const struct uinput_chord * chord, uint64_t release_us) {
+    if (uinput_batch_events(batch, chord->events, chord->press) || uinput_batch_flush(batch)) {
+        return 1;
+    }
+
+    const struct uinput_raw_data * release = chord->events + chord->press;
+    size_t count = chord->len - chord->press;
+    if (batch->emit == uinput_emit_batch && BACKEND_DAEMON >= 2 && release_us <= uinput_now_us() + YDOTOOL_TIMED_HORIZON_US) {
+        return uinput_send_timed(release, count, release_us);
+    }
+    return uinput_batch_at(batch, release_us) || uinput_batch_events(batch, release, count);
+}
+
+// Enter key sequences, expanded by the daemon if possible
+int uinput_key(int count, char * const * sequences, uint64_t repeats, uint32_t key_delay_us, uint32_t repeat_delay_us, uint32_t hold_us) {
+    // Every sequence is parsed up front, which also checks every key name before emitting anything
+    struct uinput_chord * chords = malloc((size_t)count * sizeof(*chords));
+    if (count && !chords) {
+        fprintf(stderr, "Failed to allocate %d key sequences\n", count);
+        return 1;
+    }
+    for (int i = 0; i != count; ++i) {
+        if (uinput_chord_compile(&chords[i], sequences[i])) {
+            uinput_chords_free(chords, i);
+            return 1;
+        }
+    }
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    // Delays are kept to absolute deadlines, so they don't add up to drift over many repeats
+    if (key_delay_us || repeat_delay_us || hold_us || !uinput_daemon_commands()) {
+        int timed = key_delay_us || repeat_delay_us || hold_us;
+        uint64_t time_us = uinput_now_us();
+        while (repeats--) {
+            for (int i = 0; i != count; ++i) {
+                if (timed) {
+                    uinput_batch_at(&batch, time_us);
+                }
+                // A held sequence is a single press and release, the kernel repeats in between
+                const struct uinput_chord * chord = &chords[i];
+                int failed = hold_us
+                    ? uinput_batch_hold(&batch, chord, time_us + hold_us)
+                    : uinput_batch_events(&batch, chord->events, chord->len);
+                if (failed) {
+                    uinput_batch_flush(&batch);
+                    uinput_chords_free(chords, count);
+                    return 1;
+                }
+                time_us += hold_us + key_delay_us;
+            }
+            time_us += repeat_delay_us;
+        }
+        uinput_chords_free(chords, count);
+        return uinput_batch_flush(&batch);
+    }
+    uinput_chords_free(chords, count);
+
+    // Sequences are passed NUL terminated, back to back
+    char body[YDOTOOL_MSG_MAX_PAYLOAD - sizeof(struct ydotool_msg_key)];
+    size_t len = 0;
+    for (int i = 0; i != count; ++i) {
+        size_t size = strlen(sequences[i]) + 1;
+        if (len + size > sizeof(body)) {
+            fprintf(stderr, "Key sequences too long\n");
+            return 1;
+        }
+        memcpy(body + len, sequences[i], size);
+        len += size;
+    }
+
+    while (repeats) {
+        struct ydotool_msg_key key = { repeats < UINT32_MAX ? (uint32_t)repeats : UINT32_MAX };
+        if (uinput_send_command(YDOTOOL_MSG_KEY, 0, &key, sizeof(key), body, len)) {
+            return 1;
+        }
+        repeats -= key.repeats;
+    }
+    return 0;
+}
+
+// Click a mouse button, expanded by the daemon if possible
+int uinput_click(uint16_t button) {
+    uint16_t keycode;
+    if (uinput_button_to_keycode(button, &keycode)) {
+        return 1;
+    }
+
+    if (uinput_daemon_commands()) {
+        return uinput_send_command(YDOTOOL_MSG_CLICK, button, NULL, 0, NULL, 0);
+    }
+    return uinput_send_keypress(keycode);
+}
+
+// Move the pointer smoothly, expanded by the daemon if possible
+int uinput_motion(const struct uinput_motion * motion) {
+    if (!motion->rate_hz) {
+        fprintf(stderr, "Motion rate must be positive\n");
+        return 1;
+    }
+    // The daemon takes motion ending within its horizon, longer motion goes to it as timed events
+    if ((uint64_t)motion->duration_ms * 1000 <= YDOTOOL_TIMED_HORIZON_US && uinput_daemon_commands()) {
+        return uinput_send_command(YDOTOOL_MSG_MOTION, 0, motion, sizeof(*motion), NULL, 0);
+    }
+
+    // A fresh device hasn't put the pointer anywhere yet, so there is nowhere to carry on from
+    if (!(motion->flags & (UINPUT_MOTION_FROM | UINPUT_MOTION_RELATIVE))) {
+        fprintf(stderr, "Smooth absolute motion without ydotoold needs a start position\n");
+        return 1;
+    }
+
+    // Each step is due at its own absolute deadline, the last one exactly at the end
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    uint32_t steps = uinput_motion_steps(motion);
+    uint64_t start_us = uinput_now_us();
+    struct uinput_motion local = *motion;
+    if (local.flags & UINPUT_MOTION_RELATIVE) {
+        local.from_x = 0;
+        local.from_y = 0;
+    }
+    int32_t x = local.from_x;
+    int32_t y = local.from_y;
+    for (uint64_t step = 0; step <= steps; ++step) {
+        uinput_batch_at(&batch, start_us + (uint64_t)local.duration_ms * 1000 * step / steps);
+        if (uinput_batch_motion_step(&batch, &local, (uint32_t)step, &x, &y)) {
+            uinput_batch_flush(&batch);
+            return 1;
+        }
+    }
+    return uinput_batch_flush(&batch);
+}
+
+// Scroll the wheel, paced by the daemon if possible
+int uinput_scroll(int horizontal, int32_t amount, uint32_t duration_ms, uint32_t rate_hz) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (uinput_batch_scroll(&batch, horizontal, amount, duration_ms, rate_hz, uinput_now_us())) {
+        uinput_batch_flush(&batch);
+        return 1;
+    }
+    return uinput_batch_flush(&batch);
+}
+
+// Store a macro in the daemon
+int uinput_macro_define(const char * name, const struct uinput_raw_data * events, size_t count, uint32_t * id) {
+    size_t name_size = strlen(name) + 1;
+    if (name_size == 1 || name_size > YDOTOOL_MACRO_NAME_LEN) {
+        fprintf(stderr, "Invalid macro name %s\n", name);
+        return 1;
+    }
+    if (!uinput_daemon_only()) {
+        fprintf(stderr, "Macros need ydotoold to be running\n");
+        return 1;
+    }
+
+    // Long macros are sent in pieces, each appended to the last
+    size_t max = (YDOTOOL_MSG_MAX_PAYLOAD - name_size) / sizeof(*events);
+    uint16_t arg = 0;
+    do {
+        size_t len = count < max ? count : max;
+        if (uinput_send_command(YDOTOOL_MSG_MACRO_DEFINE, arg, name, name_size, events, len * sizeof(*events))) {
+            return 1;
+        }
+
+        struct ydotool_msg_header answer;
+        if (recv(FD, &answer, sizeof(answer), MSG_WAITALL) != sizeof(answer) || answer.kind != YDOTOOL_MSG_MACRO_ID) {
+            fprintf(stderr, "Failed to receive answer from daemon\n");
+            return 1;
+        }
+        if (answer.count == YDOTOOL_MACRO_NONE) {
+            fprintf(stderr, "Daemon refused macro %s\n", name);
+            return 1;
+        }
+        *id = answer.count;
+
+        events += len;
+        count -= len;
+        arg = YDOTOOL_MACRO_APPEND;
+    } while (count);
+
+    return 0;
+}
+
+// Forget a macro stored in the daemon
+int uinput_macro_undefine(const char * name) {
+    if (!uinput_daemon_only()) {
+        fprintf(stderr, "Macros need ydotoold to be running\n");
+        return 1;
+    }
+    if (uinput_send_command(YDOTOOL_MSG_MACRO_UNDEFINE, 0, name, strlen(name) + 1, NULL, 0)) {
+        return 1;
+    }
+
+    struct ydotool_msg_header answer;
+    if (recv(FD, &answer, sizeof(answer), MSG_WAITALL) != sizeof(answer) || answer.kind != YDOTOOL_MSG_MACRO_ID) {
+        fprintf(stderr, "Failed to receive answer from daemon\n");
+        return 1;
+    }
+    if (answer.count == YDOTOOL_MACRO_NONE) {
+        fprintf(stderr, "No macro %s in daemon\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+// Run a macro stored in the daemon
+int uinput_macro_run(uint32_t id, const char * name, uint32_t repeats) {
+    if (!uinput_daemon_only()) {
+        fprintf(stderr, "Macros need ydotoold to be running\n");
+        return 1;
+    }
+
+    struct ydotool_msg_macro_run run = { id, repeats };
+    size_t name_size = id == YDOTOOL_MACRO_NONE ? strlen(name) + 1 : 0;
+    return uinput_send_command(YDOTOOL_MSG_MACRO_RUN, 0, &run, sizeof(run), name, name_size);
 }
@@ -18,6 +18,8 @@
 #define __UINPUT_H__
 
 // System includes
+#include <stddef.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <linux/uinput.h>
 
@@ -29,6 +31,41 @@
 #define NUM_MODIFIER_KEYS 15
 /// Number of function keys
 #define NUM_FUNCTION_KEYS 31
+/// Maximum number of events held by a batch
+#define UINPUT_BATCH_SIZE 1024
+/// Maximum length of a key name (e.g. "SCROLLLOCK"), including the NUL terminator
+#define UINPUT_MAX_KEY_LEN 32
+/// Default width of the screen spanned by the absolute pointer device's X axis
+#define UINPUT_SCREEN_WIDTH_DEFAULT 1920
+/// Default height of the screen spanned by the absolute pointer device's Y axis
+#define UINPUT_SCREEN_HEIGHT_DEFAULT 1080
+/// Number of multitouch slots (fingers touching at once) of the touch device
+#define UINPUT_TOUCH_SLOTS 10
+/// Default time a key is held before the kernel starts repeating it, in milliseconds
+#define UINPUT_REPEAT_DELAY_DEFAULT 250
+/// Default time between the kernel's repeats of a held key, in milliseconds
+#define UINPUT_REPEAT_PERIOD_DEFAULT 33
+/// Number of controls (axes and buttons) of the gamepad device
+#define UINPUT_GAMEPAD_CONTROLS 21
+
+/// Pseudo event type starting a frame that is emitted by another virtual device than the main
+/// one, its value being the enum uinput_device. It is never written to a device. The type is unused
+/// by the kernel but within EV_MAX, so it fits wherever event types are stored
+#define UINPUT_EV_DEVICE 0x1e
+
+/// @brief Virtual devices events can be emitted by
+enum uinput_device {
+    /// Keyboard and relative mouse, emitting all frames without a UINPUT_EV_DEVICE event
+    UINPUT_DEVICE_MAIN = 0,
+    /// Absolute pointer, like a virtual machine's USB tablet, whose axes span the screen in pixels
+    UINPUT_DEVICE_TABLET = 1,
+    /// Multitouch screen using the slot (type B) protocol, whose axes span the screen in pixels
+    UINPUT_DEVICE_TOUCH = 2,
+    /// Gamepad with two sticks, two analog triggers, a d-pad and buttons (see GAMEPAD_CONTROLS)
+    UINPUT_DEVICE_GAMEPAD = 3,
+    /// Number of virtual devices
+    UINPUT_NUM_DEVICES
+};
 
 /// @brief uinput event information
 struct uinput_raw_data {
@@ -58,12 +95,127 @@ struct key_string {
     uint16_t code;
 };
 
+/// @brief Slot of the generated key name table (keyhash.h, see keygen.c)
+struct key_hash_entry {
+    /// Name of the key in capitals, NULL for an empty slot
+    const char * name;
+    /// Length of the name
+    uint16_t len;
+    /// The Linux uinput keycode representing the associated key
+    uint16_t code;
+};
+
+/// @brief Axis or button of the gamepad device
+struct uinput_gamepad_control {
+    /// Name of the control, the kernel's name for it without the ABS_ or BTN_ prefix, in lower case
+    char name[8];
+    /// EV_ABS for an axis, EV_KEY for a button
+    uint16_t type;
+    /// The axis or button (e.g. ABS_X or BTN_SOUTH)
+    uint16_t code;
+    /// Lowest value of the control
+    int32_t minimum;
+    /// Highest value of the control
+    int32_t maximum;
+};
+
+/// @brief Collection of events to be written to the device together
+/// @details Events are appended with the uinput_batch_* functions and written out with
+/// uinput_batch_flush(). A full batch writes out its complete SYN_REPORT frames automatically
+struct uinput_batch {
+    /// Events waiting to be written
+    struct uinput_raw_data events[UINPUT_BATCH_SIZE];
+    /// Number of events currently held
+    size_t len;
+    /// Function the events are written out with, uinput_emit_batch() unless replaced after init
+    int (*emit)(const struct uinput_raw_data * events, size_t count);
+    /// CLOCK_MONOTONIC time in microseconds at which the events are due, 0 for straight away.
+    /// Only honoured by the default output, through uinput_emit_at()
+    uint64_t time_us;
+};
+
+/// @brief Key sequence parsed once into its frames, to be entered any number of times
+struct uinput_chord {
+    /// Number of events pressing the keys, the rest release them
+    size_t press;
+    /// Total number of events
+    size_t len;
+    /// Frames pressing all keys, followed by frames releasing them all, allocated to fit
+    struct uinput_raw_data * events;
+};
+
+/// Type flag: Caps Lock is on, so letters are typed with Shift the other way round
+#define UINPUT_TYPE_CAPS_LOCK 1
+
+/// Default key sequence starting the entry of a character by its code point, as taken by GTK and IBus
+#define UINPUT_UNICODE_START_DEFAULT "CTRL+SHIFT+u"
+
+/// Default key sequence ending the entry of a character by its code point
+#define UINPUT_UNICODE_END_DEFAULT "SPACE"
+
+/// @brief Shift state whilst typing text, so that a run of shifted characters shares one Shift press
+struct uinput_typist {
+    /// Any of UINPUT_TYPE_CAPS_LOCK
+    uint32_t flags;
+    /// Non-zero whilst Shift is held
+    int shift;
+};
+
+/// @brief Adaptive pacing state of the local uinput device
+struct uinput_pacer_stats {
+    /// Current gap inserted after each frame in microseconds
+    uint32_t gap_us;
+    /// Total number of frames written
+    uint64_t frames;
+    /// Total number of writes to the device
+    uint64_t writes;
+    /// Number of frames seen to be dropped (SYN_DROPPED) on readback
+    uint64_t drops;
+};
+
+/// Motion is relative to the current pointer position, starting from (0, 0)
+#define UINPUT_MOTION_RELATIVE 1
+/// Motion follows a cubic Bezier curve through the control points rather than a straight line
+#define UINPUT_MOTION_BEZIER 2
+/// Absolute motion starts from the given position rather than from where the pointer was last moved to
+#define UINPUT_MOTION_FROM 4
+
+/// @brief Smooth pointer motion, expanded into one frame per step and paced over its duration
+/// @details Also the payload of a YDOTOOL_MSG_MOTION message, so only fixed size fields are used
+struct uinput_motion {
+    /// Start position, only used by absolute motion with UINPUT_MOTION_FROM
+    int32_t from_x;
+    int32_t from_y;
+    /// End position, or total movement for relative motion
+    int32_t to_x;
+    int32_t to_y;
+    /// Bezier control points, in the same coordinates as the end position
+    int32_t c1_x;
+    int32_t c1_y;
+    int32_t c2_x;
+    int32_t c2_y;
+    /// Time taken by the whole motion in milliseconds
+    uint32_t duration_ms;
+    /// Rate of pointer updates in Hz
+    uint32_t rate_hz;
+    /// Any of UINPUT_MOTION_RELATIVE, UINPUT_MOTION_BEZIER and UINPUT_MOTION_FROM
+    uint32_t flags;
+};
+
+/// Scroll distance of one wheel notch in REL_WHEEL_HI_RES and REL_HWHEEL_HI_RES units
+#define UINPUT_SCROLL_NOTCH 120
+/// Default rate of wheel frames whilst scrolling in Hz
+#define UINPUT_SCROLL_RATE_DEFAULT 120
+
 /// @brief Array of all normal (non-shifted) character keys
 extern const struct key_char NORMAL_KEYS[NUM_NORMAL_KEYS];
 
 /// @brief Array of all shifted character keys
 extern const struct key_char SHIFTED_KEYS[NUM_SHIFTED_KEYS];
 
+/// @brief Array of all axes and buttons of the gamepad device, axes first
+extern const struct uinput_gamepad_control GAMEPAD_CONTROLS[UINPUT_GAMEPAD_CONTROLS];
+
 /// @brief Array of all modifier keys
 extern const struct key_string MODIFIER_KEYS[NUM_MODIFIER_KEYS];
 
@@ -71,9 +223,35 @@ extern const struct key_string MODIFIER_KEYS[NUM_MODIFIER_KEYS];
 extern const struct key_string FUNCTION_KEYS[NUM_FUNCTION_KEYS];
 
 /// @brief Initialise uinput device
+/// @details A newly created device is waited on until another process opens its
+/// /dev/input/eventN node, or until the timeout set with uinput_set_init_timeout() expires.
+/// There is no wait if no other process reads any input device, nor for the gamepad
 /// @return 0 on success, 1 if error(s)
 int uinput_init();
 
+/// @brief Set the size of the screen the absolute pointer and touch devices' axes span
+/// @details Must be called before the device is created. Positions are then given in pixels
+/// @param width Screen width in pixels (default = UINPUT_SCREEN_WIDTH_DEFAULT)
+/// @param height Screen height in pixels (default = UINPUT_SCREEN_HEIGHT_DEFAULT)
+void uinput_set_screen_size(uint32_t width, uint32_t height);
+
+/// @brief Set how the kernel repeats keys held on the main device (EV_REP)
+/// @details Must be called before the device is created
+/// @param delay_ms Time a key is held before it repeats, 0 to turn autorepeat off
+/// (default = UINPUT_REPEAT_DELAY_DEFAULT)
+/// @param period_ms Time between repeats (default = UINPUT_REPEAT_PERIOD_DEFAULT)
+void uinput_set_autorepeat(uint32_t delay_ms, uint32_t period_ms);
+
+/// @brief Set the maximum time uinput_init() waits for a new device to be picked up by a reader
+/// @param timeout_ms Timeout in milliseconds (default = 1000ms)
+void uinput_set_init_timeout(uint32_t timeout_ms);
+
+/// @brief Choose whether events are passed to ydotoold through a shared memory ring
+/// @details Must be called before the first event is emitted. Falls back to the socket if the
+/// daemon can't provide a ring
+/// @param enable Non-zero to request a shared memory ring from the daemon
+void uinput_set_shm(int enable);
+
 /// @brief Close uinput device if open
 /// @return 0 on success, 1 if error(s)
 int uinput_destroy();
@@ -90,6 +268,344 @@ int uinput_enter_char(char c);
 /// @return 0 on success, 1 if error(s)
 int uinput_emit(uint16_t type, uint16_t code, int32_t value);
 
+/// @brief Get the current adaptive pacing state of the local uinput device
+/// @details The gap is only adapted when writing to the device directly, not via ydotoold
+/// @param [out] stats Current pacing state
+void uinput_get_pacer_stats(struct uinput_pacer_stats * stats);
+
+/// @brief Print the current adaptive pacing state in human readable form
+/// @param stream Stream to print to
+void uinput_print_pacer_stats(FILE * stream);
+
+/// @brief Emulate a number of uinput events with as few system calls as possible
+/// @details Writes to the device are split on frame boundaries into chunks small enough for
+/// the consumers' buffers, whereas the daemon receives up to YDOTOOL_MSG_MAX_EVENTS per message.
+/// Frames starting with a UINPUT_EV_DEVICE event are written to that device, creating it first
+/// if need be
+/// @param events Array of events to be written, in order
+/// @param count Number of events in the array
+/// @return 0 on success, 1 if error(s)
+int uinput_emit_batch(const struct uinput_raw_data * events, size_t count);
+
+/// @brief Get the current CLOCK_MONOTONIC time in microseconds, the clock deadlines are given in
+/// @return Microseconds since an arbitrary fixed point
+uint64_t uinput_now_us();
+
+/// @brief Emulate a number of uinput events at a given time
+/// @details With ydotoold the events are handed over shortly before they are due and the daemon
+/// emits them on time, otherwise this sleeps until the deadline before emitting them. Deadlines are
+/// absolute, so a sequence of them doesn't accumulate drift
+/// @param events Array of events to be written, in order
+/// @param count Number of events in the array
+/// @param time_us CLOCK_MONOTONIC time in microseconds at which the events are due
+/// @return 0 on success, 1 if error(s)
+int uinput_emit_at(const struct uinput_raw_data * events, size_t count, uint64_t time_us);
+
+/// @brief Initialise an empty batch of events
+/// @param batch The batch to be initialised
+void uinput_batch_init(struct uinput_batch * batch);
+
+/// @brief Write out all events held by the batch and empty it
+/// @param batch The batch to be flushed
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_flush(struct uinput_batch * batch);
+
+/// @brief Write out the events held by the batch, then have the following events emitted at a given time
+/// @param batch The batch
+/// @param time_us CLOCK_MONOTONIC time in microseconds at which the following events are due
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_at(struct uinput_batch * batch, uint64_t time_us);
+
+/// @brief Append a single event to the batch, writing out complete frames first if it is full
+/// @param batch The batch to append to
+/// @param type The type of input event (e.g. key input or mouse movement)
+/// @param code An integer representing the key to input or direction to move in
+/// @param value 1 for key press, 0 for key release or any integer value for absolute/relative mouse movement in pixels
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_add(struct uinput_batch * batch, uint16_t type, uint16_t code, int32_t value);
+
+/// @brief Append a SYN_REPORT event, terminating the current frame
+/// @param batch The batch to append to
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_sync(struct uinput_batch * batch);
+
+/// @brief Append a single key frame (press or release)
+/// @param batch The batch to append to
+/// @param code The integer representation of the associated key
+/// @param value 1 for press, 0 for release
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_key(struct uinput_batch * batch, uint16_t code, int32_t value);
+
+/// @brief Append a keypress (i.e. press & release) of a given keycode
+/// @param batch The batch to append to
+/// @param code The integer representation of the associated key
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_keypress(struct uinput_batch * batch, uint16_t code);
+
+/// @brief Append a keypress of a given keycode whilst holding the shift key
+/// @param batch The batch to append to
+/// @param code The integer representation of the associated key
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_shifted_keypress(struct uinput_batch * batch, uint16_t code);
+
+/// @brief Append the key frame(s) for the given string representation of a key
+/// @param batch The batch to append to
+/// @param key_string Character array representing the key to be pressed/released
+/// @param value 1 for press, 0 for release
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_enter_key(struct uinput_batch * batch, const char * key_string, int32_t value);
+
+/// @brief Append the key frames for entering the given char
+/// @param batch The batch to append to
+/// @param c The character to be entered
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_enter_char(struct uinput_batch * batch, char c);
+
+/// @brief Start typing text, with Shift released
+/// @param [out] typist The typing state
+/// @param flags Any of UINPUT_TYPE_CAPS_LOCK
+void uinput_typist_init(struct uinput_typist * typist, uint32_t flags);
+
+/// @brief Translate a text into the frames typing it, ready to be written out
+/// @details One table lookup per ASCII character. Anything else is entered by its code point, in
+/// hex between the sequences set with uinput_set_unicode(), with frames built once per code point.
+/// The text must have passed uinput_check_text()
+/// @param typist The typing state, carried over from and on to neighbouring texts
+/// @param text The UTF-8 characters to type (need not be NUL terminated)
+/// @param len Length of the text in bytes
+/// @param [out] events Room for the frames
+/// @param room Number of events there is room for
+/// @param [out] used Length of the start of the text translated, short of len if out of room
+/// @return Number of events written
+size_t uinput_typist_events(struct uinput_typist * typist, const char * text, size_t len, struct uinput_raw_data * events, size_t room, size_t * used);
+
+/// @brief Append the key frames typing a text, pressing or releasing Shift only where the
+/// characters need it the other way from the one before
+/// @details The text must have passed uinput_check_text()
+/// @param batch The batch to append to
+/// @param typist The typing state, carried over from and on to neighbouring texts
+/// @param text The UTF-8 characters to type (need not be NUL terminated)
+/// @param len Length of the text in bytes
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_type_text(struct uinput_batch * batch, struct uinput_typist * typist, const char * text, size_t len);
+
+/// @brief Append the frame releasing Shift if it is still held after typing
+/// @param batch The batch to append to
+/// @param typist The typing state
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_type_end(struct uinput_batch * batch, struct uinput_typist * typist);
+
+/// @brief Check that every character of a text can be typed
+/// @details Runs of plain ASCII are classified 16 bytes at a time where SSE2 is available.
+/// Characters outside ASCII must be valid UTF-8, and can only be typed if entry by code point
+/// hasn't been turned off. Every character that can't be typed is reported, not just the first
+/// @param text The characters (need not be NUL terminated)
+/// @param len Number of characters
+/// @return 0 if all can be typed, 1 otherwise
+int uinput_check_text(const char * text, size_t len);
+
+/// @brief Check that every character of a piece of a longer text can be typed
+/// @details As uinput_check_text(), but characters are reported by their offset in the whole text
+/// @param text The characters (need not be NUL terminated)
+/// @param len Number of characters
+/// @param offset Offset of the piece in the whole text
+/// @return 0 if all can be typed, 1 otherwise
+int uinput_check_text_at(const char * text, size_t len, uint64_t offset);
+
+/// @brief Find the length of the first character of a text
+/// @param text The UTF-8 characters, which must have passed uinput_check_text()
+/// @param len Length of the text in bytes, at least 1
+/// @return Length of the character in bytes
+size_t uinput_text_char_len(const char * text, size_t len);
+
+/// @brief Find how much of a text is left once any character cut short at its end is taken off,
+/// so that a long text can be split into pieces of whole characters
+/// @param text The UTF-8 characters
+/// @param len Length of the text in bytes
+/// @return Length of the text up to the character cut short, len if there is none
+size_t uinput_text_complete(const char * text, size_t len);
+
+/// @brief Set the key sequences entering a character by its code point, for characters outside
+/// ASCII (default = UINPUT_UNICODE_START_DEFAULT, then the hex digits, then UINPUT_UNICODE_END_DEFAULT)
+/// @details Text typed with other sequences than the defaults is expanded locally, not by ydotoold
+/// @param start Key sequence before the hex digits, NULL to refuse characters outside ASCII
+/// @param end Key sequence after the hex digits
+/// @return 0 on success, 1 if either sequence can't be parsed
+int uinput_set_unicode(const char * start, const char * end);
+
+/// @brief Append the key frames typing a text, holding Shift once over each run of shifted characters
+/// @details Nothing is appended if any character can't be typed
+/// @param batch The batch to append to
+/// @param text The characters to type (need not be NUL terminated)
+/// @param len Number of characters
+/// @param flags Any of UINPUT_TYPE_CAPS_LOCK
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_type(struct uinput_batch * batch, const char * text, size_t len, uint32_t flags);
+
+/// @brief Append the key frames for pressing, or releasing, all keys of a sequence
+/// @param batch The batch to append to
+/// @param sequence String representations of keys separated by '+' (e.g. "ctrl+alt+f1")
+/// @param value 1 for press, 0 for release
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_sequence(struct uinput_batch * batch, const char * sequence, int32_t value);
+
+/// @brief Parse a key sequence into the frames entering it
+/// @param [out] chord The compiled sequence, to be freed with uinput_chord_free(). Anything it held
+/// before is overwritten, not freed
+/// @param sequence String representations of keys separated by '+' (e.g. "ctrl+alt+f1")
+/// @return 0 on success, 1 if a key is unknown or error(s), leaving the chord empty
+int uinput_chord_compile(struct uinput_chord * chord, const char * sequence);
+
+/// @brief Free the frames of a compiled key sequence, leaving it empty
+/// @param chord The compiled sequence
+void uinput_chord_free(struct uinput_chord * chord);
+
+/// @brief Append events as they are, such as pre-built frames
+/// @param batch The batch to append to
+/// @param events Events to append
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_events(struct uinput_batch * batch, const struct uinput_raw_data * events, size_t count);
+
+/// @brief Append the key frames for pressing all keys of a sequence, then releasing them all
+/// @param batch The batch to append to
+/// @param sequence String representations of keys separated by '+' (e.g. "ctrl+alt+f1")
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_enter_keys(struct uinput_batch * batch, const char * sequence);
+
+/// @brief Convert a mouse button number to the associated keycode
+/// @param button 1: left, 2: right, 3: middle
+/// @param [out] keycode The keycode of the button
+/// @return 0 on success, 1 if error(s)
+int uinput_button_to_keycode(uint16_t button, uint16_t * keycode);
+
+/// @brief Check whether an event can be emitted by the virtual device
+/// @details The event type must be one of the enabled types and, for key events, the key one of
+/// the enabled keys. Of the synchronisation events only SYN_REPORT is supported
+/// @param type Event type (e.g. EV_KEY)
+/// @param code Event code (e.g. KEY_A)
+/// @return 1 if supported, 0 if not
+int uinput_is_supported_event(uint16_t type, uint16_t code);
+
+/// @brief Type the given text, leaving the key expansion to ydotoold if it is in use
+/// @details Nothing is typed if any character can't be. Shift is held once over each run of
+/// shifted characters
+/// @param text The characters to type (need not be NUL terminated)
+/// @param len Number of characters
+/// @param key_delay_us Time between characters in microseconds, 0 for as fast as possible
+/// @param flags Any of UINPUT_TYPE_CAPS_LOCK
+/// @return 0 on success, 1 if error(s)
+int uinput_type_text(const char * text, size_t len, uint32_t key_delay_us, uint32_t flags);
+
+/// @brief Press and release key sequences, leaving the key expansion to ydotoold if it is in use
+/// @details All sequences are parsed once, before any key is pressed. A held sequence is pressed
+/// once and released at its deadline, leaving any repeats in between to the kernel's autorepeat.
+/// ydotoold is handed the release along with the press, so that it happens even if this process dies
+/// @param count Number of key sequences
+/// @param sequences Key sequences (e.g. "ctrl+alt+f1")
+/// @param repeats Number of times to enter all of the sequences
+/// @param key_delay_us Time between sequences in microseconds
+/// @param repeat_delay_us Additional time between repetitions in microseconds
+/// @param hold_us Time each sequence is held down in microseconds, 0 for a quick press
+/// @return 0 on success, 1 if error(s)
+int uinput_key(int count, char * const * sequences, uint64_t repeats, uint32_t key_delay_us, uint32_t repeat_delay_us, uint32_t hold_us);
+
+/// @brief Click a mouse button, leaving the key expansion to ydotoold if it is in use
+/// @param button 1: left, 2: right, 3: middle
+/// @return 0 on success, 1 if error(s)
+int uinput_click(uint16_t button);
+
+/// @brief Move the pointer smoothly, leaving the expansion and pacing to ydotoold if it is in use
+/// @details Without ydotoold each step is emitted at its own deadline, so this returns once the
+/// motion is over, and absolute motion needs UINPUT_MOTION_FROM. ydotoold schedules all steps of
+/// motion up to YDOTOOL_TIMED_HORIZON_US long at once, so this returns straight away, and starts
+/// absolute motion without UINPUT_MOTION_FROM where it last put the pointer. Longer motion is
+/// expanded as without ydotoold
+/// @param motion The motion
+/// @return 0 on success, 1 if error(s)
+int uinput_motion(const struct uinput_motion * motion);
+
+/// @brief Scroll the wheel, spread evenly over a time and paced by ydotoold if it is in use
+/// @details Returns once the last frame has been handed over, which is at the end of the scroll
+/// without ydotoold
+/// @param horizontal Non-zero for the horizontal wheel
+/// @param amount Distance in UINPUT_SCROLL_NOTCH units per notch, positive for up or right
+/// @param duration_ms Time taken by the whole scroll in milliseconds, 0 for a single frame
+/// @param rate_hz Rate of wheel frames in Hz
+/// @return 0 on success, 1 if error(s)
+int uinput_scroll(int horizontal, int32_t amount, uint32_t duration_ms, uint32_t rate_hz);
+
+/// @brief Store a sequence of events in ydotoold under the given name, to be run later
+/// @details Replaces any macro already defined with the same name
+/// @param name Name of the macro
+/// @param events The events of the macro
+/// @param count Number of events
+/// @param [out] id ID the macro can be run by
+/// @return 0 on success, 1 if error(s) (including ydotoold not running)
+int uinput_macro_define(const char * name, const struct uinput_raw_data * events, size_t count, uint32_t * id);
+
+/// @brief Remove a macro stored in ydotoold, freeing its ID
+/// @param name Name of the macro
+/// @return 0 on success, 1 if error(s) (including no such macro or ydotoold not running)
+int uinput_macro_undefine(const char * name);
+
+/// @brief Run a macro stored in ydotoold
+/// @param id ID of the macro, or YDOTOOL_MACRO_NONE to look it up by name
+/// @param name Name of the macro, only used if id is YDOTOOL_MACRO_NONE
+/// @param repeats Number of times to run the macro
+/// @return 0 on success, 1 if error(s) (including ydotoold not running)
+int uinput_macro_run(uint32_t id, const char * name, uint32_t repeats);
+
+/// @brief Append a frame moving the absolute pointer device to a given x and y pixel position
+/// @param batch The batch to append to
+/// @param x Horizontal pixel position
+/// @param y Vertical pixel position
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_move_mouse(struct uinput_batch * batch, int32_t x, int32_t y);
+
+/// @brief Append a frame moving the mouse a given amount in the x and y directions
+/// @param batch The batch to append to
+/// @param x Relative horizontal pixel movement
+/// @param y Relative vertical pixel movement
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_relative_move_mouse(struct uinput_batch * batch, int32_t x, int32_t y);
+
+/// @brief Append the frames of a scroll, each at its own deadline
+/// @details Every frame carries the high resolution distance, and the whole notches completed by
+/// it as a classic wheel event, so readers of either see the same total scroll. Steps too small to
+/// carry any distance are left out
+/// @param batch The batch to append to
+/// @param horizontal Non-zero for the horizontal wheel
+/// @param amount Distance in UINPUT_SCROLL_NOTCH units per notch, positive for up or right
+/// @param duration_ms Time taken by the whole scroll in milliseconds, 0 for a single frame
+/// @param rate_hz Rate of wheel frames in Hz
+/// @param start_us CLOCK_MONOTONIC time in microseconds at which the scroll starts
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_scroll(struct uinput_batch * batch, int horizontal, int32_t amount, uint32_t duration_ms, uint32_t rate_hz, uint64_t start_us);
+
+/// @brief Get the number of steps a motion is made up of, after the starting point
+/// @param motion The motion
+/// @return Number of steps, at least 1
+uint32_t uinput_motion_steps(const struct uinput_motion * motion);
+
+/// @brief Get the pointer position at a step of a motion
+/// @param motion The motion
+/// @param step Step number, from 0 (start) to uinput_motion_steps() (end)
+/// @param [out] x Horizontal position, relative to the start for relative motion
+/// @param [out] y Vertical position, relative to the start for relative motion
+void uinput_motion_point(const struct uinput_motion * motion, uint32_t step, int32_t * x, int32_t * y);
+
+/// @brief Append the frame moving the pointer to a step of a motion
+/// @details Nothing is appended for a step that leaves the pointer where it is, except for the
+/// start of an absolute motion, which puts the pointer in place
+/// @param batch The batch to append to
+/// @param motion The motion
+/// @param step Step number, from 0 (start) to uinput_motion_steps() (end)
+/// @param [in,out] x Position of the previous step, from_x or 0 (relative) before step 0
+/// @param [in,out] y Position of the previous step, from_y or 0 (relative) before step 0
+/// @return 0 on success, 1 if error(s)
+int uinput_batch_motion_step(struct uinput_batch * batch, const struct uinput_motion * motion, uint32_t step, int32_t * x, int32_t * y);
+
 /// @brief Emulate a single key event for the given string representation of a key
 /// @param key_string Character array representing the key to be pressed/released
 /// @param value 1 for press, 0 for release
@@ -103,6 +619,22 @@ int uinput_enter_key(const char * key_string, int32_t value);
 /// @return 0 on success, 1 if error(s)
 int uinput_keychar_to_keycode(const char c, uint16_t * keycode, uint8_t * shifted);
 
+/// @brief Hash a key name, ignoring case
+/// @param seed Selects one of a family of hash functions
+/// @param name The key name (need not be NUL terminated)
+/// @param len Length of the name
+/// @return The hash
+uint32_t key_hash(uint32_t seed, const char * name, size_t len);
+
+/// @brief Look up a key name, ignoring case, in the generated perfect hash table
+/// @details Covers the modifier and function key names and the kernel's own KEY_* names without
+/// the prefix (e.g. "volumeup"). Costs two hashes and one comparison, and allocates nothing
+/// @param [in] name The key name (need not be NUL terminated)
+/// @param len Length of the name
+/// @param [out] keycode The integer keycode for the given key
+/// @return 0 on success, 1 if not a key name
+int uinput_keyname_to_keycode(const char * name, size_t len, uint16_t * keycode);
+
 /// @brief Convert string/char representation of a key to the associated integer keycode
 /// @param [in] key_string Character array representing the key
 /// @param [out] keycode The integer keycode for the given key
@@ -0,0 +1,130 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file wheel.c
+/// @author Harry Austen
+/// @brief Implementation of the timer wheel
+
+// System includes
+#include <stdlib.h>
+#include <string.h>
+
+// Local includes
+#include "wheel.h"
+
+// Empty wheel
+void ydotool_wheel_init(struct ydotool_wheel * wheel) {
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->tick = 0;
+    wheel->next_us = 0;
+    wheel->events = 0;
+}
+
+// Timer in the slot of its tick
+struct ydotool_timer * ydotool_wheel_add(struct ydotool_wheel * wheel, uint64_t time_us, uint64_t now_us, const void * events, size_t count) {
+    struct ydotool_timer * timer = malloc(sizeof(*timer) + count * sizeof(struct uinput_raw_data));
+    if (!timer) {
+        return NULL;
+    }
+    timer->time_us = time_us;
+    timer->count = count;
+    memcpy(timer->events, events, count * sizeof(struct uinput_raw_data));
+
+    // Start from the present when the wheel has been idle
+    if (!wheel->events) {
+        wheel->tick = now_us / YDOTOOL_WHEEL_TICK_US;
+        wheel->next_us = time_us;
+    } else if (wheel->next_us && time_us < wheel->next_us) {
+        wheel->next_us = time_us;
+    }
+
+    // Late timers are due in the first tick still to be taken out. Equal deadlines keep arrival order
+    uint64_t tick = time_us / YDOTOOL_WHEEL_TICK_US;
+    if (tick < wheel->tick) {
+        tick = wheel->tick;
+    }
+    struct ydotool_timer ** slot = &wheel->slots[tick & (YDOTOOL_WHEEL_SLOTS - 1)];
+    while (*slot && (*slot)->time_us <= time_us) {
+        slot = &(*slot)->next;
+    }
+    timer->next = *slot;
+    *slot = timer;
+    wheel->events += count;
+    return timer;
+}
+
+// Earliest deadline, worked out again only after a timer has been taken out
+uint64_t ydotool_wheel_next(struct ydotool_wheel * wheel) {
+    if (!wheel->events) {
+        return 0;
+    }
+    if (wheel->next_us) {
+        return wheel->next_us;
+    }
+
+    // The first slot with a timer due in the current rotation holds the earliest deadline.
+    // Failing that, the earliest of the later rotations' timers is found at the head of a slot
+    uint64_t next = UINT64_MAX;
+    for (uint64_t tick = wheel->tick; tick != wheel->tick + YDOTOOL_WHEEL_SLOTS; ++tick) {
+        const struct ydotool_timer * timer = wheel->slots[tick & (YDOTOOL_WHEEL_SLOTS - 1)];
+        if (timer && timer->time_us < next) {
+            next = timer->time_us;
+            if (next / YDOTOOL_WHEEL_TICK_US == tick) {
+                break;
+            }
+        }
+    }
+    wheel->next_us = next;
+    return next;
+}
+
+// Head of the first slot holding a due timer
+struct ydotool_timer * ydotool_wheel_pop(struct ydotool_wheel * wheel, uint64_t now_us) {
+    if (!wheel->events) {
+        return NULL;
+    }
+
+    // Nothing is due before the earliest deadline, if known
+    if (wheel->next_us / YDOTOOL_WHEEL_TICK_US > wheel->tick) {
+        wheel->tick = wheel->next_us / YDOTOOL_WHEEL_TICK_US;
+    }
+
+    uint64_t now_tick = now_us / YDOTOOL_WHEEL_TICK_US;
+    for (; wheel->tick <= now_tick; ++wheel->tick) {
+        struct ydotool_timer ** slot = &wheel->slots[wheel->tick & (YDOTOOL_WHEEL_SLOTS - 1)];
+        struct ydotool_timer * timer = *slot;
+        if (timer && timer->time_us <= now_us && timer->time_us / YDOTOOL_WHEEL_TICK_US <= wheel->tick) {
+            *slot = timer->next;
+            wheel->events -= timer->count;
+            wheel->next_us = 0;
+            return timer;
+        }
+
+        // Timers later in the current tick are still to come
+        if (wheel->tick == now_tick) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Free every slot's timers
+void ydotool_wheel_clear(struct ydotool_wheel * wheel) {
+    for (size_t i = 0; i != YDOTOOL_WHEEL_SLOTS; ++i) {
+        while (wheel->slots[i]) {
+            struct ydotool_timer * timer = wheel->slots[i];
+            wheel->slots[i] = timer->next;
+            free(timer);
+        }
+    }
+    wheel->next_us = 0;
+    wheel->events = 0;
+}
@@ -0,0 +1,89 @@
+/// @copyright
+/// This file is part of ydotool.
+/// Copyright (C) 2019 Harry Austen
+///
+/// This program is free software: you can redistribute it and/or modify
+/// it under the terms of the MIT License.
+///
+/// This program is distributed in the hope that it will be useful,
+/// but WITHOUT ANY WARRANTY; without even the implied warranty of
+/// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+/// @file wheel.h
+/// @author Harry Austen
+/// @brief Hashed timer wheel holding timed events until they are due
+/// @details Timers are kept in the slot of their tick, sorted by deadline, with timers for later
+/// rotations of the wheel after those due in the current one. Adding a timer and taking out a due
+/// one only look at a single slot
+
+#ifndef __WHEEL_H__
+#define __WHEEL_H__
+
+// System includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Local includes
+#include "uinput.h"
+
+/// Number of slots of a timer wheel (must be a power of two)
+#define YDOTOOL_WHEEL_SLOTS 1024
+
+/// Time covered by each slot of a timer wheel in microseconds
+#define YDOTOOL_WHEEL_TICK_US 1000
+
+/// @brief Timed events waiting in a timer wheel
+struct ydotool_timer {
+    /// CLOCK_MONOTONIC time in microseconds at which the events are due
+    uint64_t time_us;
+    /// Next timer in the same slot, in deadline order
+    struct ydotool_timer * next;
+    /// Number of events
+    size_t count;
+    /// Events, made up of whole frames
+    struct uinput_raw_data events[];
+};
+
+/// @brief A timer wheel
+struct ydotool_wheel {
+    /// Timers of each slot
+    struct ydotool_timer * slots[YDOTOOL_WHEEL_SLOTS];
+    /// First tick not yet taken out. Timers are never placed in earlier slots
+    uint64_t tick;
+    /// Earliest deadline in the wheel, 0 if not worked out since the last timer was taken out
+    uint64_t next_us;
+    /// Number of events waiting in the wheel
+    size_t events;
+};
+
+/// @brief Initialise an empty timer wheel
+/// @param wheel The wheel to initialise
+void ydotool_wheel_init(struct ydotool_wheel * wheel);
+
+/// @brief Put timed events into a timer wheel
+/// @details Events with the same deadline come out in the order they were put in, and events
+/// already late are due in the first tick still to be taken out
+/// @param wheel The wheel
+/// @param time_us CLOCK_MONOTONIC time in microseconds at which the events are due (at least 1)
+/// @param now_us Current CLOCK_MONOTONIC time in microseconds
+/// @param events The events, made up of whole frames (need not be aligned)
+/// @param count Number of events
+/// @return The timer holding a copy of the events, NULL if it couldn't be allocated
+struct ydotool_timer * ydotool_wheel_add(struct ydotool_wheel * wheel, uint64_t time_us, uint64_t now_us, const void * events, size_t count);
+
+/// @brief Earliest deadline of the timers in a wheel
+/// @param wheel The wheel
+/// @return CLOCK_MONOTONIC time in microseconds, 0 if the wheel is empty
+uint64_t ydotool_wheel_next(struct ydotool_wheel * wheel);
+
+/// @brief Take the timer with the earliest deadline out of a wheel, if it is due
+/// @param wheel The wheel
+/// @param now_us Current CLOCK_MONOTONIC time in microseconds
+/// @return The timer, to be freed by the caller, or NULL if none is due
+struct ydotool_timer * ydotool_wheel_pop(struct ydotool_wheel * wheel, uint64_t now_us);
+
+/// @brief Free all timers left in a wheel, leaving it empty
+/// @param wheel The wheel
+void ydotool_wheel_clear(struct ydotool_wheel * wheel);
+
+#endif // __WHEEL_H__
@@ -16,17 +16,31 @@
 
 // System includes
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <unistd.h>
 
 // Local includes
+#include "gamepad.h"
+#include "gesture.h"
+#include "program.h"
+#include "protocol.h"
+#include "record.h"
+#include "stream.h"
 #include "uinput.h"
 
+/// Bytes of text typed at a time from a file or stdin, so memory use doesn't grow with the input
+#define TYPE_CHUNK_SIZE (1 << 20)
+
 /// @brief Click command usage string
 static const char * click_usage =
     "Usage: click [--delay <ms>] <button>\n"
@@ -36,28 +50,131 @@ static const char * click_usage =
     "                2: right\n"
     "                3: middle\n";
 
+/// @brief Compile command usage string
+static const char * compile_usage =
+    "Usage: compile <script> <program>\n"
+    "    --help   Show this help\n"
+    "    script   Text file of steps, one per line:\n"
+    "                 type <text>\n"
+    "                 key <key sequence> ...\n"
+    "                 mouse [--relative] <x> <y>\n"
+    "                 click <button>\n"
+    "                 delay <ms>\n"
+    "                 loop <times> ... end\n"
+    "    program  Compiled program file to write, replayed with the run command\n";
+
+/// @brief Gamepad command usage string
+static const char * gamepad_usage =
+    "Usage: gamepad [--delay <ms>] <control>=<value> ...\n"
+    "       gamepad --stream [--binary] [--rate <hz>]\n"
+    "    --help       Show this help\n"
+    "    --delay ms   Delay time before start (default = 100ms)\n"
+    "    --stream     Read samples from stdin until end of input, any number of <control>=<value>\n"
+    "                 per line\n"
+    "    --binary     Read samples as native endian struct uinput_raw_data records (EV_ABS or\n"
+    "                 EV_KEY, code, value) instead\n"
+    "    --rate hz    Maximum rate of gamepad updates (default = 1000). Axes sampled faster only\n"
+    "                 keep their latest value, every button change is kept\n"
+    "Axes: x y rx ry (sticks, -32768 to 32767), z rz (triggers, 0 to 255), hat0x hat0y (d-pad, -1 to 1)\n"
+    "Buttons (0 or 1): south east north west tl tr tl2 tr2 select start mode thumbl thumbr\n";
+
+/// @brief Gesture command usage string
+static const char * gesture_usage =
+    "Usage: gesture [--delay <ms>] [--fingers <n>] [--duration <ms>] tap <x> <y>\n"
+    "       gesture [--delay <ms>] [--fingers <n>] [--duration <ms>] [--rate <hz>] swipe <x> <y> <dx> <dy>\n"
+    "       gesture [--delay <ms>] [--fingers <n>] [--duration <ms>] [--rate <hz>] pinch <x> <y> <from radius> <to radius>\n"
+    "    --help         Show this help\n"
+    "    --delay ms     Delay time before start touching (default = 100ms)\n"
+    "    --fingers n    Number of fingers, up to 10 (default = 1, or 2 for pinch)\n"
+    "    --duration ms  Time from touching down to lifting (default = 50ms for tap, 300ms otherwise)\n"
+    "    --rate hz      Rate of touchscreen frames whilst moving (default = 120)\n"
+    "    tap            Touch down side by side, centred on x,y\n"
+    "    swipe          Touch down side by side, centred on x,y, and move by dx,dy\n"
+    "    pinch          Touch down evenly spread around a circle centred on x,y, whose radius goes\n"
+    "                   from one to the other (smaller to pinch, larger to spread)\n"
+    "Positions are in pixels on the screen set with ydotool(d) --screen (default = 1920x1080)\n";
+
 /// @brief Key command usage string
 static const char * key_usage =
-    "Usage: key [--delay <ms>] [--key-delay <ms>] [--repeat <times>] [--repeat-delay <ms>] <key sequence> ...\n"
+    "Usage: key [--delay <ms>] [--key-delay <ms>] [--repeat <times>] [--repeat-delay <ms>] [--hold <ms>] <key sequence> ...\n"
     "    --help             Show this help\n"
     "    --delay ms         Delay time before start pressing keys (default = 100ms)\n"
-    "    --key-delay ms     Delay time between keystrokes (default = 12ms)\n"
+    "    --key-delay ms     Delay time between key sequences (default = 0ms)\n"
     "    --repeats times    Times to repeat the key sequence\n"
-    "    --repeat-delay ms  Delay time between repetitions (default = 0ms)\n"
-    "Each key sequence can be any number of modifiers and keys, separated by plus (+)\nFor example: alt+r Alt+F4 CTRL+alt+f3 aLT+1+2+3 ctrl+Backspace\n";
+    "    --repeat-delay ms  Additional delay time between repetitions (default = 0ms)\n"
+    "    --hold ms          Hold each key sequence down this long, with the kernel repeating it\n"
+    "                       as set with ydotool(d) --autorepeat, then release it\n"
+    "Each key sequence can be any number of modifiers and keys, separated by plus (+)\n"
+    "Key names ignore case and include the kernel's KEY_* names without the prefix (e.g. volumeup)\n"
+    "For example: alt+r Alt+F4 CTRL+alt+f3 aLT+1+2+3 ctrl+Backspace\n";
+
+/// @brief Macro command usage string
+static const char * macro_usage =
+    "Usage: macro define <name> type <things to type>\n"
+    "       macro define <name> key <key sequence> ...\n"
+    "       macro define <name> click <button>\n"
+    "       macro run [--repeats <times>] <name | #id>\n"
+    "       macro undefine <name>\n"
+    "    --help           Show this help\n"
+    "    --repeats times  Times to run the macro\n"
+    "Macros are stored in ydotoold, which must be running. Defining a macro prints its id\n"
+    "ydotoold refuses macros of more than 65536 events, or beyond 1048576 events in all\n";
 
 /// @brief Mouse command usage string
 static const char * mouse_usage =
-    "Usage: mouse [--delay <ms>] <x> <y>\n"
-    "    --help      Show this help\n"
-    "    --delay ms  Delay time before start moving (default = 100ms)\n";
+    "Usage: mouse [--delay <ms>] [--relative] <x> <y>\n"
+    "       mouse --duration <ms> [--rate <hz>] [--from <x,y>] [--bezier <x1,y1,x2,y2>] [--relative] <x> <y>\n"
+    "       mouse --stream [--relative] [--binary] [--rate <hz>]\n"
+    "    --help         Show this help\n"
+    "    --delay ms     Delay time before start moving (default = 100ms)\n"
+    "    --relative     Move relative to the current position, rather than to a position on the\n"
+    "                   screen set with ydotool(d) --screen (default = 1920x1080)\n"
+    "    --duration ms  Move smoothly, taking this long to get there\n"
+    "    --from x,y     Start position of a smooth absolute move (default = where the pointer was\n"
+    "                   last moved to by ydotoold, required without ydotoold)\n"
+    "    --bezier x1,y1,x2,y2\n"
+    "                   Follow a cubic Bezier curve with these control points instead of a line\n"
+    "    --stream       Read positions from stdin, one \"x y\" pair per line, until end of input\n"
+    "    --binary       Read positions as pairs of native endian 32 bit integers instead\n"
+    "    --rate hz      Rate of pointer updates (default = 1000). For streams this is the maximum,\n"
+    "                   relative moves arriving faster are added together, for absolute ones only\n"
+    "                   the latest counts\n";
+
+/// @brief Record command usage string
+static const char * record_usage =
+    "Usage: record [--duration <ms>] <program> <device> ...\n"
+    "    --help         Show this help\n"
+    "    --duration ms  Time to record for (default = until interrupted)\n"
+    "    program        Program file to write, replayed with the run command. '-' writes to stdout\n"
+    "    device         Input device to record (e.g. /dev/input/event3)\n";
+
+/// @brief Run command usage string
+static const char * run_usage =
+    "Usage: run [--delay <ms>] [--speed <factor>] <program>\n"
+    "    --help          Show this help\n"
+    "    --delay ms      Delay time before start running (default = 100ms)\n"
+    "    --speed factor  Play the program's delays this many times faster (default = 1)\n"
+    "    program         Program file written by the compile or record command\n";
+
+/// @brief Scroll command usage string
+static const char * scroll_usage =
+    "Usage: scroll [--delay <ms>] [--duration <ms>] [--rate <hz>] [--hi-res] <up | down | left | right> <amount>\n"
+    "    --help         Show this help\n"
+    "    --delay ms     Delay time before start scrolling (default = 100ms)\n"
+    "    --duration ms  Spread the scroll evenly over this long (default = all in one go)\n"
+    "    --rate hz      Rate of wheel updates whilst spreading the scroll (default = 120)\n"
+    "    --hi-res       Amount is in 120ths of a notch, rather than in whole notches\n"
+    "    amount         Distance to scroll\n";
 
 /// @brief Type command usage string
 static const char * type_usage =
-    "Usage: type [--delay milliseconds] [--key-delay milliseconds] [--args N] [--file <filepath>] <things to type>\n"
+    "Usage: type [--delay milliseconds] [--key-delay milliseconds] [--caps-lock] [--unicode <key sequence>|off] [--unicode-end <key sequence>] [--args N] [--file <filepath>] <things to type>\n"
     "    --help                    Show this help\n"
     "    --delay milliseconds      Delay time before start typing\n"
-    "    --key-delay milliseconds  Delay time between keystrokes (default = 12ms)\n"
+    "    --key-delay milliseconds  Delay time between keystrokes (default = 0ms)\n"
+    "    --caps-lock               Caps Lock is on, so type letters with Shift the other way round\n"
+    "    --unicode key_sequence    Keys starting hex entry of characters outside ASCII, or off to refuse them (default = " UINPUT_UNICODE_START_DEFAULT ")\n"
+    "    --unicode-end key_sequence  Keys ending hex entry of characters outside ASCII (default = " UINPUT_UNICODE_END_DEFAULT ")\n"
     "    --file filepath           Specify a file, the contents of which will be be typed as if passed as an argument. The filepath may also be '-' to read from stdin\n";
 
 /// @brief Print usage string to stderr
@@ -73,71 +190,169 @@ static int usage(const char * msg) {
 /// @param[in] time_delay Delay before entering key
 /// @return 0 on success, 1 if error(s)
 int click_run(uint16_t button, uint32_t time_delay) {
-	uint16_t keycode = BTN_LEFT;
-
-	switch (button) {
-        case 1:
-            break;
-		case 2:
-			keycode = BTN_RIGHT;
-			break;
-		case 3:
-			keycode = BTN_MIDDLE;
-			break;
-		default:
-            fprintf(stderr, "Invalid button argument!\n");
-            return usage(click_usage);
-	}
+	uint16_t keycode;
+
+    if (uinput_button_to_keycode(button, &keycode)) {
+        return usage(click_usage);
+    }
 
     usleep(time_delay * 1000);
 
-    if (uinput_send_keypress(keycode)) {
+    if (uinput_click(button)) {
         return 1;
     }
 
 	return 0;
 }
 
-/// @brief Press all keys, then release all keys
-/// @param[in] key_string Sequence of string representations of keys to be pressed together, separated by '+'
+/// @brief Emulate entering any number of given sequences of keys
+/// @param[in] time_delay Number of milliseconds to wait before pressing keys
+/// @param[in] key_delay Milliseconds between key sequences
+/// @param[in] repeats Number of times to repeat the inputted key presses
+/// @param[in] repeat_delay Additional milliseconds between repetitions
+/// @param[in] hold Milliseconds each key sequence is held down, 0 for a quick press
+/// @param[in] argc Number of (remaining) program arguments
+/// @param[in] argv Pointer to the (remaining) program arguments
 /// @return 0 on success, 1 if error(s)
-int key_enter_keys(char * key_string) {
-    char * ptr = strtok(key_string, "+");
-    while (ptr) {
-        if (uinput_enter_key(ptr, 1)) {
-            return 1;
-        }
-        ptr = strtok(NULL, "+");
+int key_run(uint32_t time_delay, uint32_t key_delay, uint64_t repeats, uint32_t repeat_delay, uint32_t hold, int argc, char ** argv) {
+
+    usleep(time_delay * 1000);
+
+    if (uinput_key(argc, argv, repeats, key_delay * 1000, repeat_delay * 1000, hold * 1000)) {
+        return 1;
     }
-    ptr = strtok(key_string, "+");
-    while (ptr) {
-        if (uinput_enter_key(ptr, 0)) {
-            return 1;
-        }
-        ptr = strtok(NULL, "+");
+
+	return 0;
+}
+
+/// @brief Events captured for a macro definition
+static struct uinput_raw_data * macro_events = NULL;
+
+/// @brief Number of events captured for a macro definition
+static size_t macro_count = 0;
+
+/// @brief Batch output capturing the events of a macro definition
+/// @param[in] events The events to capture
+/// @param[in] count Number of events
+/// @return 0 on success, 1 if error(s)
+static int macro_capture(const struct uinput_raw_data * events, size_t count) {
+    struct uinput_raw_data * tmp = realloc(macro_events, (macro_count + count) * sizeof(*events));
+    if (!tmp) {
+        fprintf(stderr, "Failed to allocate macro events\n");
+        return 1;
     }
+    macro_events = tmp;
+    memcpy(macro_events + macro_count, events, count * sizeof(*events));
+    macro_count += count;
     return 0;
 }
 
-/// @brief Emulate entering any number of given sequences of keys
-/// @param[in] time_delay Number of milliseconds to wait before pressing keys
-/// @param[in] repeats Number of times to repeat the inputted key presses
-/// @param[in] argc Number of (remaining) program arguments
+/// @brief Expand a command into events and store them in the daemon as a macro
+/// @param[in] name Name of the macro
+/// @param[in] argc Number of (remaining) program arguments, starting with the command
 /// @param[in] argv Pointer to the (remaining) program arguments
 /// @return 0 on success, 1 if error(s)
-int key_run(uint32_t time_delay, uint64_t repeats, int argc, char ** argv) {
+int macro_define(const char * name, int argc, char ** argv) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    batch.emit = macro_capture;
+
+    int ret = 0;
+    if (!strcmp(argv[0], "type")) {
+        for (int i = 1; i != argc && !ret; ++i) {
+            ret = uinput_check_text(argv[i], strlen(argv[i]));
+        }
+        struct uinput_typist typist;
+        uinput_typist_init(&typist, 0);
+        for (int i = 1; i != argc && !ret; ++i) {
+            ret = uinput_batch_type_text(&batch, &typist, argv[i], strlen(argv[i]));
+        }
+        ret = ret || uinput_batch_type_end(&batch, &typist);
+    } else if (!strcmp(argv[0], "key")) {
+        for (int i = 1; i != argc && !ret; ++i) {
+            ret = uinput_batch_enter_keys(&batch, argv[i]);
+        }
+    } else if (!strcmp(argv[0], "click") && argc == 2) {
+        uint16_t keycode;
+        ret = uinput_button_to_keycode((uint16_t)strtoul(argv[1], NULL, 10), &keycode)
+            || uinput_batch_keypress(&batch, keycode);
+    } else {
+        ret = usage(macro_usage);
+    }
+
+    uint32_t id = 0;
+    if (!ret && !uinput_batch_flush(&batch) && !uinput_macro_define(name, macro_events, macro_count, &id)) {
+        printf("%" PRIu32 "\n", id);
+    } else {
+        ret = 1;
+    }
+
+    free(macro_events);
+    macro_events = NULL;
+    macro_count = 0;
+    return ret;
+}
+
+/// @brief Perform a touch gesture on the virtual touchscreen
+/// @param[in] argc Number of arguments
+/// @param[in] argv Kind of gesture followed by its positions
+/// @param[in] time_delay Milliseconds to wait before touching
+/// @param[in] fingers Number of fingers, 0 for the gesture's default
+/// @param[in] duration_ms Milliseconds from touching down to lifting, 0 for the gesture's default
+/// @param[in] rate Touchscreen frames per second whilst moving
+/// @return 0 on success, 1 if error(s)
+int gesture_run(int argc, char ** argv, uint32_t time_delay, uint32_t fingers, uint32_t duration_ms, uint32_t rate) {
+    struct gesture gesture;
+    memset(&gesture, 0, sizeof(gesture));
+    gesture.fingers = fingers ? fingers : 1;
+    gesture.duration_ms = duration_ms ? duration_ms : GESTURE_MOVE_MS;
+    gesture.rate_hz = rate;
+
+    if (argc == 3 && !strcmp(argv[0], "tap")) {
+        gesture.kind = GESTURE_TAP;
+        gesture.duration_ms = duration_ms ? duration_ms : GESTURE_TAP_MS;
+    } else if (argc == 5 && !strcmp(argv[0], "swipe")) {
+        gesture.kind = GESTURE_SWIPE;
+        gesture.dx = (int32_t)strtol(argv[3], NULL, 10);
+        gesture.dy = (int32_t)strtol(argv[4], NULL, 10);
+    } else if (argc == 5 && !strcmp(argv[0], "pinch")) {
+        gesture.kind = GESTURE_PINCH;
+        gesture.fingers = fingers ? fingers : 2;
+        gesture.radius_from = (uint32_t)strtoul(argv[3], NULL, 10);
+        gesture.radius_to = (uint32_t)strtoul(argv[4], NULL, 10);
+    } else {
+        return usage(gesture_usage);
+    }
+    gesture.x = (int32_t)strtol(argv[1], NULL, 10);
+    gesture.y = (int32_t)strtol(argv[2], NULL, 10);
 
     usleep(time_delay * 1000);
 
-    while (repeats--) {
-        for (int i = 0; i != argc; ++i) {
-            if (key_enter_keys(argv[i])) {
-                return 1;
-            }
-        }
+    if (gesture_perform(&gesture)) {
+        return 1;
     }
 
-	return 0;
+    return 0;
+}
+
+/// @brief Run a macro stored in the daemon
+/// @param[in] target Name of the macro, or its id prefixed by '#'
+/// @param[in] repeats Number of times to run the macro
+/// @return 0 on success, 1 if error(s)
+int macro_run(const char * target, uint64_t repeats) {
+    uint32_t id = YDOTOOL_MACRO_NONE;
+    if (target[0] == '#') {
+        id = (uint32_t)strtoul(target + 1, NULL, 10);
+    }
+
+    while (repeats) {
+        uint32_t times = repeats < UINT32_MAX ? (uint32_t)repeats : UINT32_MAX;
+        if (uinput_macro_run(id, target, times)) {
+            return 1;
+        }
+        repeats -= times;
+    }
+    return 0;
 }
 
 /// @brief Moves the move absolutely or relatively by the given x/y coordinates
@@ -163,23 +378,326 @@ int mouse_run(int32_t x, int32_t y, uint32_t time_delay, bool relative) {
 	return 0;
 }
 
-/// @brief Enter characters in input string one at a time
-/// @param[in] text Array of characters to be entered
-/// @return 0 on success, >0 if errors
-int type_text(char * text) {
-	for (size_t i = 0; text[i] != '\0'; ++i) {
-        if (uinput_enter_char(text[i])) {
+/// @brief Move the mouse smoothly along a line or Bezier curve, paced by ydotoold if it is running
+/// @param[in] x Horizontal end position, or movement if relative
+/// @param[in] y Vertical end position, or movement if relative
+/// @param[in] time_delay Milliseconds to wait before moving mouse
+/// @param[in] relative true if movement is to be relative to current mouse position
+/// @param[in] duration_ms Milliseconds the movement takes
+/// @param[in] rate Pointer updates per second
+/// @param[in] from "x,y" start position, NULL to carry on from the current one
+/// @param[in] bezier "x1,y1,x2,y2" Bezier control points, NULL for a straight line
+/// @return 0 on success, 1 if error(s)
+int mouse_motion_run(int32_t x, int32_t y, uint32_t time_delay, bool relative, uint32_t duration_ms, uint32_t rate, const char * from, const char * bezier) {
+    struct uinput_motion motion;
+    memset(&motion, 0, sizeof(motion));
+    motion.to_x = x;
+    motion.to_y = y;
+    motion.duration_ms = duration_ms;
+    motion.rate_hz = rate;
+    if (relative) {
+        motion.flags |= UINPUT_MOTION_RELATIVE;
+    }
+
+    char end;
+    if (from) {
+        if (relative || sscanf(from, "%" SCNd32 ",%" SCNd32 "%c", &motion.from_x, &motion.from_y, &end) != 2) {
+            fprintf(stderr, "ydotool: mouse: invalid start position %s\n", from);
+            return 1;
+        }
+        motion.flags |= UINPUT_MOTION_FROM;
+    }
+    if (bezier) {
+        if (sscanf(bezier, "%" SCNd32 ",%" SCNd32 ",%" SCNd32 ",%" SCNd32 "%c", &motion.c1_x, &motion.c1_y, &motion.c2_x, &motion.c2_y, &end) != 4) {
+            fprintf(stderr, "ydotool: mouse: invalid Bezier control points %s\n", bezier);
             return 1;
         }
-	}
+        motion.flags |= UINPUT_MOTION_BEZIER;
+    }
+
+    usleep(time_delay * 1000);
+
+    if (uinput_motion(&motion)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Record input devices into a program file
+/// @param[in] output Path of the program file
+/// @param[in] duration_ms Milliseconds to record for, 0 until interrupted
+/// @param[in] argc Number of devices
+/// @param[in] argv Paths of the devices
+/// @return 0 on success, 1 if error(s)
+int record_run(const char * output, uint32_t duration_ms, int argc, char ** argv) {
+    struct record_stats stats;
+    int ret = record_devices(output, argc, argv, duration_ms, &stats);
+
+    fprintf(stderr, "Recorded %" PRIu64 " frames (%" PRIu64 " events), %" PRIu64 " events filtered, %" PRIu64 " drops\n",
+        stats.frames, stats.events, stats.filtered, stats.drops);
+    return ret;
+}
+
+/// @brief Replay a compiled program
+/// @param[in] path Path of the program file
+/// @param[in] time_delay Milliseconds to wait before running
+/// @param[in] speed Speed factor applied to the program's delays
+/// @return 0 on success, 1 if error(s)
+int run_run(const char * path, uint32_t time_delay, double speed) {
+    usleep(time_delay * 1000);
+
+    if (program_run_file(path, speed)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Pointer movement accumulated between ticks of a mouse stream
+struct mouse_stream {
+    /// true if positions are relative to the current position
+    bool relative;
+    /// Horizontal position, or sum of the relative moves
+    int64_t x;
+    /// Vertical position, or sum of the relative moves
+    int64_t y;
+};
+
+/// @brief Take in a position read from a mouse stream
+/// @param[in] stream The stream
+/// @param[in] data Text line or binary record
+/// @param[in] len Length of the data in bytes
+/// @return 0 (malformed lines are skipped)
+static int mouse_stream_input(struct stream * stream, const char * data, size_t len) {
+    struct mouse_stream * state = stream->ctx;
+    int32_t x;
+    int32_t y;
+
+    if (stream->record_size) {
+        memcpy(&x, data, sizeof(x));
+        memcpy(&y, data + sizeof(x), sizeof(y));
+    } else {
+        char * end_x;
+        char * end_y;
+        x = (int32_t)strtol(data, &end_x, 10);
+        y = (int32_t)strtol(end_x + strspn(end_x, " \t,"), &end_y, 10);
+        if (end_x == data || end_y == end_x || end_y[strspn(end_y, " \t\r")]) {
+            if (len) {
+                fprintf(stderr, "ydotool: mouse: skipping malformed line: %s\n", data);
+            }
+            return 0;
+        }
+    }
+
+    if (state->relative) {
+        state->x += x;
+        state->y += y;
+    } else {
+        state->x = x;
+        state->y = y;
+    }
     return 0;
 }
 
+/// @brief Clamp an accumulated coordinate to the range of an event value
+/// @param[in] value The coordinate
+/// @return The clamped coordinate
+static int32_t mouse_stream_clamp(int64_t value) {
+    return value > INT32_MAX ? INT32_MAX : value < INT32_MIN ? INT32_MIN : (int32_t)value;
+}
+
+/// @brief Move the pointer by, or to, what a mouse stream has accumulated
+/// @param[in] stream The stream
+/// @return 0 on success, 1 if error(s)
+static int mouse_stream_tick(struct stream * stream) {
+    struct mouse_stream * state = stream->ctx;
+
+    if (!state->relative) {
+        return uinput_move_mouse(mouse_stream_clamp(state->x), mouse_stream_clamp(state->y));
+    }
+    if (!state->x && !state->y) {
+        return 0;
+    }
+
+    int32_t x = mouse_stream_clamp(state->x);
+    int32_t y = mouse_stream_clamp(state->y);
+    state->x -= x;
+    state->y -= y;
+    return uinput_relative_move_mouse(x, y);
+}
+
+/// @brief Move the mouse following positions read from stdin
+/// @param[in] relative true if positions are relative to the current position
+/// @param[in] binary true if positions are binary pairs of int32_t rather than text
+/// @param[in] rate Maximum number of pointer updates per second
+/// @param[in] stats true to print the number of positions read and updates made
+/// @return 0 on success, 1 if error(s)
+int mouse_stream_run(bool relative, bool binary, uint32_t rate, bool stats) {
+    struct mouse_stream state = { relative, 0, 0 };
+    struct stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.fd = STDIN_FILENO;
+    stream.record_size = binary ? 2 * sizeof(int32_t) : 0;
+    stream.period_us = rate ? 1000000 / rate : 0;
+    stream.input = mouse_stream_input;
+    stream.tick = mouse_stream_tick;
+    stream.ctx = &state;
+
+    int ret = stream_run(&stream);
+
+    if (stats) {
+        fprintf(stderr, "stream: %" PRIu64 " positions, %" PRIu64 " updates\n", stream.records, stream.ticks);
+    }
+    return ret;
+}
+
+/// @brief Set gamepad controls once, in a single update unless a button changes more than once
+/// @param[in] argc Number of samples
+/// @param[in] argv "<control>=<value>" samples
+/// @param[in] time_delay Milliseconds to wait before updating the gamepad
+/// @return 0 on success, 1 if error(s)
+int gamepad_run(int argc, char ** argv, uint32_t time_delay) {
+    struct gamepad gamepad;
+    gamepad_init(&gamepad);
+
+    for (int i = 0; i != argc; ++i) {
+        int control;
+        int32_t value;
+        if (gamepad_parse(argv[i], strlen(argv[i]), &control, &value)) {
+            fprintf(stderr, "ydotool: gamepad: invalid sample %s\n", argv[i]);
+            return usage(gamepad_usage);
+        }
+        if (gamepad_set(&gamepad, control, value)) {
+            fprintf(stderr, "ydotool: gamepad: more than %d button changes\n", GAMEPAD_MAX_PRESSES);
+            return 1;
+        }
+    }
+
+    usleep(time_delay * 1000);
+
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    if (gamepad_batch(&batch, &gamepad) || uinput_batch_flush(&batch)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/// @brief Update the gamepad with what a gamepad stream has sampled
+/// @param[in] stream The stream
+/// @return 0 on success, 1 if error(s)
+static int gamepad_stream_tick(struct stream * stream) {
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+
+    if (gamepad_batch(&batch, stream->ctx)) {
+        uinput_batch_flush(&batch);
+        return 1;
+    }
+    return uinput_batch_flush(&batch);
+}
+
+/// @brief Take in a sample of a gamepad control
+/// @param[in] stream The stream
+/// @param[in] control Index of the control in GAMEPAD_CONTROLS
+/// @param[in] value Value of the control
+/// @return 0 on success, 1 if error(s)
+static int gamepad_stream_sample(struct stream * stream, int control, int32_t value) {
+    if (!gamepad_set(stream->ctx, control, value)) {
+        return 0;
+    }
+
+    // Too many button changes to hold, so they go out ahead of the next tick
+    if (gamepad_stream_tick(stream)) {
+        return 1;
+    }
+    return gamepad_set(stream->ctx, control, value);
+}
+
+/// @brief Take in the samples read from a gamepad stream
+/// @param[in] stream The stream
+/// @param[in] data Text line or binary record
+/// @param[in] len Length of the data in bytes
+/// @return 0 on success, 1 if error(s) (malformed lines are skipped)
+static int gamepad_stream_input(struct stream * stream, const char * data, size_t len) {
+    static const char * separators = " \t\r,";
+    (void)len;
+
+    if (stream->record_size) {
+        struct uinput_raw_data sample;
+        memcpy(&sample, data, sizeof(sample));
+        int control = gamepad_find_code(sample.type, sample.code);
+        if (control == -1) {
+            fprintf(stderr, "ydotool: gamepad: skipping unknown control type %u code %u\n", sample.type, sample.code);
+            return 0;
+        }
+        return gamepad_stream_sample(stream, control, sample.value);
+    }
+
+    // The whole line is checked before any of it is taken in
+    for (int pass = 0; pass != 2; ++pass) {
+        const char * token = data + strspn(data, separators);
+        while (*token) {
+            size_t token_len = strcspn(token, separators);
+            int control;
+            int32_t value;
+            if (gamepad_parse(token, token_len, &control, &value)) {
+                fprintf(stderr, "ydotool: gamepad: skipping malformed line: %s\n", data);
+                return 0;
+            }
+            if (pass && gamepad_stream_sample(stream, control, value)) {
+                return 1;
+            }
+            token += token_len;
+            token += strspn(token, separators);
+        }
+    }
+    return 0;
+}
+
+/// @brief Drive the gamepad following samples read from stdin
+/// @param[in] binary true if samples are binary struct uinput_raw_data records rather than text
+/// @param[in] rate Maximum number of gamepad updates per second
+/// @param[in] stats true to print the number of lines or records read and updates made
+/// @return 0 on success, 1 if error(s)
+int gamepad_stream_run(bool binary, uint32_t rate, bool stats) {
+    struct gamepad gamepad;
+    gamepad_init(&gamepad);
+    struct stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.fd = STDIN_FILENO;
+    stream.record_size = binary ? sizeof(struct uinput_raw_data) : 0;
+    stream.period_us = rate ? 1000000 / rate : 0;
+    stream.input = gamepad_stream_input;
+    stream.tick = gamepad_stream_tick;
+    stream.ctx = &gamepad;
+
+    int ret = stream_run(&stream);
+
+    if (stats) {
+        fprintf(stderr, "stream: %" PRIu64 " %s, %" PRIu64 " updates\n", stream.records, binary ? "samples" : "lines", stream.ticks);
+    }
+    return ret;
+}
+
+/// @brief Enter characters in input string one at a time
+/// @param[in] text Array of characters to be entered
+/// @param[in] key_delay Milliseconds between keystrokes
+/// @param[in] flags Any of UINPUT_TYPE_CAPS_LOCK
+/// @return 0 on success, >0 if errors
+int type_text(char * text, uint32_t key_delay, uint32_t flags) {
+    return uinput_type_text(text, strlen(text), key_delay * 1000, flags);
+}
+
 /// @brief Type the given text using a virtual keyboard device
 /// @param[in] argc The number of strings to type
 /// @param[in] argv Pointer to the strings
+/// @param[in] key_delay Milliseconds between keystrokes
+/// @param[in] flags Any of UINPUT_TYPE_CAPS_LOCK
 /// @return 0 on success, 1 on error(s)
-int type_args(int argc, char ** argv) {
+int type_args(int argc, char ** argv, uint32_t key_delay, uint32_t flags) {
     // Sum length of args
     size_t len = 0;
     for (int i = 0; i != argc; ++i) {
@@ -199,7 +717,7 @@ int type_args(int argc, char ** argv) {
     }
 
     // Emulate keyboard input of buffer characters
-    if (type_text(buf)) {
+    if (type_text(buf, key_delay, flags)) {
         return 1;
     }
 
@@ -209,106 +727,160 @@ int type_args(int argc, char ** argv) {
 	return 0;
 }
 
-/// @brief Type the given text using a virtual keyboard device
+/// @brief Type text read from a file descriptor as it arrives
+/// @details Whatever each read returns is checked and typed before reading on, so memory use
+/// doesn't grow with the input, and a pipe's writer carries on filling the pipe meanwhile.
+/// Typing stops at the first chunk with a character that can't be typed
+/// @param[in] fd File descriptor to read from until end of file
+/// @param[in] name Name of the input, for messages
+/// @param[in] key_delay Milliseconds between keystrokes
+/// @param[in] flags Any of UINPUT_TYPE_CAPS_LOCK
 /// @return 0 on success, 1 on error(s)
-int type_stdin() {
-    // Allocate buffer for reading in chunks and text for holding full input
-    char * buf = malloc(sizeof(char) * 10);
-    char * text = malloc(sizeof(char));
-
-    // Read up to 10 chars at a time from stdin
-    while (fgets(buf, 10, stdin)) {
-        // Add extra byte allocation for new chars
-        size_t len = strlen(text) + strlen(buf) + 1;
-        char * tmp = realloc(text, sizeof(char) * len);
-        if (tmp) {
-            text = tmp;
-        } else {
-            free(text);
-            free(buf);
-            fprintf(stderr, "Failed to allocated %lu bytes for text buffer\n", len);
+int type_stream(int fd, const char * name, uint32_t key_delay, uint32_t flags) {
+    static char buf[TYPE_CHUNK_SIZE];
+    uint64_t offset = 0;
+    size_t len = 0;
+
+    for (;;) {
+        ssize_t got = read(fd, buf + len, sizeof(buf) - len);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got == -1) {
+            fprintf(stderr, "ydotool: type: error: failed to read %s: %s\n", name, strerror(errno));
             return 1;
         }
 
-        // Error handling
-        if (!text) {
-            fprintf(stderr, "Failed to read text from stdin\n");
+        // A character cut short by the read waits for the rest of it, unless there is no more
+        len += (size_t)got;
+        size_t complete = got ? uinput_text_complete(buf, len) : len;
+        if (complete && (uinput_check_text_at(buf, complete, offset) || uinput_type_text(buf, complete, key_delay * 1000, flags))) {
             return 1;
         }
+        if (!got) {
+            return 0;
+        }
 
-        // Append current buffer to full text string
-        strcat(text, buf);
+        memmove(buf, buf + complete, len - complete);
+        len -= complete;
+        offset += complete;
     }
+}
 
-    // Free up buffer memory
-    free(buf);
-
-    // Call uinput to type the text
-    if (type_text(text)) {
-        return 1;
+/// @brief Find the length of the next chunk of a mapped file to type
+/// @param[in] text The contents of the file
+/// @param[in] size Size of the file
+/// @param[in] offset Offset of the chunk, short of size
+/// @return Length of the chunk, TYPE_CHUNK_SIZE or the rest of the file, less any character cut short
+size_t type_chunk(const char * text, size_t size, size_t offset) {
+    if (size - offset <= TYPE_CHUNK_SIZE) {
+        return size - offset;
     }
+    return uinput_text_complete(text + offset, TYPE_CHUNK_SIZE);
+}
 
-    // Free up text memory
-    free(text);
-
-    return 0;
+/// @brief Advise the kernel about a chunk of a mapped file, widened to whole pages
+/// @param[in] text The contents of the file, page aligned
+/// @param[in] offset Offset of the chunk
+/// @param[in] len Length of the chunk
+/// @param[in] advice MADV_WILLNEED or MADV_DONTNEED
+void type_advise(char * text, size_t offset, size_t len, int advice) {
+    size_t start = offset & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+    madvise(text + start, offset + len - start, advice);
 }
 
-/// @brief Type the given text using a virtual keyboard device
+/// @brief Type the contents of a file using a virtual keyboard device
+/// @details Regular files are mapped rather than read, checked in full before any of it is typed,
+/// then typed a chunk at a time with the next chunk read ahead. Chunks are dropped from memory
+/// once done with, so memory use doesn't grow with the file. Anything else is read as a stream
 /// @param[in] file_path The path to the file containing the text to write
+/// @param[in] key_delay Milliseconds between keystrokes
+/// @param[in] flags Any of UINPUT_TYPE_CAPS_LOCK
 /// @return 0 on success, 1 on error(s)
-int type_file(char * file_path) {
-    // Open file_path file in read only mode
-    FILE * fd = fopen(file_path, "r");
-
-    if (!fd) {
+int type_file(const char * file_path, uint32_t key_delay, uint32_t flags) {
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
         fprintf(stderr, "ydotool: type: error: failed to open %s: %s\n", file_path, strerror(errno));
         return 1;
     }
 
-    // Seek to end of file
-    if (fseek(fd, 0L, SEEK_END)) {
-        fprintf(stderr, "Failed to seek to end of file %s\n", file_path);
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+        int ret = type_stream(fd, file_path, key_delay, flags);
+        close(fd);
+        return ret;
     }
 
-    // Grab length of file (current position)
-    int64_t len = ftell(fd);
-
-    // Seek back to beginning
-    if (fseek(fd, 0L, SEEK_SET)) {
-        fprintf(stderr, "Failed to seek to beginning of file %s\n", file_path);
+    size_t size = (size_t)st.st_size;
+    char * text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        fprintf(stderr, "ydotool: type: error: failed to map %s: %s\n", file_path, strerror(errno));
+        return 1;
     }
+    madvise(text, size, MADV_SEQUENTIAL);
 
-    // Allocate buffer to correct size to hold all characers in the file,
-    // plus a null terminating byte
-    size_t len_with_null = (size_t)len + 1;
-    char * buf = malloc(sizeof(char) * len_with_null);
-
-    // Extract text from file and pass to uinput to type
-    fgets(buf, (int)len_with_null, fd);
-    if (type_text(buf)) {
-        // Free up buffer memory
-        free(buf);
+    // Every character that can't be typed is reported before anything is typed
+    int ret = 0;
+    for (size_t offset = 0, len; offset != size; offset += len) {
+        len = type_chunk(text, size, offset);
+        ret |= uinput_check_text_at(text + offset, len, offset);
+        type_advise(text, offset, len, MADV_DONTNEED);
+    }
 
-        if (fclose(fd)) {
-            fprintf(stderr, "Failed to close file %s\n", file_path);
+    for (size_t offset = 0, len; offset != size && !ret; offset += len) {
+        len = type_chunk(text, size, offset);
+        if (offset + len != size) {
+            type_advise(text, offset + len, type_chunk(text, size, offset + len), MADV_WILLNEED);
         }
+        ret = uinput_type_text(text + offset, len, key_delay * 1000, flags);
+        type_advise(text, offset, len, MADV_DONTNEED);
+    }
+
+    munmap(text, size);
+    return ret;
+}
 
-        // Free up filepath memory
-        free(file_path);
+/// @brief Scroll the mouse wheel, spread over a time and paced by ydotoold if it is running
+/// @param[in] direction "up", "down", "left" or "right"
+/// @param[in] amount Distance to scroll
+/// @param[in] time_delay Milliseconds to wait before scrolling
+/// @param[in] duration_ms Milliseconds the scroll takes, 0 for all in one go
+/// @param[in] rate Wheel updates per second
+/// @param[in] hi_res true if amount is in 120ths of a notch, rather than in whole notches
+/// @return 0 on success, 1 if error(s)
+int scroll_run(const char * direction, const char * amount, uint32_t time_delay, uint32_t duration_ms, uint32_t rate, bool hi_res) {
+    int horizontal;
+    int32_t sign;
+    if (!strcmp(direction, "up")) {
+        horizontal = 0;
+        sign = 1;
+    } else if (!strcmp(direction, "down")) {
+        horizontal = 0;
+        sign = -1;
+    } else if (!strcmp(direction, "left")) {
+        horizontal = 1;
+        sign = -1;
+    } else if (!strcmp(direction, "right")) {
+        horizontal = 1;
+        sign = 1;
+    } else {
+        return usage(scroll_usage);
+    }
 
+    int32_t unit = hi_res ? 1 : UINPUT_SCROLL_NOTCH;
+    unsigned long distance = strtoul(amount, NULL, 10);
+    if (distance > (unsigned long)(INT32_MAX / unit)) {
+        fprintf(stderr, "ydotool: scroll: amount %s is too large\n", amount);
         return 1;
     }
 
-    // Free up buffer memory
-    free(buf);
+    usleep(time_delay * 1000);
 
-    if (fclose(fd)) {
-        fprintf(stderr, "Failed to close file %s\n", file_path);
+    if (uinput_scroll(horizontal, sign * (int32_t)distance * unit, duration_ms, rate)) {
+        return 1;
     }
 
-    // Free up filepath memory
-    free(file_path);
     return 0;
 }
 
@@ -317,12 +889,20 @@ int type_file(char * file_path) {
 /// @return 1 (error)
 int usage_main(char * prog) {
     fprintf(stderr,
-        "Usage: %s cmd [opt ...]\n"
+        "Usage: %s [--stats] [--init-timeout <ms>] [--shm] [--screen <width>x<height>] [--autorepeat <delay>,<period> | off] cmd [opt ...]\n"
         "Available commands:\n"
         "    click\n"
+        "    compile\n"
+        "    gamepad\n"
+        "    gesture\n"
         "    key\n"
+        "    macro\n"
         "    mouse\n"
-        "    type\n",
+        "    record\n"
+        "    run\n"
+        "    scroll\n"
+        "    type\n"
+        "A ydotoold older than the version 2 protocol costs every command a 250ms wait to detect\n",
         prog
     );
     return 1;
@@ -341,55 +921,189 @@ int main(int argc, char ** argv) {
     // Options
     /// @todo Implement delays
 
-    char * file_path;
+    const char * file_path = NULL;
+    const char * bezier = NULL;
+    bool binary = false;
+    const char * from = NULL;
+    uint32_t duration = 0;
+    uint32_t fingers = 0;
+    bool hi_res = false;
+    uint32_t hold = 0;
+    uint32_t type_flags = 0;
+    uint32_t rate = 1000;
+    bool rate_set = false;
     bool relative = false;
+    bool stream = false;
     uint64_t repeats = 1;
     uint32_t time_delay = 100;
-    //uint32_t time_keydelay = 12;
+    bool stats = false;
+    uint32_t time_keydelay = 0;
+    uint32_t time_repeatdelay = 0;
+    double speed = 1;
+    const char * unicode_start = UINPUT_UNICODE_START_DEFAULT;
+    const char * unicode_end = UINPUT_UNICODE_END_DEFAULT;
+    bool unicode_set = false;
 
     enum optlist_t {
+        opt_autorepeat,
+        opt_bezier,
+        opt_binary,
+        opt_caps_lock,
         opt_delay,
+        opt_duration,
         opt_file,
+        opt_fingers,
+        opt_from,
         opt_help,
+        opt_hi_res,
+        opt_hold,
+        opt_init_timeout,
         opt_key_delay,
+        opt_rate,
         opt_relative,
+        opt_repeat_delay,
         opt_repeats,
+        opt_screen,
+        opt_shm,
+        opt_speed,
+        opt_stats,
+        opt_stream,
+        opt_unicode,
+        opt_unicode_end,
     };
 
     static struct option long_options[] = {
         {"help",      no_argument,       NULL, opt_help     },
+        {"autorepeat", required_argument, NULL, opt_autorepeat},
+        {"bezier",    required_argument, NULL, opt_bezier   },
+        {"binary",    no_argument,       NULL, opt_binary   },
+        {"caps-lock", no_argument,       NULL, opt_caps_lock},
         {"delay",     required_argument, NULL, opt_delay    },
-        //{"key-delay", required_argument, NULL, opt_key_delay},
+        {"key-delay", required_argument, NULL, opt_key_delay},
+        {"duration",  required_argument, NULL, opt_duration },
         {"file",      required_argument, NULL, opt_file     },
+        {"fingers",   required_argument, NULL, opt_fingers  },
+        {"from",      required_argument, NULL, opt_from     },
+        {"hi-res",    no_argument,       NULL, opt_hi_res   },
+        {"hold",      required_argument, NULL, opt_hold     },
+        {"init-timeout", required_argument, NULL, opt_init_timeout},
+        {"rate",      required_argument, NULL, opt_rate     },
         {"relative",  no_argument,       NULL, opt_relative },
+        {"repeat-delay", required_argument, NULL, opt_repeat_delay},
         {"repeats",   required_argument, NULL, opt_repeats  },
+        {"screen",    required_argument, NULL, opt_screen   },
+        {"shm",       no_argument,       NULL, opt_shm      },
+        {"speed",     required_argument, NULL, opt_speed    },
+        {"stats",     no_argument,       NULL, opt_stats    },
+        {"stream",    no_argument,       NULL, opt_stream   },
+        {"unicode",   required_argument, NULL, opt_unicode  },
+        {"unicode-end", required_argument, NULL, opt_unicode_end},
+        {NULL,        0,                 NULL, 0            },
     };
 
     int opt;
     while ((opt = getopt_long_only(argc, argv, "d:f:hk:r", long_options, NULL)) != -1) {
         switch (opt) {
+            case opt_autorepeat: {
+                uint32_t repeat_delay;
+                uint32_t repeat_period;
+                if (!strcmp(optarg, "off")) {
+                    uinput_set_autorepeat(0, 0);
+                } else if (sscanf(optarg, "%" SCNu32 ",%" SCNu32, &repeat_delay, &repeat_period) == 2 && repeat_delay && repeat_period) {
+                    uinput_set_autorepeat(repeat_delay, repeat_period);
+                } else {
+                    fprintf(stderr, "ydotool: invalid autorepeat %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case opt_bezier:
+                bezier = optarg;
+                break;
+            case opt_binary:
+                binary = true;
+                break;
+            case opt_caps_lock:
+                type_flags |= UINPUT_TYPE_CAPS_LOCK;
+                break;
             case 'd':
             case opt_delay:
                 time_delay = (uint32_t)strtoul(optarg, NULL, 10);
                 break;
-            /*
+            case opt_duration:
+                duration = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
             case 'k':
             case opt_key_delay:
                 time_keydelay = (uint32_t)strtoul(optarg, NULL, 10);
                 break;
-            */
             case 'f':
             case opt_file:
-                file_path = malloc(sizeof(char) * (strlen(optarg) + 1));
-                strcat(file_path, optarg);
+                file_path = optarg;
+                break;
+            case opt_fingers:
+                fingers = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_from:
+                from = optarg;
+                break;
+            case opt_hi_res:
+                hi_res = true;
+                break;
+            case opt_hold:
+                hold = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case opt_init_timeout:
+                uinput_set_init_timeout((uint32_t)strtoul(optarg, NULL, 10));
+                break;
+            case opt_rate:
+                rate = (uint32_t)strtoul(optarg, NULL, 10);
+                rate_set = true;
                 break;
             case 'r':
             case opt_relative:
                 relative = true;
                 break;
+            case opt_repeat_delay:
+                time_repeatdelay = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
             case opt_repeats:
                 repeats = strtoul(optarg, NULL, 10);
                 break;
+            case opt_screen: {
+                uint32_t width;
+                uint32_t height;
+                if (sscanf(optarg, "%" SCNu32 "x%" SCNu32, &width, &height) != 2 || !width || !height) {
+                    fprintf(stderr, "ydotool: invalid screen size %s\n", optarg);
+                    return 1;
+                }
+                uinput_set_screen_size(width, height);
+                break;
+            }
+            case opt_shm:
+                uinput_set_shm(1);
+                break;
+            case opt_speed:
+                speed = strtod(optarg, NULL);
+                if (!(speed > 0)) {
+                    fprintf(stderr, "ydotool: speed must be positive\n");
+                    return 1;
+                }
+                break;
+            case opt_stats:
+                stats = true;
+                break;
+            case opt_stream:
+                stream = true;
+                break;
+            case opt_unicode:
+                unicode_start = strcmp(optarg, "off") ? optarg : NULL;
+                unicode_set = true;
+                break;
+            case opt_unicode_end:
+                unicode_end = optarg;
+                unicode_set = true;
+                break;
             case 'h':
             case opt_help:
             case '?':
@@ -400,6 +1114,10 @@ int main(int argc, char ** argv) {
     if (optind == argc) {
         return usage_main(argv[0]);
     }
+    if (unicode_set && uinput_set_unicode(unicode_start, unicode_end)) {
+        fprintf(stderr, "ydotool: invalid unicode entry sequence\n");
+        return 1;
+    }
 
     // Check which command to run
     if (!strcmp(argv[optind], "click")) {
@@ -410,32 +1128,89 @@ int main(int argc, char ** argv) {
             uint16_t button = (uint16_t)strtoul(argv[optind], NULL, 10);
             ret += click_run(button, time_delay);
         }
+    } else if (!strcmp(argv[optind], "compile")) {
+        optind++;
+        if (argc - optind != 2) {
+            ret += usage(compile_usage);
+        } else {
+            ret += program_compile_file(argv[optind], argv[optind + 1]);
+        }
+    } else if (!strcmp(argv[optind], "gamepad")) {
+        optind++;
+        if (stream && argc == optind) {
+            ret += gamepad_stream_run(binary, rate, stats);
+        } else if (stream || argc == optind) {
+            ret += usage(gamepad_usage);
+        } else {
+            ret += gamepad_run(argc - optind, argv + optind, time_delay);
+        }
+    } else if (!strcmp(argv[optind], "gesture")) {
+        optind++;
+        ret += gesture_run(argc - optind, argv + optind, time_delay, fingers, duration, rate_set ? rate : GESTURE_RATE_DEFAULT);
     } else if (!strcmp(argv[optind], "key")) {
         optind++;
         if (argc == optind) {
             ret += usage(key_usage);
         } else {
-            ret += key_run(time_delay, repeats, argc - optind, argv + optind);
+            ret += key_run(time_delay, time_keydelay, repeats, time_repeatdelay, hold, argc - optind, argv + optind);
+        }
+    } else if (!strcmp(argv[optind], "macro")) {
+        optind++;
+        if (argc - optind >= 4 && !strcmp(argv[optind], "define")) {
+            ret += macro_define(argv[optind + 1], argc - optind - 2, argv + optind + 2);
+        } else if (argc - optind == 2 && !strcmp(argv[optind], "run")) {
+            ret += macro_run(argv[optind + 1], repeats);
+        } else if (argc - optind == 2 && !strcmp(argv[optind], "undefine")) {
+            ret += uinput_macro_undefine(argv[optind + 1]);
+        } else {
+            ret += usage(macro_usage);
         }
     } else if (!strcmp(argv[optind], "mouse")) {
         optind++;
-        if (argc - optind != 2) {
+        if (stream && argc == optind) {
+            ret += mouse_stream_run(relative, binary, rate, stats);
+        } else if (argc - optind != 2) {
             ret += usage(mouse_usage);
         } else {
             int32_t x = (int32_t)strtol(argv[optind], NULL, 10);
             int32_t y = (int32_t)strtol(argv[optind + 1], NULL, 10);
-            ret += mouse_run(x, y, time_delay, relative);
+            if (duration || from || bezier) {
+                ret += mouse_motion_run(x, y, time_delay, relative, duration, rate, from, bezier);
+            } else {
+                ret += mouse_run(x, y, time_delay, relative);
+            }
+        }
+    } else if (!strcmp(argv[optind], "record")) {
+        optind++;
+        if (argc - optind < 2) {
+            ret += usage(record_usage);
+        } else {
+            ret += record_run(argv[optind], duration, argc - optind - 1, argv + optind + 1);
+        }
+    } else if (!strcmp(argv[optind], "run")) {
+        optind++;
+        if (argc - optind != 1) {
+            ret += usage(run_usage);
+        } else {
+            ret += run_run(argv[optind], time_delay, speed);
+        }
+    } else if (!strcmp(argv[optind], "scroll")) {
+        optind++;
+        if (argc - optind != 2) {
+            ret += usage(scroll_usage);
+        } else {
+            ret += scroll_run(argv[optind], argv[optind + 1], time_delay, duration, rate_set ? rate : UINPUT_SCROLL_RATE_DEFAULT, hi_res);
         }
     } else if (!strcmp(argv[optind], "type")) {
         optind++;
         if (argc > optind) {
-            ret += type_args(argc - optind, argv + optind);
-        } else if (!strcmp(file_path, "")) {
+            ret += type_args(argc - optind, argv + optind, time_keydelay, type_flags);
+        } else if (file_path) {
             // Hyphen means read from stdin
             if (!strcmp(file_path, "-")) {
-                ret += type_stdin();
+                ret += type_stream(STDIN_FILENO, "stdin", time_keydelay, type_flags);
             } else {
-                ret += type_file(file_path);
+                ret += type_file(file_path, time_keydelay, type_flags);
             }
         } else {
             ret += usage(type_usage);
@@ -445,6 +1220,10 @@ int main(int argc, char ** argv) {
         ret += usage_main(argv[0]);
     }
 
+    if (stats) {
+        uinput_print_pacer_stats(stderr);
+    }
+
     ret += uinput_destroy();
 
 	return ret;
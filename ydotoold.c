@@ -15,6 +15,7 @@
 /// @brief Main entry point to the ydotool daemon program. Run this in the background to speed up the ydotool program commands
 
 // System includes
+#define _GNU_SOURCE
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -22,60 +23,1708 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
 #include <signal.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 
 // Local includes
+#include "protocol.h"
+#include "ring.h"
 #include "uinput.h"
+#include "wheel.h"
 
 /// File decriptor for the socket listener
 static int FD_LIST = -1;
 
-/// Function for handling user interruption (Ctrl-C)
+/// Maximum number of events in a single queued frame. Larger frames are dropped
+#define FRAME_MAX_EVENTS YDOTOOL_MAX_FRAME_EVENTS
+
+/// Number of frames the emission queue can hold (must be a power of two)
+#define QUEUE_SIZE 1024
+
+/// @brief A single SYN delimited frame waiting in the emission queue
+struct ydotoold_frame {
+    /// Sequence number used to hand the slot between producers and the emitter
+    atomic_size_t seq;
+    /// Number of events in the frame
+    size_t count;
+    /// Events of the frame, the last normally being a SYN_REPORT
+    struct uinput_raw_data events[FRAME_MAX_EVENTS];
+};
+
+/// Bounded multi-producer, single-consumer queue of frames waiting to be emitted
+static struct ydotoold_frame QUEUE[QUEUE_SIZE];
+
+/// Next queue position to be claimed by a producer
+static atomic_size_t QUEUE_HEAD;
+
+/// Next queue position to be emitted (only written by the emitter thread)
+static atomic_size_t QUEUE_TAIL;
+
+/// Number of frames available to the emitter thread
+static sem_t QUEUE_SEM;
+
+/// Highest number of frames seen waiting in the queue
+static atomic_size_t QUEUE_HIGH_WATER;
+
+/// Number of times the event loop found the queue full and kept frames back
+static atomic_size_t QUEUE_FULL;
+
+/// Non-zero while the event loop is waiting for the emitter to make room in the queue
+static atomic_int SPACE_WANTED;
+
+/// eventfd signalled by the emitter thread once it has made room that the event loop is waiting for
+static int FD_SPACE = -1;
+
+/// The emitter thread
+static pthread_t EMITTER;
+
+/// Set once nothing more is queued, the emitter thread exits after emitting what is left
+static atomic_int EMITTER_STOP;
+
+/// Number of timed messages dispatched by the timer wheel
+static uint64_t TIMER_DISPATCHED = 0;
+
+/// Sum of the lateness of dispatched timed messages in microseconds
+static uint64_t TIMER_LATE_TOTAL_US = 0;
+
+/// Highest lateness of a dispatched timed message in microseconds
+static uint64_t TIMER_LATE_MAX_US = 0;
+
+/// Print daemon statistics
+void ydotoold_print_stats() {
+    printf("queue: %zu/%d frames high-water, full %zu times\n",
+        atomic_load(&QUEUE_HIGH_WATER), QUEUE_SIZE, atomic_load(&QUEUE_FULL));
+    printf("timer: %" PRIu64 " timed messages, %" PRIu64 "us mean, %" PRIu64 "us max lateness\n",
+        TIMER_DISPATCHED, TIMER_DISPATCHED ? TIMER_LATE_TOTAL_US / TIMER_DISPATCHED : 0, TIMER_LATE_MAX_US);
+    uinput_print_pacer_stats(stdout);
+}
+
+/// Set by SIGUSR1, statistics are printed by the event loop
+static volatile sig_atomic_t SIG_STATS = 0;
+
+/// Set to the signal asking the daemon to terminate, handled by the event loop
+static volatile sig_atomic_t SIG_QUIT = 0;
+
+/// Function for handling user interruption (Ctrl-C) and statistics requests (SIGUSR1)
+/// @details Only records the signal, as printing isn't async-signal-safe. The signals are blocked
+/// outside epoll_pwait(), so the event loop always wakes up to act on them
 /// @param sig The signal received by the program
 void ydotoold_sig_handler(int sig) {
-    printf("\nReceived %s. Terminating...\n", sys_siglist[sig]);
-    uinput_destroy();
-    close(FD_LIST);
-    exit(0);
+    if (sig == SIGUSR1) {
+        SIG_STATS = 1;
+    } else {
+        SIG_QUIT = sig;
+    }
 }
 
-/// Function for handling a uinput event sent from the main ydotool program via socket
-/// @param fdp File descriptor pointer for the open socket
-void * ydotoold_client_handler(void * fdp) {
-	struct uinput_raw_data buf;
-    int fd = *(int *)fdp;
+/// Try to add a frame to the emission queue without blocking
+/// @details Lock free and safe to call from any number of threads at once
+/// @param events Events of the frame
+/// @param count Number of events, at most FRAME_MAX_EVENTS
+/// @return 0 on success, 1 if the queue is full
+int ydotoold_queue_try_push(const struct uinput_raw_data * events, size_t count) {
+    size_t pos = atomic_load_explicit(&QUEUE_HEAD, memory_order_relaxed);
+    struct ydotoold_frame * frame;
 
-	for (;;) {
-		ssize_t rc = recv(fd, &buf, sizeof(buf), MSG_WAITALL);
+    // Claim the slot at pos once the emitter has released it
+    for (;;) {
+        frame = &QUEUE[pos & (QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&frame->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&QUEUE_HEAD, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (seq < pos) {
+            return 1;
+        } else {
+            pos = atomic_load_explicit(&QUEUE_HEAD, memory_order_relaxed);
+        }
+    }
 
-		if (rc != sizeof(buf)) {
-			break;
-		}
+    memcpy(frame->events, events, count * sizeof(*events));
+    frame->count = count;
+    atomic_store_explicit(&frame->seq, pos + 1, memory_order_release);
 
-		uinput_emit(buf.type, buf.code, buf.value);
-	}
+    // Record queue depth high-water mark
+    size_t depth = pos + 1 - atomic_load_explicit(&QUEUE_TAIL, memory_order_relaxed);
+    size_t high = atomic_load_explicit(&QUEUE_HIGH_WATER, memory_order_relaxed);
+    while (depth > high && !atomic_compare_exchange_weak_explicit(&QUEUE_HIGH_WATER, &high, depth, memory_order_relaxed, memory_order_relaxed)) {}
+
+    sem_post(&QUEUE_SEM);
+    return 0;
+}
+
+/// Frames the emission queue had no room for, each a count event followed by its events. Only
+/// the event loop touches them, so it never has to wait for the emitter
+static struct uinput_raw_data * BACKLOG = NULL;
+
+/// Position of the first frame of the backlog
+static size_t BACKLOG_HEAD = 0;
+
+/// Position after the last frame of the backlog
+static size_t BACKLOG_TAIL = 0;
+
+/// Number of events the backlog has room for
+static size_t BACKLOG_SIZE = 0;
+
+/// Move frames from the backlog into the emission queue, as many as there is room for
+/// @details If any are left, the emitter thread is asked to signal FD_SPACE once it has made room
+void ydotoold_backlog_drain() {
+    for (int retry = 0; ; retry = 1) {
+        while (BACKLOG_HEAD != BACKLOG_TAIL) {
+            size_t count = (size_t)BACKLOG[BACKLOG_HEAD].value;
+            if (ydotoold_queue_try_push(BACKLOG + BACKLOG_HEAD + 1, count)) {
+                break;
+            }
+            BACKLOG_HEAD += count + 1;
+        }
+        if (BACKLOG_HEAD == BACKLOG_TAIL) {
+            BACKLOG_HEAD = 0;
+            BACKLOG_TAIL = 0;
+            return;
+        }
+        if (retry) {
+            return;
+        }
+
+        // The emitter may have made room before seeing the request, so look once more after making it
+        atomic_store_explicit(&SPACE_WANTED, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+/// Keep a frame back until the emission queue has room for it
+/// @param events Events of the frame
+/// @param count Number of events, at most FRAME_MAX_EVENTS
+void ydotoold_backlog_push(const struct uinput_raw_data * events, size_t count) {
+    if (BACKLOG_TAIL + count + 1 > BACKLOG_SIZE && BACKLOG_HEAD) {
+        memmove(BACKLOG, BACKLOG + BACKLOG_HEAD, (BACKLOG_TAIL - BACKLOG_HEAD) * sizeof(*BACKLOG));
+        BACKLOG_TAIL -= BACKLOG_HEAD;
+        BACKLOG_HEAD = 0;
+    }
+    if (BACKLOG_TAIL + count + 1 > BACKLOG_SIZE) {
+        size_t size = BACKLOG_SIZE ? BACKLOG_SIZE * 2 : 4096;
+        struct uinput_raw_data * backlog = realloc(BACKLOG, size * sizeof(*backlog));
+        if (!backlog) {
+            fprintf(stderr, "ydotoold: failed to allocate backlog, dropping frame\n");
+            return;
+        }
+        BACKLOG = backlog;
+        BACKLOG_SIZE = size;
+    }
+
+    BACKLOG[BACKLOG_TAIL].type = 0;
+    BACKLOG[BACKLOG_TAIL].code = 0;
+    BACKLOG[BACKLOG_TAIL].value = (int32_t)count;
+    memcpy(BACKLOG + BACKLOG_TAIL + 1, events, count * sizeof(*events));
+    BACKLOG_TAIL += count + 1;
+}
+
+/// Add a frame to the emission queue, or to the backlog behind frames already waiting for room
+/// @details Never waits, so that the event loop carries on with other clients and timers
+/// @param events Events of the frame
+/// @param count Number of events, at most FRAME_MAX_EVENTS
+void ydotoold_queue_push(const struct uinput_raw_data * events, size_t count) {
+    if (BACKLOG_HEAD != BACKLOG_TAIL) {
+        ydotoold_backlog_push(events, count);
+    } else if (ydotoold_queue_try_push(events, count)) {
+        atomic_fetch_add_explicit(&QUEUE_FULL, 1, memory_order_relaxed);
+        ydotoold_backlog_push(events, count);
+        ydotoold_backlog_drain();
+    }
+}
+
+/// Signal the event loop if it is waiting for room in the queue
+/// @details Called by the emitter thread after releasing slots
+void ydotoold_emitter_space() {
+    // Pairs with the fence in ydotoold_backlog_drain(): either the request or the room is seen
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&SPACE_WANTED, memory_order_relaxed) && atomic_exchange(&SPACE_WANTED, 0)) {
+        eventfd_write(FD_SPACE, 1);
+    }
+}
+
+/// Emitter thread: the only place events are written to the uinput device
+/// @details Drains as many queued frames as fit in one batch per write
+/// @param arg Unused
+/// @return NULL once stopped and the queue is empty
+void * ydotoold_emitter(void * arg) {
+    (void)arg;
+    struct uinput_raw_data batch[UINPUT_BATCH_SIZE];
+
+    for (;;) {
+        while (sem_wait(&QUEUE_SEM)) {}
+
+        size_t len = 0;
+        size_t tail = atomic_load_explicit(&QUEUE_TAIL, memory_order_relaxed);
+        for (;;) {
+            struct ydotoold_frame * frame = &QUEUE[tail & (QUEUE_SIZE - 1)];
+
+            // Producer may have claimed, but not yet filled, the slot. Once stopped every frame
+            // has been filled, and the post without a frame asks to exit
+            while (atomic_load_explicit(&frame->seq, memory_order_acquire) != tail + 1) {
+                if (atomic_load_explicit(&EMITTER_STOP, memory_order_acquire)) {
+                    uinput_emit_batch(batch, len);
+                    return NULL;
+                }
+                sched_yield();
+            }
+
+            if (len + frame->count > UINPUT_BATCH_SIZE) {
+                ydotoold_emitter_space();
+                uinput_emit_batch(batch, len);
+                len = 0;
+            }
+            memcpy(batch + len, frame->events, frame->count * sizeof(*batch));
+            len += frame->count;
+
+            atomic_store_explicit(&frame->seq, tail + QUEUE_SIZE, memory_order_release);
+            atomic_store_explicit(&QUEUE_TAIL, ++tail, memory_order_relaxed);
+
+            // Carry on while further frames are already queued
+            if (sem_trywait(&QUEUE_SEM)) {
+                break;
+            }
+        }
+
+        ydotoold_emitter_space();
+        uinput_emit_batch(batch, len);
+    }
+
+    return NULL;
+}
+
+/// Start the emitter thread
+/// @param priority SCHED_FIFO priority of the thread, or 0 for normal scheduling
+/// @param cpu CPU to pin the thread to, or -1 for no affinity
+/// @return 0 on success, 1 if error(s)
+int ydotoold_emitter_start(int priority, int cpu) {
+    for (size_t i = 0; i != QUEUE_SIZE; ++i) {
+        atomic_init(&QUEUE[i].seq, i);
+    }
+    if (sem_init(&QUEUE_SEM, 0, 0)) {
+        fprintf(stderr, "ydotoold: failed to create semaphore: %s\n", strerror(errno));
+        return 1;
+    }
+    FD_SPACE = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (FD_SPACE == -1) {
+        fprintf(stderr, "ydotoold: failed to create eventfd: %s\n", strerror(errno));
+        return 1;
+    }
+
+    pthread_t thd;
+    if (pthread_create(&thd, NULL, ydotoold_emitter, NULL)) {
+        fprintf(stderr, "ydotoold: Error creating emitter thread!\n");
+        return 1;
+    }
+    EMITTER = thd;
+
+    // Real time settings are best effort, the emitter works without them
+    if (priority) {
+        struct sched_param param = { .sched_priority = priority };
+        int rc = pthread_setschedparam(thd, SCHED_FIFO, &param);
+        if (rc) {
+            fprintf(stderr, "ydotoold: failed to set emitter priority %d: %s\n", priority, strerror(rc));
+        }
+    }
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t)cpu, &set);
+        int rc = pthread_setaffinity_np(thd, sizeof(set), &set);
+        if (rc) {
+            fprintf(stderr, "ydotoold: failed to pin emitter to CPU %d: %s\n", cpu, strerror(rc));
+        }
+    }
+
+    return 0;
+}
+
+/// Stop the emitter thread once it has emitted every frame, those kept back included
+/// @details Waits for room in the queue as long as need be, so only called by the event loop once
+/// nothing more is to be queued
+void ydotoold_emitter_stop() {
+    ydotoold_backlog_drain();
+    while (BACKLOG_HEAD != BACKLOG_TAIL) {
+        struct pollfd pfd = { FD_SPACE, POLLIN, 0 };
+        if (poll(&pfd, 1, -1) > 0) {
+            eventfd_t value;
+            eventfd_read(FD_SPACE, &value);
+        }
+        ydotoold_backlog_drain();
+    }
+
+    atomic_store_explicit(&EMITTER_STOP, 1, memory_order_release);
+    sem_post(&QUEUE_SEM);
+    pthread_join(EMITTER, NULL);
+}
+
+/// Size of the receive buffer held for each client connection
+#define CLIENT_BUF_SIZE 16384
+
+/// Maximum number of reads from one client per wakeup, so that one busy client can't starve the others
+#define CLIENT_MAX_READS 16
+
+/// Maximum number of epoll events handled per wakeup
+#define MAX_EPOLL_EVENTS 64
+
+/// @brief Kinds of file descriptor watched by the event loop
+enum ydotoold_watch_kind {
+    /// The listening socket
+    WATCH_LISTEN,
+    /// A client's socket
+    WATCH_CLIENT,
+    /// A client's shared memory ring eventfd
+    WATCH_RING,
+    /// The timerfd of the timer wheel
+    WATCH_TIMER,
+    /// The eventfd signalled when the emission queue has room for the backlog
+    WATCH_SPACE,
+};
+
+/// @brief Event loop registration, pointed to by the epoll data
+struct ydotoold_watch {
+    /// What the file descriptor is
+    enum ydotoold_watch_kind kind;
+    /// Client the file descriptor belongs to, if any
+    struct ydotoold_client * client;
+};
+
+/// @brief Frame being put together from events that may arrive in pieces
+struct ydotoold_framer {
+    /// Number of events of the frame so far
+    size_t len;
+    /// Non-zero once the frame has grown past FRAME_MAX_EVENTS, until its SYN_REPORT
+    int overflow;
+    /// Events of the frame so far
+    struct uinput_raw_data events[FRAME_MAX_EVENTS];
+};
+
+/// Maximum number of events a command is expanded into at once, before other work gets a turn
+#define JOB_CHUNK 1024
+
+/// @brief Kinds of command expanded into events a chunk at a time
+enum ydotoold_job_kind {
+    /// Typing a text
+    JOB_TYPE,
+    /// Repeating a sequence of events
+    JOB_REPEAT,
+};
+
+/// @brief A client's command being expanded into events, a chunk per step
+struct ydotoold_job {
+    /// What the command is
+    enum ydotoold_job_kind kind;
+    /// Typing state, for JOB_TYPE
+    struct uinput_typist typist;
+    /// Number of times the events are still to be entered, for JOB_REPEAT
+    uint32_t repeats;
+    /// Position reached in the text or events
+    size_t pos;
+    /// Length of the text in bytes, or number of events
+    size_t len;
+    /// Frame put together from the events of the current repeat
+    struct ydotoold_framer framer;
+    /// Text to type, stored after the job
+    char * text;
+    /// Events to repeat, stored after the job
+    struct uinput_raw_data * events;
+};
+
+/// @brief State of a single connected client
+struct ydotoold_client {
+    /// Socket file descriptor for the connection
+    int fd;
+    /// Event loop registration of the socket
+    struct ydotoold_watch watch;
+    /// Shared memory ring of events, if requested by the client
+    struct ydotool_ring * ring;
+    /// Number of event slots of the ring. The client can write the ring's header, so it is never read back
+    uint32_t ring_size;
+    /// Length of the ring's mapping in bytes
+    size_t ring_bytes;
+    /// eventfd signalled by the client when it writes to an idle ring
+    int fd_ring;
+    /// Event loop registration of the ring eventfd
+    struct ydotoold_watch watch_ring;
+    /// Next client closed during the current loop iteration
+    struct ydotoold_client * next_closed;
+    /// Non-zero while the socket is watched by the event loop
+    int armed;
+    /// Non-zero while the client is on the PENDING list
+    int pending;
+    /// Next client on the PENDING list
+    struct ydotoold_client * next_pending;
+    /// Command being expanded, anything sent after it waits until it is finished
+    struct ydotoold_job * job;
+    /// Protocol version spoken by the client, 0 until known
+    int proto;
+    /// CLOCK_MONOTONIC time in microseconds at which the client's last motion scheduled ends
+    uint64_t motion_end_us;
+    /// Latest deadline of the timed events handed over by the client
+    uint64_t due_us;
+    /// Keys of the main device the client's events leave pressed, one bit per key code
+    uint8_t keys[KEY_MAX / 8 + 1];
+    /// Non-zero once the client has hung up, whilst its ring and held back messages are finished
+    int hangup;
+    /// Frame the client's events are put together in, whether sent on the socket or the ring
+    struct ydotoold_framer framer;
+    /// Number of bytes received but not yet handled
+    size_t len;
+    /// Received data. Events are only emitted once their frame is complete
+    unsigned char buf[CLIENT_BUF_SIZE];
+};
+
+/// File decriptor for the epoll instance
+static int FD_EPOLL = -1;
+
+/// Event loop registration of the listening socket
+static struct ydotoold_watch WATCH_LIST = { WATCH_LISTEN, NULL };
+
+/// Clients closed during the current loop iteration, freed once it is over
+static struct ydotoold_client * CLOSED = NULL;
+
+/// Clients with work left over, carried on with once the backlog has gone into the queue
+static struct ydotoold_client * PENDING = NULL;
 
-    pthread_exit(NULL);
+/// Event loop registration of the emission queue's eventfd
+static struct ydotoold_watch WATCH_SPACEFD = { WATCH_SPACE, NULL };
+
+/// Maximum number of events taken from a ring at once
+#define RING_CHUNK 1024
+
+/// Maximum number of chunks taken from one ring per wakeup, so that one busy client can't starve the others
+#define RING_MAX_CHUNKS 16
+
+/// Absolute pointer position requested last, where absolute motion starts by default
+static int32_t POINTER_X = 0;
+static int32_t POINTER_Y = 0;
+
+/// Keep track of the absolute pointer position requested by the frames of a sequence of events
+/// @details Only frames of the absolute pointer device count, other devices have axes of their own
+/// @param events The events
+/// @param count Number of events
+void ydotoold_track_pointer(const struct uinput_raw_data * events, size_t count) {
+    int tablet = 0;
+    for (size_t i = 0; i != count; ++i) {
+        if (events[i].type == UINPUT_EV_DEVICE) {
+            tablet = events[i].value == UINPUT_DEVICE_TABLET;
+        } else if (events[i].type == EV_SYN && events[i].code == SYN_REPORT) {
+            tablet = 0;
+        } else if (tablet && events[i].type == EV_ABS && events[i].code == ABS_X) {
+            POINTER_X = events[i].value;
+        } else if (tablet && events[i].type == EV_ABS && events[i].code == ABS_Y) {
+            POINTER_Y = events[i].value;
+        }
+    }
+}
+
+/// Keep track of the keys of the main device a client's events leave pressed
+/// @details Only the main device autorepeats, so frames for other devices don't count
+/// @param client The client the events came from
+/// @param events The events (need not be aligned)
+/// @param count Number of events
+void ydotoold_client_keys(struct ydotoold_client * client, const void * events, size_t count) {
+    int other = 0;
+    for (size_t i = 0; i != count; ++i) {
+        struct uinput_raw_data event;
+        memcpy(&event, (const unsigned char *)events + i * sizeof(event), sizeof(event));
+        if (event.type == UINPUT_EV_DEVICE) {
+            other = event.value != UINPUT_DEVICE_MAIN;
+        } else if (event.type == EV_SYN && event.code == SYN_REPORT) {
+            other = 0;
+        } else if (!other && event.type == EV_KEY && event.code <= KEY_MAX) {
+            uint8_t bit = (uint8_t)(1 << (event.code % 8));
+            client->keys[event.code / 8] = (uint8_t)(event.value ? client->keys[event.code / 8] | bit : client->keys[event.code / 8] & ~bit);
+        }
+    }
+}
+
+/// Queue a whole frame for emission
+/// @param events Events of the frame
+/// @param count Number of events, at most FRAME_MAX_EVENTS
+void ydotoold_queue_frame(const struct uinput_raw_data * events, size_t count) {
+    // Only frames for other devices than the main one can move the absolute pointer
+    if (events[0].type == UINPUT_EV_DEVICE) {
+        ydotoold_track_pointer(events, count);
+    }
+    ydotoold_queue_push(events, count);
+}
+
+/// Queue the frames of a sequence of events for emission
+/// @details Frames are only queued whole, so events from different clients never interleave
+/// within a frame and a reader never sees part of one. Events after the last SYN_REPORT are kept
+/// in the framer until the rest of their frame arrives. Frames longer than FRAME_MAX_EVENTS
+/// are dropped
+/// @param framer The frame put together so far, from earlier events of the same source
+/// @param events The events to queue
+/// @param count Number of events
+void ydotoold_queue_frames(struct ydotoold_framer * framer, const struct uinput_raw_data * events, size_t count) {
+    size_t start = 0;
+    for (size_t i = 0; i != count; ++i) {
+        if (events[i].type != EV_SYN || events[i].code != SYN_REPORT) {
+            continue;
+        }
+
+        // Frames arriving whole are queued straight from the events
+        size_t len = i + 1 - start;
+        if (!framer->len && !framer->overflow && len <= FRAME_MAX_EVENTS) {
+            ydotoold_queue_frame(events + start, len);
+        } else if (!framer->overflow && framer->len + len <= FRAME_MAX_EVENTS) {
+            memcpy(framer->events + framer->len, events + start, len * sizeof(*events));
+            ydotoold_queue_frame(framer->events, framer->len + len);
+        } else {
+            fprintf(stderr, "ydotoold: dropping frame of more than %d events\n", FRAME_MAX_EVENTS);
+        }
+        framer->len = 0;
+        framer->overflow = 0;
+        start = i + 1;
+    }
+
+    // Keep the start of the next frame, as far as it fits
+    size_t len = count - start;
+    if (framer->overflow || framer->len + len > FRAME_MAX_EVENTS) {
+        framer->overflow = 1;
+        framer->len = 0;
+    } else {
+        memcpy(framer->events + framer->len, events + start, len * sizeof(*events));
+        framer->len += len;
+    }
+}
+
+/// Queue the events left in a framer after the last SYN_REPORT as a frame of their own
+/// @param framer The frame put together so far
+void ydotoold_queue_rest(struct ydotoold_framer * framer) {
+    if (framer->len && !framer->overflow) {
+        ydotoold_queue_frame(framer->events, framer->len);
+    }
+    framer->len = 0;
+    framer->overflow = 0;
+}
+
+/// Queue events expanded by the daemon itself, any events after the last SYN_REPORT as a frame
+/// @param events The events to queue, normally whole frames
+/// @param count Number of events
+void ydotoold_queue_events(const struct uinput_raw_data * events, size_t count) {
+    struct ydotoold_framer framer = { 0, 0, { { 0, 0, 0 } } };
+    ydotoold_queue_frames(&framer, events, count);
+    ydotoold_queue_rest(&framer);
+}
+
+/// Handle data received from a legacy client, a plain stream of events
+/// @param client The client to handle the data of
+/// @return Number of bytes handled
+size_t ydotoold_client_legacy(struct ydotoold_client * client) {
+    size_t count = client->len / sizeof(struct uinput_raw_data);
+    ydotoold_client_keys(client, client->buf, count);
+    ydotoold_queue_frames(&client->framer, (const struct uinput_raw_data *)client->buf, count);
+    return count * sizeof(struct uinput_raw_data);
+}
+
+/// Send the answer to a shared memory ring request
+/// @param client The client to answer
+/// @param size Number of event slots of the ring, or 0 if refused
+/// @param fd_mem memfd of the ring, only sent if size is not 0
+/// @return 0 on success, 1 if error(s)
+int ydotoold_send_ring(struct ydotoold_client * client, uint32_t size, int fd_mem) {
+    struct ydotool_msg_header header = { YDOTOOL_MSG_SHM, 0, size };
+    struct iovec iov = { &header, sizeof(header) };
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (size) {
+        int fds[2] = { fd_mem, client->fd_ring };
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    }
+
+    if (sendmsg(client->fd, &msg, MSG_NOSIGNAL) != sizeof(header)) {
+        fprintf(stderr, "ydotoold: failed to answer ring request: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/// Create a shared memory ring for a client and pass it over
+/// @details The ring lives in a memfd mapped by both processes. The client signals an eventfd,
+/// watched by the event loop, whenever it writes to a ring the daemon has stopped reading
+/// @param client The client requesting the ring
+/// @param size Number of event slots wanted, 0 for default
+/// @return 0 on success (including a refused request), 1 if error(s)
+int ydotoold_client_ring(struct ydotoold_client * client, uint32_t size) {
+    if (client->ring) {
+        return ydotoold_send_ring(client, 0, -1);
+    }
+
+    // Round up to a power of two
+    uint32_t slots = YDOTOOL_RING_DEFAULT_SIZE;
+    if (size) {
+        slots = 1;
+        while (slots < size && slots < YDOTOOL_RING_MAX_SIZE) {
+            slots <<= 1;
+        }
+    }
+    size_t bytes = ydotool_ring_bytes(slots);
+
+    int fd_mem = memfd_create("ydotool_ring", MFD_CLOEXEC);
+    if (fd_mem == -1 || ftruncate(fd_mem, (off_t)bytes)) {
+        fprintf(stderr, "ydotoold: failed to create ring memory: %s\n", strerror(errno));
+        if (fd_mem != -1) {
+            close(fd_mem);
+        }
+        return ydotoold_send_ring(client, 0, -1);
+    }
+
+    void * mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_mem, 0);
+    client->fd_ring = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = { EPOLLIN, { .ptr = &client->watch_ring } };
+    if (mem == MAP_FAILED || client->fd_ring == -1 || epoll_ctl(FD_EPOLL, EPOLL_CTL_ADD, client->fd_ring, &ev)) {
+        fprintf(stderr, "ydotoold: failed to set up ring: %s\n", strerror(errno));
+        if (mem != MAP_FAILED) {
+            munmap(mem, bytes);
+        }
+        if (client->fd_ring != -1) {
+            close(client->fd_ring);
+            client->fd_ring = -1;
+        }
+        close(fd_mem);
+        return ydotoold_send_ring(client, 0, -1);
+    }
+
+    client->ring = mem;
+    client->ring_size = slots;
+    client->ring_bytes = bytes;
+    ydotool_ring_init(client->ring, slots);
+
+    // The memfd itself is no longer needed once mapped and passed over
+    int ret = ydotoold_send_ring(client, slots, fd_mem);
+    close(fd_mem);
+    return ret;
+}
+
+/// Queue the frames written to a client's shared memory ring
+/// @details Stops after RING_MAX_CHUNKS, or once frames are kept back in the backlog, so that a
+/// client that never stops writing can't hold up the event loop
+/// @param client The client whose ring has been signalled
+/// @return 0 if the ring has been emptied, 1 if events are left for later
+int ydotoold_ring_handler(struct ydotoold_client * client) {
+    struct uinput_raw_data events[RING_CHUNK];
+    for (int i = 0; i != RING_MAX_CHUNKS; ++i) {
+        if (BACKLOG_HEAD != BACKLOG_TAIL) {
+            return 1;
+        }
+
+        size_t count = ydotool_ring_peek(client->ring, client->ring_size, events, RING_CHUNK);
+        if (!count) {
+            // Ring empty, only stop once the client knows to signal us
+            if (ydotool_ring_sleep(client->ring)) {
+                continue;
+            }
+            return 0;
+        }
+
+        // A partial frame waits in the framer for the rest of it
+        ydotoold_client_keys(client, events, count);
+        ydotoold_queue_frames(&client->framer, events, count);
+        ydotool_ring_advance(client->ring, count);
+    }
+    return 1;
+}
+
+/// Batch output for commands expanded by the daemon, queueing the events for the emitter thread
+/// @param events The events to queue
+/// @param count Number of events
+/// @return 0
+int ydotoold_emit(const struct uinput_raw_data * events, size_t count) {
+    ydotoold_queue_events(events, count);
+    return 0;
+}
+
+/// Start a client's command, expanded a chunk at a time by ydotoold_job_step()
+/// @param client The client sending the command
+/// @param kind What the command is
+/// @param bytes Size of the text or events stored with the job
+/// @return The job, to be filled in by the caller, or NULL if error(s)
+struct ydotoold_job * ydotoold_job_start(struct ydotoold_client * client, enum ydotoold_job_kind kind, size_t bytes) {
+    struct ydotoold_job * job = malloc(sizeof(*job) + bytes);
+    if (!job) {
+        fprintf(stderr, "ydotoold: failed to allocate command\n");
+        return NULL;
+    }
+    job->kind = kind;
+    uinput_typist_init(&job->typist, 0);
+    job->repeats = 0;
+    job->pos = 0;
+    job->len = 0;
+    job->framer.len = 0;
+    job->framer.overflow = 0;
+    job->text = (char *)(job + 1);
+    job->events = (struct uinput_raw_data *)(job + 1);
+    client->job = job;
+    return job;
+}
+
+/// Queue the next chunk of events of a client's command
+/// @details At most JOB_CHUNK events are queued per step, so that however long the command the
+/// event loop gets back to other clients, and the backlog stays small when the queue is full
+/// @param client The client whose command is being expanded
+/// @return 0 once the command is finished, 1 if there is more to come
+int ydotoold_job_step(struct ydotoold_client * client) {
+    struct ydotoold_job * job = client->job;
+    if (job->kind == JOB_TYPE) {
+        struct uinput_raw_data events[JOB_CHUNK];
+        size_t used;
+        size_t count = uinput_typist_events(&job->typist, job->text + job->pos, job->len - job->pos, events, JOB_CHUNK, &used);
+        ydotoold_client_keys(client, events, count);
+        ydotoold_queue_events(events, count);
+        job->pos += used;
+        if (job->pos != job->len) {
+            return 1;
+        }
+
+        // Release Shift if the last character left it held
+        struct uinput_batch batch;
+        uinput_batch_init(&batch);
+        batch.emit = ydotoold_emit;
+        uinput_batch_type_end(&batch, &job->typist);
+        ydotoold_client_keys(client, batch.events, batch.len);
+        uinput_batch_flush(&batch);
+        return 0;
+    }
+
+    for (size_t done = 0; done < JOB_CHUNK && job->repeats; ) {
+        size_t count = job->len - job->pos;
+        if (count > JOB_CHUNK - done) {
+            count = JOB_CHUNK - done;
+        }
+        ydotoold_client_keys(client, job->events + job->pos, count);
+        ydotoold_queue_frames(&job->framer, job->events + job->pos, count);
+        job->pos += count;
+        done += count;
+
+        // Each repeat ends its frames, as if queued on its own
+        if (job->pos == job->len) {
+            ydotoold_queue_rest(&job->framer);
+            job->pos = 0;
+            --job->repeats;
+        }
+    }
+    return job->repeats != 0;
+}
+
+/// Start typing text sent by a client
+/// @param client The client sending the text
+/// @param text The characters to type
+/// @param len Number of characters
+void ydotoold_type(struct ydotoold_client * client, const char * text, size_t len) {
+    if (!len || uinput_check_text(text, len)) {
+        return;
+    }
+
+    struct ydotoold_job * job = ydotoold_job_start(client, JOB_TYPE, len);
+    if (job) {
+        memcpy(job->text, text, len);
+        job->len = len;
+    }
+}
+
+/// Start entering key sequences sent by a client
+/// @param client The client sending the key sequences
+/// @param payload struct ydotool_msg_key followed by NUL terminated key sequences
+/// @param len Length of the payload in bytes
+void ydotoold_key(struct ydotoold_client * client, const unsigned char * payload, size_t len) {
+    struct ydotool_msg_key key;
+    if (len < sizeof(key) || payload[len - 1] != '\0') {
+        fprintf(stderr, "ydotoold: malformed key message\n");
+        return;
+    }
+    memcpy(&key, payload, sizeof(key));
+
+    // Sequences are parsed once, however many times they are repeated
+    const char * sequences = (const char *)payload + sizeof(key);
+    const char * end = (const char *)payload + len;
+    size_t count = 0;
+    for (const char * sequence = sequences; sequence != end; sequence += strlen(sequence) + 1) {
+        ++count;
+    }
+    struct uinput_chord * chords = malloc(count * sizeof(*chords));
+    if (count && !chords) {
+        fprintf(stderr, "ydotoold: failed to allocate %zu key sequences\n", count);
+        return;
+    }
+    size_t i = 0;
+    size_t events = 0;
+    for (const char * sequence = sequences; sequence != end; sequence += strlen(sequence) + 1) {
+        if (uinput_chord_compile(&chords[i], sequence)) {
+            while (i) {
+                uinput_chord_free(&chords[--i]);
+            }
+            free(chords);
+            return;
+        }
+        events += chords[i++].len;
+    }
+
+    // The repeats are entered a chunk at a time from one copy of the chords' events
+    struct ydotoold_job * job = events && key.repeats ? ydotoold_job_start(client, JOB_REPEAT, events * sizeof(struct uinput_raw_data)) : NULL;
+    if (job) {
+        for (i = 0; i != count; ++i) {
+            memcpy(job->events + job->len, chords[i].events, chords[i].len * sizeof(struct uinput_raw_data));
+            job->len += chords[i].len;
+        }
+        job->repeats = key.repeats;
+    }
+    for (i = 0; i != count; ++i) {
+        uinput_chord_free(&chords[i]);
+    }
+    free(chords);
+}
+
+/// Click a mouse button for a client
+/// @param button 1: left, 2: right, 3: middle
+void ydotoold_click(uint16_t button) {
+    uint16_t keycode;
+    if (uinput_button_to_keycode(button, &keycode)) {
+        return;
+    }
+
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    batch.emit = ydotoold_emit;
+    uinput_batch_keypress(&batch, keycode);
+    uinput_batch_flush(&batch);
+}
+
+/// Maximum number of macros held by the daemon
+#define MAX_MACROS 256
+
+/// Maximum number of events in a single macro
+#define MACRO_MAX_EVENTS (1 << 16)
+
+/// Maximum number of events in all macros together
+#define MACROS_MAX_EVENTS (1 << 20)
+
+/// @brief A named, pre-expanded sequence of events
+struct ydotoold_macro {
+    /// Name the macro was defined with, empty if the slot is free
+    char name[YDOTOOL_MACRO_NAME_LEN];
+    /// Events of the macro
+    struct uinput_raw_data * events;
+    /// Number of events
+    size_t count;
+};
+
+/// Macros defined by clients, indexed by ID
+static struct ydotoold_macro MACROS[MAX_MACROS];
+
+/// Number of events in all macros together
+static size_t MACROS_EVENTS = 0;
+
+/// Look up a macro by name
+/// @param name Name of the macro
+/// @return ID of the macro, or YDOTOOL_MACRO_NONE if not defined
+uint32_t ydotoold_macro_find(const char * name) {
+    for (uint32_t id = 0; id != MAX_MACROS; ++id) {
+        if (MACROS[id].name[0] && !strcmp(MACROS[id].name, name)) {
+            return id;
+        }
+    }
+    return YDOTOOL_MACRO_NONE;
+}
+
+/// Forget a macro, freeing its slot
+/// @param id ID of the macro
+void ydotoold_macro_free(uint32_t id) {
+    struct ydotoold_macro * macro = &MACROS[id];
+    MACROS_EVENTS -= macro->count;
+    free(macro->events);
+    memset(macro, 0, sizeof(*macro));
+}
+
+/// Forget a macro by name
+/// @param payload NUL terminated name
+/// @param len Length of the payload in bytes
+/// @return ID the macro had, or YDOTOOL_MACRO_NONE if not defined
+uint32_t ydotoold_macro_undefine(const unsigned char * payload, size_t len) {
+    size_t name_len = strnlen((const char *)payload, len);
+    uint32_t id = name_len < len ? ydotoold_macro_find((const char *)payload) : YDOTOOL_MACRO_NONE;
+    if (id == YDOTOOL_MACRO_NONE) {
+        fprintf(stderr, "ydotoold: no such macro\n");
+        return YDOTOOL_MACRO_NONE;
+    }
+
+    ydotoold_macro_free(id);
+    printf("ydotoold: macro #%" PRIu32 " undefined\n", id);
+    return id;
+}
+
+/// Define (or add to) a macro
+/// @details A macro growing beyond MACRO_MAX_EVENTS, or all macros beyond MACROS_MAX_EVENTS, is
+/// refused and forgotten, so that clients can't take up the daemon's memory without bound
+/// @param arg YDOTOOL_MACRO_APPEND to add to an existing macro, 0 to replace it
+/// @param payload NUL terminated name followed by the events
+/// @param len Length of the payload in bytes
+/// @return ID of the macro, or YDOTOOL_MACRO_NONE on failure
+uint32_t ydotoold_macro_define(uint16_t arg, const unsigned char * payload, size_t len) {
+    size_t name_len = strnlen((const char *)payload, len);
+    if (name_len == len || name_len == 0 || name_len >= YDOTOOL_MACRO_NAME_LEN
+            || (len - name_len - 1) % sizeof(struct uinput_raw_data)) {
+        fprintf(stderr, "ydotoold: malformed macro definition\n");
+        return YDOTOOL_MACRO_NONE;
+    }
+    const char * name = (const char *)payload;
+    size_t count = (len - name_len - 1) / sizeof(struct uinput_raw_data);
+
+    // Existing macro, or first free slot
+    uint32_t id = ydotoold_macro_find(name);
+    if (id == YDOTOOL_MACRO_NONE) {
+        for (id = 0; id != MAX_MACROS && MACROS[id].name[0]; ++id) {}
+        if (id == MAX_MACROS) {
+            fprintf(stderr, "ydotoold: no room for macro %s\n", name);
+            return YDOTOOL_MACRO_NONE;
+        }
+        memcpy(MACROS[id].name, name, name_len + 1);
+    }
+    struct ydotoold_macro * macro = &MACROS[id];
+    if (arg != YDOTOOL_MACRO_APPEND) {
+        MACROS_EVENTS -= macro->count;
+        macro->count = 0;
+    }
+    if (macro->count + count > MACRO_MAX_EVENTS || MACROS_EVENTS + count > MACROS_MAX_EVENTS) {
+        fprintf(stderr, "ydotoold: macro %s too long, forgetting it\n", name);
+        ydotoold_macro_free(id);
+        return YDOTOOL_MACRO_NONE;
+    }
+
+    // Extra byte so that an empty macro still has an allocation
+    struct uinput_raw_data * events = realloc(macro->events, (macro->count + count) * sizeof(*events) + 1);
+    if (!events) {
+        fprintf(stderr, "ydotoold: failed to allocate macro %s\n", name);
+        return YDOTOOL_MACRO_NONE;
+    }
+    memcpy(events + macro->count, payload + name_len + 1, count * sizeof(*events));
+    macro->events = events;
+    macro->count += count;
+    MACROS_EVENTS += count;
+
+    printf("ydotoold: macro %s defined as #%" PRIu32 " (%zu events)\n", name, id, macro->count);
+    return id;
+}
+
+/// Start running a macro for a client
+/// @param client The client running the macro
+/// @param payload struct ydotool_msg_macro_run, followed by the name if looking up by name
+/// @param len Length of the payload in bytes
+void ydotoold_macro_run(struct ydotoold_client * client, const unsigned char * payload, size_t len) {
+    struct ydotool_msg_macro_run run;
+    if (len < sizeof(run)) {
+        fprintf(stderr, "ydotoold: malformed macro run message\n");
+        return;
+    }
+    memcpy(&run, payload, sizeof(run));
+
+    uint32_t id = run.id;
+    if (id == YDOTOOL_MACRO_NONE) {
+        char name[YDOTOOL_MACRO_NAME_LEN] = "";
+        size_t name_len = len - sizeof(run);
+        if (name_len && name_len <= sizeof(name)) {
+            memcpy(name, payload + sizeof(run), name_len);
+            name[name_len - 1] = '\0';
+        }
+        id = ydotoold_macro_find(name);
+    }
+    if (id >= MAX_MACROS || !MACROS[id].name[0]) {
+        fprintf(stderr, "ydotoold: no such macro\n");
+        return;
+    }
+
+    // The job has its own copy, so the macro can be redefined whilst it runs
+    const struct ydotoold_macro * macro = &MACROS[id];
+    struct ydotoold_job * job = macro->count && run.repeats ? ydotoold_job_start(client, JOB_REPEAT, macro->count * sizeof(*macro->events)) : NULL;
+    if (job) {
+        memcpy(job->events, macro->events, macro->count * sizeof(*macro->events));
+        job->len = macro->count;
+        job->repeats = run.repeats;
+    }
+}
+
+/// Maximum number of events waiting in the timer wheel
+#define WHEEL_MAX_EVENTS (1 << 20)
+
+/// Furthest ahead of the present a client's timed events may be due, so that events for the
+/// distant future can't fill the wheel for everybody else. Clients hand events over
+/// milliseconds before they are due
+#define TIMED_HORIZON_US YDOTOOL_TIMED_HORIZON_US
+
+/// Timed events waiting to be emitted
+static struct ydotool_wheel WHEEL;
+
+/// Deadline the timerfd is armed for, 0 if disarmed
+static uint64_t WHEEL_ARMED_US = 0;
+
+/// timerfd firing at the earliest deadline in the wheel
+static int FD_TIMER = -1;
+
+/// Event loop registration of the timerfd
+static struct ydotoold_watch WATCH_TIMERFD = { WATCH_TIMER, NULL };
+
+/// Arm the timerfd for the earliest deadline in the wheel, or disarm it if the wheel is empty
+void ydotoold_timer_arm() {
+    uint64_t armed = ydotool_wheel_next(&WHEEL);
+    if (armed == WHEEL_ARMED_US) {
+        return;
+    }
+    WHEEL_ARMED_US = armed;
+
+    // A zero it_value disarms the timer, so deadlines are at least 1us
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(armed / 1000000);
+    spec.it_value.tv_nsec = (long)(armed % 1000000) * 1000;
+    timerfd_settime(FD_TIMER, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/// Queue the frames of all timers whose deadline has passed, in deadline order
+void ydotoold_timer_dispatch() {
+    uint64_t now = uinput_now_us();
+    struct ydotool_timer * timer;
+    while ((timer = ydotool_wheel_pop(&WHEEL, now))) {
+        uint64_t late = now - timer->time_us;
+        TIMER_DISPATCHED++;
+        TIMER_LATE_TOTAL_US += late;
+        if (late > TIMER_LATE_MAX_US) {
+            TIMER_LATE_MAX_US = late;
+        }
+
+        // The position was tracked when the timer was added, later timers may have moved it on
+        int32_t x = POINTER_X;
+        int32_t y = POINTER_Y;
+        ydotoold_queue_events(timer->events, timer->count);
+        POINTER_X = x;
+        POINTER_Y = y;
+        free(timer);
+    }
+
+    ydotoold_timer_arm();
+}
+
+/// Queue the frames of all timers at once, in deadline order, so that no sequence is cut short
+void ydotoold_timer_flush() {
+    struct ydotool_timer * timer;
+    while ((timer = ydotool_wheel_pop(&WHEEL, UINT64_MAX))) {
+        ydotoold_queue_events(timer->events, timer->count);
+        free(timer);
+    }
+}
+
+/// Put timed events into the timer wheel
+/// @details The timerfd is re-armed if need be, but nothing is dispatched
+/// @param time_us CLOCK_MONOTONIC time in microseconds at which the events are due
+/// @param events The events, made up of whole frames (need not be aligned)
+/// @param count Number of events
+/// @return 0 on success, 1 if error(s)
+int ydotoold_timer_add(uint64_t time_us, const void * events, size_t count) {
+    if (WHEEL.events + count > WHEEL_MAX_EVENTS) {
+        fprintf(stderr, "ydotoold: too many timed events waiting, dropping %zu\n", count);
+        return 1;
+    }
+
+    struct ydotool_timer * timer = ydotool_wheel_add(&WHEEL, time_us ? time_us : 1, uinput_now_us(), events, count);
+    if (!timer) {
+        fprintf(stderr, "ydotoold: failed to allocate timed events\n");
+        return 1;
+    }
+    ydotoold_track_pointer(timer->events, count);
+
+    if (!WHEEL_ARMED_US || timer->time_us < WHEEL_ARMED_US) {
+        ydotoold_timer_arm();
+    }
+    return 0;
+}
+
+/// Put timed events sent by a client into the timer wheel
+/// @param client The client the events came from
+/// @param payload struct ydotool_msg_time followed by the events
+/// @param len Length of the payload in bytes
+void ydotoold_timed(struct ydotoold_client * client, const unsigned char * payload, size_t len) {
+    struct ydotool_msg_time when;
+    if (len < sizeof(when) || (len - sizeof(when)) % sizeof(struct uinput_raw_data)) {
+        fprintf(stderr, "ydotoold: malformed timed events message\n");
+        return;
+    }
+    memcpy(&when, payload, sizeof(when));
+    size_t count = (len - sizeof(when)) / sizeof(struct uinput_raw_data);
+    uint64_t now = uinput_now_us();
+    if (!count) {
+        return;
+    }
+    if (when.time_us > now + TIMED_HORIZON_US) {
+        fprintf(stderr, "ydotoold: timed events due more than %ds ahead, dropping %zu\n", TIMED_HORIZON_US / 1000000, count);
+        return;
+    }
+    if (ydotoold_timer_add(when.time_us, payload + sizeof(when), count)) {
+        return;
+    }
+    ydotoold_client_keys(client, payload + sizeof(when), count);
+    if (when.time_us > client->due_us) {
+        client->due_us = when.time_us;
+    }
+    if (when.time_us <= now) {
+        ydotoold_timer_dispatch();
+    }
+}
+
+/// Expand a pointer motion sent by a client into timed frames, one per step
+/// @details Motion ending beyond TIMED_HORIZON_US is dropped, as timed events are
+/// @param client The client the motion came from
+/// @param payload struct uinput_motion
+/// @param len Length of the payload in bytes
+void ydotoold_motion(struct ydotoold_client * client, const unsigned char * payload, size_t len) {
+    struct uinput_motion motion;
+    if (len != sizeof(motion)) {
+        fprintf(stderr, "ydotoold: malformed motion message\n");
+        return;
+    }
+    memcpy(&motion, payload, sizeof(motion));
+    if (!motion.rate_hz) {
+        fprintf(stderr, "ydotoold: malformed motion message\n");
+        return;
+    }
+
+    // Absolute motion carries on from where the pointer was last put, including by earlier motion
+    if (motion.flags & UINPUT_MOTION_RELATIVE) {
+        motion.from_x = 0;
+        motion.from_y = 0;
+    } else if (!(motion.flags & UINPUT_MOTION_FROM)) {
+        motion.from_x = POINTER_X;
+        motion.from_y = POINTER_Y;
+    }
+
+    // Each step is one frame: REL_X, REL_Y and SYN, or for the absolute pointer the device too
+    uint32_t steps = uinput_motion_steps(&motion);
+    size_t step_events = motion.flags & UINPUT_MOTION_RELATIVE ? 3 : 4;
+    if (WHEEL.events + ((size_t)steps + 1) * step_events > WHEEL_MAX_EVENTS) {
+        fprintf(stderr, "ydotoold: too many timed events waiting, dropping motion of %" PRIu32 " steps\n", steps);
+        return;
+    }
+
+    // Motion follows on from the client's earlier motion, as it would if the client expanded it itself
+    uint64_t now = uinput_now_us();
+    uint64_t start_us = client->motion_end_us > now ? client->motion_end_us : now;
+    uint64_t end_us = start_us + (uint64_t)motion.duration_ms * 1000;
+    if (end_us > now + TIMED_HORIZON_US) {
+        fprintf(stderr, "ydotoold: motion ending more than %ds ahead, dropping it\n", TIMED_HORIZON_US / 1000000);
+        return;
+    }
+
+    // The batch only collects each step's frame, it is never flushed
+    struct uinput_batch batch;
+    uinput_batch_init(&batch);
+    int32_t x = motion.from_x;
+    int32_t y = motion.from_y;
+    for (uint64_t step = 0; step <= steps; ++step) {
+        batch.len = 0;
+        uinput_batch_motion_step(&batch, &motion, (uint32_t)step, &x, &y);
+        if (batch.len && ydotoold_timer_add(start_us + (uint64_t)motion.duration_ms * 1000 * step / steps, batch.events, batch.len)) {
+            break;
+        }
+        // Later motion only waits for this one once all of it is scheduled
+        if (step == steps) {
+            client->motion_end_us = end_us;
+        }
+    }
+
+    // The start may be due straight away
+    if (start_us <= uinput_now_us()) {
+        ydotoold_timer_dispatch();
+    }
+}
+
+/// Size of the payload following a message header
+/// @param header The message header
+/// @return Payload size in bytes
+size_t ydotoold_payload_size(const struct ydotool_msg_header * header) {
+    switch (header->kind) {
+        case YDOTOOL_MSG_EVENTS:
+            return header->count * sizeof(struct uinput_raw_data);
+        case YDOTOOL_MSG_SHM:
+        case YDOTOOL_MSG_CLICK:
+            return 0;
+        default:
+            return header->count;
+    }
+}
+
+/// Handle all complete messages received from a version 2 client
+/// @param client The client to handle the messages of
+/// @param [out] used Number of bytes handled
+/// @return 0 on success, 1 if the client broke the protocol
+int ydotoold_client_messages(struct ydotoold_client * client, size_t * used) {
+    *used = 0;
+    while (client->len - *used >= sizeof(struct ydotool_msg_header)) {
+        struct ydotool_msg_header header;
+        memcpy(&header, client->buf + *used, sizeof(header));
+        const unsigned char * payload = client->buf + *used + sizeof(header);
+        size_t available = client->len - *used - sizeof(header);
+
+        size_t size = ydotoold_payload_size(&header);
+        if (size > YDOTOOL_MSG_MAX_PAYLOAD) {
+            fprintf(stderr, "ydotoold: message of %zu bytes too long\n", size);
+            return 1;
+        }
+        if (available < size) {
+            return 0;
+        }
+
+        // Messages wait behind a command being expanded, and for the emitter to catch up
+        if (client->job || BACKLOG_HEAD != BACKLOG_TAIL) {
+            return 0;
+        }
+
+        // Keep events written to the ring ahead of anything sent since. Messages wait for the
+        // ring to be emptied on later wakeups
+        if (client->ring && header.kind != YDOTOOL_MSG_EVENTS && ydotoold_ring_handler(client)) {
+            return 0;
+        }
+
+        switch (header.kind) {
+            case YDOTOOL_MSG_EVENTS:
+                ydotoold_client_keys(client, payload, header.count);
+                ydotoold_queue_frames(&client->framer, (const struct uinput_raw_data *)payload, header.count);
+                break;
+            case YDOTOOL_MSG_SHM:
+                if (ydotoold_client_ring(client, header.count)) {
+                    return 1;
+                }
+                break;
+            case YDOTOOL_MSG_TYPE:
+                ydotoold_type(client, (const char *)payload, size);
+                break;
+            case YDOTOOL_MSG_KEY:
+                ydotoold_key(client, payload, size);
+                break;
+            case YDOTOOL_MSG_CLICK:
+                ydotoold_click(header.arg);
+                break;
+            case YDOTOOL_MSG_MACRO_DEFINE:
+            case YDOTOOL_MSG_MACRO_UNDEFINE: {
+                uint32_t id = header.kind == YDOTOOL_MSG_MACRO_DEFINE
+                    ? ydotoold_macro_define(header.arg, payload, size)
+                    : ydotoold_macro_undefine(payload, size);
+                struct ydotool_msg_header answer = { YDOTOOL_MSG_MACRO_ID, 0, id };
+                if (send(client->fd, &answer, sizeof(answer), MSG_NOSIGNAL) != sizeof(answer)) {
+                    return 1;
+                }
+                break;
+            }
+            case YDOTOOL_MSG_MACRO_RUN:
+                ydotoold_macro_run(client, payload, size);
+                break;
+            case YDOTOOL_MSG_TIMED_EVENTS:
+                ydotoold_timed(client, payload, size);
+                break;
+            case YDOTOOL_MSG_MOTION:
+                ydotoold_motion(client, payload, size);
+                break;
+            default:
+                fprintf(stderr, "ydotoold: unknown message kind %" PRIu16 "\n", header.kind);
+                return 1;
+        }
+
+        *used += sizeof(header) + size;
+    }
+    return 0;
+}
+
+/// Handle the data received from a client
+/// @details The protocol version is detected from the first data received
+/// @param client The client to handle the data of
+/// @return 0 on success, 1 if the connection should be closed
+int ydotoold_client_process(struct ydotoold_client * client) {
+    if (!client->proto) {
+        struct ydotool_hello hello;
+        if (client->len < sizeof(hello.magic)) {
+            return 0;
+        }
+        memcpy(&hello.magic, client->buf, sizeof(hello.magic));
+        if (hello.magic != YDOTOOL_PROTOCOL_MAGIC) {
+            client->proto = 1;
+        } else if (client->len < sizeof(hello)) {
+            return 0;
+        } else {
+            memcpy(&hello, client->buf, sizeof(hello));
+            client->proto = hello.version < YDOTOOL_PROTOCOL_VERSION ? (int)hello.version : YDOTOOL_PROTOCOL_VERSION;
+            if (client->proto < 2) {
+                return 1;
+            }
+
+            client->len -= sizeof(hello);
+            memmove(client->buf, client->buf + sizeof(hello), client->len);
+        }
+    }
+
+    size_t used = 0;
+    if (client->proto == 1) {
+        used = ydotoold_client_legacy(client);
+    } else if (ydotoold_client_messages(client, &used)) {
+        return 1;
+    }
+
+    // Keep hold of the remainder (partial frame, event or message)
+    memmove(client->buf, client->buf + used, client->len - used);
+    client->len -= used;
+    return 0;
+}
+
+/// Start or stop watching a client's socket
+/// @details Clients with work left over aren't watched, so that neither unread data nor a hang up
+/// wakes the event loop over and over until the work is done
+/// @param client The client
+/// @param armed Non-zero to watch the socket
+void ydotoold_client_watch(struct ydotoold_client * client, int armed) {
+    if (client->armed == armed) {
+        return;
+    }
+    struct epoll_event ev = { EPOLLIN, { .ptr = &client->watch } };
+    epoll_ctl(FD_EPOLL, armed ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, client->fd, &ev);
+    client->armed = armed;
+}
+
+/// Put a client on the PENDING list, unless already there
+/// @param client The client with work left over
+void ydotoold_client_pend(struct ydotoold_client * client) {
+    if (!client->pending) {
+        client->pending = 1;
+        client->next_pending = PENDING;
+        PENDING = client;
+    }
+}
+
+/// Release the keys a client's events have left pressed, so that a client going away mid-hold
+/// can't leave a key autorepeating for good
+/// @details The releases are due with the client's last timed events, so that they never
+/// overtake a press still waiting in the timer wheel
+/// @param client The client going away
+void ydotoold_client_release(struct ydotoold_client * client) {
+    struct uinput_raw_data events[2 * (KEY_MAX + 1)];
+    size_t count = 0;
+    for (uint16_t code = 0; code <= KEY_MAX; ++code) {
+        if ((client->keys[code / 8] >> (code % 8)) & 1) {
+            events[count++] = (struct uinput_raw_data){ EV_KEY, code, 0 };
+            events[count++] = (struct uinput_raw_data){ EV_SYN, SYN_REPORT, 0 };
+        }
+    }
+    if (!count) {
+        return;
+    }
+
+    printf("ydotoold: releasing %zu keys left pressed\n", count / 2);
+    if (client->due_us <= uinput_now_us() || ydotoold_timer_add(client->due_us, events, count)) {
+        ydotoold_queue_events(events, count);
+    }
+}
+
+/// Close a client connection, its state is freed at the end of the loop iteration
+/// @param client The client to be closed
+void ydotoold_client_close(struct ydotoold_client * client) {
+    printf("ydotoold: client disconnected\n");
+    ydotoold_client_release(client);
+    ydotoold_client_watch(client, 0);
+    close(client->fd);
+
+    if (client->ring) {
+        epoll_ctl(FD_EPOLL, EPOLL_CTL_DEL, client->fd_ring, NULL);
+        close(client->fd_ring);
+        munmap(client->ring, client->ring_bytes);
+        client->ring = NULL;
+    }
+    free(client->job);
+    client->job = NULL;
+
+    if (client->pending) {
+        struct ydotoold_client ** pending = &PENDING;
+        while (*pending != client) {
+            pending = &(*pending)->next_pending;
+        }
+        *pending = client->next_pending;
+        client->pending = 0;
+    }
+
+    // Other events for this client may still be pending in this loop iteration
+    client->fd = -1;
+    client->next_closed = CLOSED;
+    CLOSED = client;
+}
+
+/// Carry on with a client's work as far as it goes without waiting, in a bounded number of steps
+/// @details Everything a client sends is emitted in order: a command being expanded goes before
+/// anything sent after it, and the ring is emptied before messages are handled. Nothing more is
+/// produced whilst frames are kept back in the backlog. Work left over puts the client on the
+/// PENDING list, and its socket is only read from once there is nothing else to do
+/// @param client The client to carry on with
+void ydotoold_client_pump(struct ydotoold_client * client) {
+    // Timed events whose deadline has passed go ahead of anything received since, even if the
+    // timerfd hasn't been read yet
+    if (WHEEL_ARMED_US && WHEEL_ARMED_US <= uinput_now_us()) {
+        ydotoold_timer_dispatch();
+    }
+
+    for (int i = 0; i != CLIENT_MAX_READS; ++i) {
+        if (BACKLOG_HEAD != BACKLOG_TAIL) {
+            break;
+        }
+        if (client->job) {
+            if (!ydotoold_job_step(client)) {
+                free(client->job);
+                client->job = NULL;
+            }
+            continue;
+        }
+        if (client->ring && ydotoold_ring_handler(client)) {
+            continue;
+        }
+        if (client->len) {
+            if (ydotoold_client_process(client)) {
+                ydotoold_client_close(client);
+                return;
+            }
+            if (client->job || BACKLOG_HEAD != BACKLOG_TAIL) {
+                continue;
+            }
+        }
+
+        // Finish the ring and the messages held back before closing
+        if (client->hangup || client->len == sizeof(client->buf)) {
+            ydotoold_client_close(client);
+            return;
+        }
+
+        ssize_t rc = recv(client->fd, client->buf + client->len, sizeof(client->buf) - client->len, 0);
+
+        if (rc == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rc == -1 && errno == EAGAIN) {
+            ydotoold_client_watch(client, 1);
+            return;
+        }
+        if (rc == 0) {
+            ydotoold_client_watch(client, 0);
+            client->hangup = 1;
+            continue;
+        }
+        if (rc < 0) {
+            ydotoold_client_close(client);
+            return;
+        }
+        client->len += (size_t)rc;
+    }
+
+    ydotoold_client_watch(client, 0);
+    ydotoold_client_pend(client);
+}
+
+/// Accept all pending connections on the listening socket
+/// @return 0 on success, 1 if error(s)
+int ydotoold_accept() {
+    for (;;) {
+        int fd = accept4(FD_LIST, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return 0;
+            }
+            fprintf(stderr, "ydotoold: failed to accept client: %s\n", strerror(errno));
+            return 1;
+        }
+
+        struct ydotoold_client * client = malloc(sizeof(*client));
+        if (!client) {
+            fprintf(stderr, "ydotoold: failed to allocate client\n");
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->watch.kind = WATCH_CLIENT;
+        client->watch.client = client;
+        client->ring = NULL;
+        client->fd_ring = -1;
+        client->watch_ring.kind = WATCH_RING;
+        client->watch_ring.client = client;
+        client->armed = 0;
+        client->pending = 0;
+        client->job = NULL;
+        client->proto = 0;
+        client->motion_end_us = 0;
+        client->due_us = 0;
+        memset(client->keys, 0, sizeof(client->keys));
+        client->hangup = 0;
+        client->framer.len = 0;
+        client->framer.overflow = 0;
+        client->len = 0;
+
+        // Greet the client first, so that it never sends a legacy daemon anything it would misread.
+        // A fresh socket buffer always has room, and legacy clients never read it
+        struct ydotool_hello hello = { YDOTOOL_PROTOCOL_MAGIC, YDOTOOL_PROTOCOL_VERSION };
+        struct epoll_event ev = { EPOLLIN, { .ptr = &client->watch } };
+        if (send(fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello) || epoll_ctl(FD_EPOLL, EPOLL_CTL_ADD, fd, &ev)) {
+            fprintf(stderr, "ydotoold: failed to set up client: %s\n", strerror(errno));
+            close(fd);
+            free(client);
+            continue;
+        }
+        client->armed = 1;
+
+        printf("ydotoold: accepted client\n");
+    }
+}
+
+/// Print usage string to stderr
+/// @param prog Name of the program (argv[0])
+/// @return 1 (error)
+int ydotoold_usage(const char * prog) {
+    fprintf(stderr,
+        "Usage: %s [--priority <1-99>] [--cpu <n>] [--mlock] [--screen <width>x<height>] [--autorepeat <delay>,<period> | off]\n"
+        "    --help          Show this help\n"
+        "    --priority n    Run the emitter thread with SCHED_FIFO priority n\n"
+        "    --cpu n         Pin the emitter thread to CPU n\n"
+        "    --mlock         Lock all daemon memory to avoid page faults whilst emitting\n"
+        "    --screen wxh    Screen size in pixels spanned by the absolute pointer (default = 1920x1080)\n"
+        "    --autorepeat delay,period\n"
+        "                    Milliseconds before a held key repeats and between repeats, or off\n"
+        "                    (default = 250,33)\n",
+        prog
+    );
+    return 1;
 }
 
 /// Main entrypoint to the ydotool daemon program
+/// @param argc Number of input arguments
+/// @param argv Array of input arguments
 /// @return 0 on success, 1 if error(s)
-int main() {
-    // Setup SIGINT signal handling
+int main(int argc, char ** argv) {
+    int priority = 0;
+    int cpu = -1;
+    int lock = 0;
+
+    enum optlist_t {
+        opt_autorepeat,
+        opt_cpu,
+        opt_help,
+        opt_mlock,
+        opt_priority,
+        opt_screen,
+    };
+
+    static struct option long_options[] = {
+        {"help",     no_argument,       NULL, opt_help    },
+        {"autorepeat", required_argument, NULL, opt_autorepeat},
+        {"cpu",      required_argument, NULL, opt_cpu     },
+        {"mlock",    no_argument,       NULL, opt_mlock   },
+        {"priority", required_argument, NULL, opt_priority},
+        {"screen",   required_argument, NULL, opt_screen  },
+        {NULL,       0,                 NULL, 0           },
+    };
+
+    int opt;
+    while ((opt = getopt_long_only(argc, argv, "h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case opt_autorepeat: {
+                uint32_t delay;
+                uint32_t period;
+                if (!strcmp(optarg, "off")) {
+                    uinput_set_autorepeat(0, 0);
+                } else if (sscanf(optarg, "%" SCNu32 ",%" SCNu32, &delay, &period) == 2 && delay && period) {
+                    uinput_set_autorepeat(delay, period);
+                } else {
+                    fprintf(stderr, "ydotoold: invalid autorepeat %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+            case opt_cpu:
+                cpu = (int)strtol(optarg, NULL, 10);
+                break;
+            case opt_mlock:
+                lock = 1;
+                break;
+            case opt_priority:
+                priority = (int)strtol(optarg, NULL, 10);
+                break;
+            case opt_screen: {
+                uint32_t width;
+                uint32_t height;
+                if (sscanf(optarg, "%" SCNu32 "x%" SCNu32, &width, &height) != 2 || !width || !height) {
+                    fprintf(stderr, "ydotoold: invalid screen size %s\n", optarg);
+                    return 1;
+                }
+                uinput_set_screen_size(width, height);
+                break;
+            }
+            case 'h':
+            case opt_help:
+            case '?':
+            default:
+                return ydotoold_usage(argv[0]);
+        }
+    }
+
+    // Initialise input device. The tablet, touchscreen and gamepad are only created by the emitter
+    // thread on first use, so that they don't hold up startup or show up when nobody uses them
+    if (uinput_init()) {
+        return 1;
+    }
+
+    // Setup SIGINT signal handling, and print statistics on SIGUSR1. Both are only taken whilst
+    // waiting in the event loop, and the emitter thread inherits them blocked
     struct sigaction act;
+    memset(&act, 0, sizeof(act));
     act.sa_handler = &ydotoold_sig_handler;
+    act.sa_flags = SA_RESTART;
     sigaction(SIGINT, &act, NULL);
+    sigaction(SIGUSR1, &act, NULL);
 
-    // Initialise input device
-    if (uinput_init()) {
+    sigset_t signals;
+    sigset_t wait_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, &wait_signals);
+
+    if (lock && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        fprintf(stderr, "ydotoold: failed to lock memory: %s\n", strerror(errno));
+    }
+
+    if (ydotoold_emitter_start(priority, cpu)) {
         return 1;
     }
 
     // Create socket
-	const char * path_socket = "/tmp/.ydotool_socket";
+	const char * path_socket = YDOTOOL_SOCKET_PATH;
 	unlink(path_socket);
-	FD_LIST = socket(AF_UNIX, SOCK_STREAM, 0);
+	FD_LIST = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
 	if (FD_LIST == -1) {
 		fprintf(stderr, "ydotoold: failed to create socket: %s\n", strerror(errno));
@@ -101,24 +1750,121 @@ int main() {
 	chmod(path_socket, open_access);
 	printf("ydotoold: listening on socket %s\n", path_socket);
 
+    // Single threaded event loop for all connections
+    FD_EPOLL = epoll_create1(EPOLL_CLOEXEC);
+    if (FD_EPOLL == -1) {
+        fprintf(stderr, "ydotoold: failed to create epoll instance: %s\n", strerror(errno));
+        return 1;
+    }
+
+    struct epoll_event ev_list = { EPOLLIN, { .ptr = &WATCH_LIST } };
+    if (epoll_ctl(FD_EPOLL, EPOLL_CTL_ADD, FD_LIST, &ev_list)) {
+        fprintf(stderr, "ydotoold: failed to watch socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Timed events are dispatched from the event loop, woken at absolute deadlines
+    ydotool_wheel_init(&WHEEL);
+    FD_TIMER = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event ev_timer = { EPOLLIN, { .ptr = &WATCH_TIMERFD } };
+    if (FD_TIMER == -1 || epoll_ctl(FD_EPOLL, EPOLL_CTL_ADD, FD_TIMER, &ev_timer)) {
+        fprintf(stderr, "ydotoold: failed to create timer: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // The emitter signals when it has made room for frames kept back
+    struct epoll_event ev_space = { EPOLLIN, { .ptr = &WATCH_SPACEFD } };
+    if (epoll_ctl(FD_EPOLL, EPOLL_CTL_ADD, FD_SPACE, &ev_space)) {
+        fprintf(stderr, "ydotoold: failed to watch emission queue: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Default timer slack of 50us would be most of a frame at high rates
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
     // Wait for tasks
-    int fd_client = 0;
-	while ((fd_client = accept(FD_LIST, NULL, NULL))) {
-		printf("ydotoold: accepted client\n");
+    for (;;) {
+        // Don't wait for anything while clients have work left that can be carried on with
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int timeout = PENDING && BACKLOG_HEAD == BACKLOG_TAIL ? 0 : -1;
+        int n = epoll_pwait(FD_EPOLL, events, MAX_EPOLL_EVENTS, timeout, &wait_signals);
+        if (SIG_STATS) {
+            SIG_STATS = 0;
+            ydotoold_print_stats();
+        }
+        if (SIG_QUIT) {
+            printf("\nReceived %s. Terminating...\n", strsignal(SIG_QUIT));
+            ydotoold_print_stats();
+            break;
+        }
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ydotoold: epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
 
-        pthread_t thd;
-        if (pthread_create(&thd, NULL, ydotoold_client_handler, (void *)&fd_client)) {
-            fprintf(stderr, "ydotoold: Error creating thread!\n");
-            return 1;
+        for (int i = 0; i != n; ++i) {
+            struct ydotoold_watch * watch = events[i].data.ptr;
+            switch (watch->kind) {
+                case WATCH_LISTEN:
+                    ydotoold_accept();
+                    break;
+                case WATCH_CLIENT:
+                    if (watch->client->fd != -1) {
+                        ydotoold_client_pump(watch->client);
+                    }
+                    break;
+                case WATCH_RING:
+                    if (watch->client->fd != -1) {
+                        eventfd_t value;
+                        eventfd_read(watch->client->fd_ring, &value);
+                        ydotoold_client_pump(watch->client);
+                    }
+                    break;
+                case WATCH_TIMER: {
+                    uint64_t expirations;
+                    if (read(FD_TIMER, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                        ydotoold_timer_dispatch();
+                    }
+                    break;
+                }
+                case WATCH_SPACE: {
+                    eventfd_t value;
+                    eventfd_read(FD_SPACE, &value);
+                    ydotoold_backlog_drain();
+                    break;
+                }
+            }
         }
 
-        if (pthread_detach(thd)) {
-            fprintf(stderr, "ydotoold: Error detaching thread!\n");
-            return 1;
+        // Carry on with left over work once the emitter has caught up, one turn per client
+        if (BACKLOG_HEAD == BACKLOG_TAIL) {
+            struct ydotoold_client * client = PENDING;
+            PENDING = NULL;
+            while (client) {
+                struct ydotoold_client * next = client->next_pending;
+                client->pending = 0;
+                if (client->fd != -1) {
+                    ydotoold_client_pump(client);
+                }
+                client = next;
+            }
         }
-	}
 
-    // If socket become invalidated, destroy input device and close socket
+        while (CLOSED) {
+            struct ydotoold_client * next = CLOSED->next_closed;
+            free(CLOSED);
+            CLOSED = next;
+        }
+    }
+
+    // If socket become invalidated, emit everything still waiting before destroying the input
+    // device and closing the socket
+    close(FD_EPOLL);
+    ydotoold_timer_flush();
+    ydotoold_emitter_stop();
     if (uinput_destroy() || close(FD_LIST)) {
         return 1;
     }